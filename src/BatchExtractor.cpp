@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BatchExtractor.h"
+#include "LBPImage.h"
+#include "LBPDescriptor.h"
+#include <QRunnable>
+#include <QThread>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QtGlobal>
+#include <algorithm>
+#include <vector>
+
+using namespace cv;
+
+// Number of images in one work unit. Small enough to balance the workers,
+// big enough to keep the counter from bouncing between cores.
+const int CHUNK_SIZE = 8;
+
+struct BatchExtractor::Batch
+{
+    Batch(const QVector<Mat> &images, const int descriptor, Mat &histograms) :
+        images(images),
+        descriptor(descriptor),
+        histograms(histograms),
+        nextImage(0) {}
+
+    const QVector<Mat> &images;
+    const int descriptor;
+    Mat &histograms;
+
+    QAtomicInt nextImage;
+    QSemaphore workersDone;
+};
+
+class BatchExtractor::Worker : public QRunnable
+{
+public:
+    Worker(Batch &batch, LBPScratch &scratch) :
+        batch(batch),
+        scratch(scratch)
+    {
+    }
+
+    void run()
+    {
+        extractBatch(batch, scratch);
+        batch.workersDone.release();
+    }
+
+private:
+    Batch &batch;
+    LBPScratch &scratch;
+
+};
+
+BatchExtractor::BatchExtractor(const int threadCount) :
+    workerCount(threadCount > 0 ? threadCount : QThread::idealThreadCount())
+{
+    workerCount = qMax(workerCount, 1);
+
+    // The calling thread is one of the workers.
+    pool.setMaxThreadCount(qMax(workerCount - 1, 1));
+}
+
+BatchExtractor::~BatchExtractor()
+{
+    pool.waitForDone();
+}
+
+void BatchExtractor::extract(const QVector<Mat> &images, const int descriptor, Mat &histograms)
+{
+    histograms.create(images.size(), LBPImage::histogramSize(), CV_32FC1);
+
+    Batch batch(images, descriptor, histograms);
+
+    // A single chunk is not worth waking up the pool.
+    const int chunkCount = (images.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    const int batchWorkers = qBound(1, chunkCount, workerCount);
+
+    std::vector<LBPScratch> scratches(batchWorkers);
+
+    for (int i = 1; i < batchWorkers; i++)
+    {
+        pool.start(new Worker(batch, scratches[i]));
+    }
+
+    extractBatch(batch, scratches[0]);
+
+    batch.workersDone.acquire(batchWorkers - 1);
+}
+
+void BatchExtractor::extractBatch(Batch &batch, LBPScratch &scratch)
+{
+    for (;;)
+    {
+        const int first = batch.nextImage.fetchAndAddRelaxed(CHUNK_SIZE);
+        if (first >= batch.images.size())
+        {
+            return;
+        }
+
+        const int last = qMin(first + CHUNK_SIZE, batch.images.size());
+        for (int i = first; i < last; i++)
+        {
+            float *row = batch.histograms.ptr<float>(i);
+            if (!LBPImage::calcHistogram(batch.images.at(i), batch.descriptor, scratch, row))
+            {
+                std::fill(row, row + batch.histograms.cols, 0.0f);
+            }
+        }
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BATCHEXTRACTOR_H
+#define BATCHEXTRACTOR_H
+
+#include "opencv2/opencv.hpp"
+#include <QThreadPool>
+#include <QVector>
+
+class LBPScratch;
+
+/**
+ * @brief Multi-threaded calculation of the histograms of many face images.
+ *
+ * This is for bulk enrollment and re-indexing. The images are split into
+ * chunks, which the workers take in turn. Each worker of a batch has its own
+ * buffers (see LBPScratch), which it reuses for all images it calculates.
+ * The state of a batch is local to extract(), so batches can be extracted
+ * from several threads at once with the same extractor.
+ */
+class BatchExtractor
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param threadCount   Number of worker threads. If zero or negative,
+     *                      one thread per processor core is used.
+     */
+    explicit BatchExtractor(const int threadCount = 0);
+    ~BatchExtractor();
+
+    int threadCount() const     { return workerCount; }
+
+    /**
+     * @brief Calculate the histograms of the given images.
+     *
+     * Blocks until all histograms are calculated. The calling thread works
+     * on the batch too.
+     *
+     * @param images        Aligned grayscale and 8-bit face images.
+     * @param descriptor    LBP_DESCRIPTOR_R1P8 or LBP_DESCRIPTOR_R2P8.
+     * @param histograms    N x LBPImage::histogramSize() float matrix, which
+     *                      gets the histogram of images[i] (as given by
+     *                      LBPImage::histogram()) on row i. Rows of invalid
+     *                      images are zero. Reallocated only if it is not of
+     *                      that size and type.
+     */
+    void extract(const QVector<cv::Mat> &images, const int descriptor, cv::Mat &histograms);
+
+private:
+    struct Batch;
+    class Worker;
+
+    static void extractBatch(Batch &batch, LBPScratch &scratch);
+
+private:
+    int workerCount;
+
+    QThreadPool pool;
+
+};
+
+#endif // BATCHEXTRACTOR_H
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BatchedSearch.h"
+#include "LBPImage.h"
+#include <QtGlobal>
+
+using namespace cv;
+
+BatchedSearch::BatchedSearch(const int tileBytes) :
+    tileBytes(qMax(tileBytes, 1)),
+    version(0),
+    isBuilt(false)
+{
+}
+
+void BatchedSearch::update(const Database::Snapshot &snapshot)
+{
+    if (isBuilt && snapshot.version() == version)
+    {
+        return;
+    }
+
+    version = snapshot.version();
+    isBuilt = true;
+
+    entries.clear();
+    entries.reserve(snapshot.histogramCount());
+    tileStarts.clear();
+
+    const int elementSize = CV_ELEM_SIZE(snapshot.histogramType());
+    int bytes = tileBytes;
+
+    for (quint32 personId = 0; personId < snapshot.personCount(); personId++)
+    {
+        for (quint32 trackId = 0; trackId < snapshot.trackCount(personId); trackId++)
+        {
+            for (quint32 histogramId = 0; histogramId < snapshot.histogramCount(personId, trackId); histogramId++)
+            {
+                // Sparse histograms are smaller, so tiles hold more of them.
+                const int size = snapshot.histogramSize(personId, trackId, histogramId) * elementSize;
+                if (bytes + size > tileBytes)
+                {
+                    tileStarts.append(entries.size());
+                    bytes = 0;
+                }
+
+                bytes += size;
+
+                Entry entry;
+                entry.personId = personId;
+                entry.trackId = trackId;
+                entry.histogramId = histogramId;
+                entries.append(entry);
+            }
+        }
+    }
+
+    tileStarts.append(entries.size());
+}
+
+void BatchedSearch::clear()
+{
+    entries.clear();
+    tileStarts.clear();
+    isBuilt = false;
+}
+
+QVector<BatchedSearch::Result> BatchedSearch::search(const Database::Snapshot &snapshot, const QList<Mat> &histograms, const float bound,
+                                                    const SearchDeadline &deadline)
+{
+    QVector<Result> results(histograms.size());
+
+    QList<Mat> galleryHistograms;
+    for (int i = 0; i < histograms.size(); i++)
+    {
+        galleryHistograms.append(LBPImage::toGalleryHistogram(histograms.at(i)));
+    }
+
+    // The best distance of each person for each histogram.
+    const quint32 personCount = snapshot.personCount();
+    std::vector<float> best(static_cast<size_t>(histograms.size()) * personCount, bound);
+
+    for (int t = 0; t + 1 < tileStarts.size(); t++)
+    {
+        // The histograms of the block miss the rest of the tiles alike.
+        if (deadline.isOver())
+        {
+            for (int i = 0; i < results.size(); i++)
+            {
+                results[i].completed = false;
+            }
+
+            break;
+        }
+
+        const int start = tileStarts.at(t);
+        const int end = tileStarts.at(t + 1);
+
+        tile.clear();
+        for (int j = start; j < end; j++)
+        {
+            const Entry &entry = entries.at(j);
+            tile.push_back(snapshot.getHistogram(entry.personId, entry.trackId, entry.histogramId));
+        }
+
+        // The tile stays in the cache while every histogram is compared to it.
+        for (int i = 0; i < galleryHistograms.size(); i++)
+        {
+            const Mat &histogram = galleryHistograms.at(i);
+            if (histogram.empty())
+            {
+                continue;
+            }
+
+            Result &result = results[i];
+            float *personBest = best.data() + static_cast<size_t>(i) * personCount;
+
+            for (int j = start; j < end; j++)
+            {
+                const quint32 personId = entries.at(j).personId;
+
+                int patchesEvaluated;
+                const float distance = LBPImage::galleryDistance(tile[j - start], histogram, personBest[personId], &patchesEvaluated);
+                result.histogramsCompared++;
+                result.patchesEvaluated += patchesEvaluated;
+
+                if (distance < personBest[personId])
+                {
+                    personBest[personId] = distance;
+
+                    if (distance < result.distance)
+                    {
+                        result.distance = distance;
+                        result.personId = personId;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < results.size(); i++)
+    {
+        const float *personBest = best.data() + static_cast<size_t>(i) * personCount;
+
+        for (quint32 personId = 0; personId < personCount; personId++)
+        {
+            if (personBest[personId] < bound)
+            {
+                results[i].personDistances.append(qMakePair(personBest[personId], personId));
+            }
+        }
+    }
+
+    return results;
+}
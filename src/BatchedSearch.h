@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BATCHEDSEARCH_H
+#define BATCHEDSEARCH_H
+
+#include "Database.h"
+#include "SearchDeadline.h"
+#include <QList>
+#include <QPair>
+#include <QVector>
+#include <QtGlobal>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Exact search of the database for a block of histograms at a time.
+ *
+ * Searching histograms one at a time streams the whole database from memory
+ * for each of them. Here the database is split into tiles of consecutive
+ * histograms that fit in the cache, and each tile is compared to all
+ * histograms of the block before moving to the next one, so the database is
+ * streamed once per block. Each histogram keeps its own best distance of
+ * each person, which bounds its comparisons to the person (see
+ * LBPImage::galleryDistance()).
+ */
+class BatchedSearch
+{
+public:
+    struct Result
+    {
+        Result() :
+            distance(std::numeric_limits<float>::max()),
+            personId(std::numeric_limits<quint32>::max()),
+            histogramsCompared(0),
+            patchesEvaluated(0),
+            completed(true) {}
+
+        float distance;                 /**< The smallest distance below the bound. */
+        quint32 personId;               /**< Person of the smallest distance. */
+        QVector<QPair<float, quint32> > personDistances; /**< The smallest distance below the bound of each person. */
+        quint32 histogramsCompared;
+        quint64 patchesEvaluated;
+        bool completed;                 /**< False, if the deadline was over. */
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param tileBytes     Size of the histograms of a tile in bytes.
+     */
+    explicit BatchedSearch(const int tileBytes);
+
+    /**
+     * @brief Split the histograms of the given snapshot into tiles, unless
+     * they have been split already.
+     */
+    void update(const Database::Snapshot &snapshot);
+    void clear();
+
+    /**
+     * @brief Search the snapshot given to the last update() for each of the
+     * given histograms.
+     *
+     * The deadline is checked between the tiles. If it is over, the rest of
+     * the tiles are not searched.
+     *
+     * @param snapshot      The snapshot given to update().
+     * @param histograms    Uniform spatial histograms (as returned by
+     *                      LBPImage::histogram()).
+     * @param bound         Distances bigger than this are not of interest.
+     * @param deadline      The time limit and the stop request of the search.
+     * @return QVector<Result>  The best match and the best distance of each
+     *                          person for each histogram, in the same order.
+     */
+    QVector<Result> search(const Database::Snapshot &snapshot, const QList<cv::Mat> &histograms, const float bound,
+                           const SearchDeadline &deadline = SearchDeadline());
+
+private:
+    struct Entry
+    {
+        quint32 personId;
+        quint32 trackId;
+        quint32 histogramId;
+    };
+
+    int tileBytes;
+
+    quint64 version;
+    bool isBuilt;
+
+    QVector<Entry> entries;     // Histograms of the snapshot.
+    QVector<int> tileStarts;    // First entry of each tile, and the end.
+
+    // Buffer of the search, kept to avoid reallocating it.
+    std::vector<cv::Mat> tile;
+
+};
+
+#endif // BATCHEDSEARCH_H
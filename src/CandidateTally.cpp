@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CandidateTally.h"
+#include "Constants.h"
+#include <algorithm>
+
+struct LessMinDistance
+{
+    bool operator()(const SearchCandidate &c1, const SearchCandidate &c2) const
+    {
+        return c1.minDistance < c2.minDistance;
+    }
+};
+
+struct LessMeanBestDistance
+{
+    bool operator()(const SearchCandidate &c1, const SearchCandidate &c2) const
+    {
+        return c1.meanBestDistance < c2.meanBestDistance ||
+               (c1.meanBestDistance == c2.meanBestDistance && c1.minDistance < c2.minDistance);
+    }
+};
+
+struct MoreVotes
+{
+    bool operator()(const SearchCandidate &c1, const SearchCandidate &c2) const
+    {
+        return c1.votes > c2.votes ||
+               (c1.votes == c2.votes && c1.minDistance < c2.minDistance);
+    }
+};
+
+CandidateTally::CandidateTally(const int bestCount) :
+    bestCount(qMax(bestCount, 1)),
+    frames(0),
+    matchedFrames(0)
+{
+}
+
+void CandidateTally::clear()
+{
+    frames = 0;
+    matchedFrames = 0;
+    tallies.clear();
+}
+
+void CandidateTally::add(const float distance, const quint32 personId, const QVector<QPair<float, quint32> > &personDistances)
+{
+    frames++;
+
+    if (personId == std::numeric_limits<quint32>::max())
+    {
+        return;
+    }
+
+    matchedFrames++;
+    tallies[personId].votes++;
+
+    if (personDistances.isEmpty())
+    {
+        addDistance(personId, distance);
+        return;
+    }
+
+    for (int i = 0; i < personDistances.size(); i++)
+    {
+        addDistance(personDistances.at(i).second, personDistances.at(i).first);
+    }
+}
+
+void CandidateTally::addDistance(const quint32 personId, const float distance)
+{
+    Tally &tally = tallies[personId];
+    tally.minDistance = qMin(tally.minDistance, distance);
+
+    // Insert to the sorted distances, dropping the biggest one.
+    if (tally.best.size() < bestCount || distance < tally.best.last())
+    {
+        tally.best.insert(std::upper_bound(tally.best.begin(), tally.best.end(), distance), distance);
+
+        if (tally.best.size() > bestCount)
+        {
+            tally.best.removeLast();
+        }
+    }
+}
+
+QVector<SearchCandidate> CandidateTally::candidates(const int count, const int ranking) const
+{
+    QVector<SearchCandidate> all;
+    all.reserve(tallies.size());
+
+    for (QHash<quint32, Tally>::const_iterator i = tallies.constBegin(); i != tallies.constEnd(); ++i)
+    {
+        const Tally &tally = i.value();
+
+        SearchCandidate candidate;
+        candidate.personId = i.key();
+        candidate.minDistance = tally.minDistance;
+        candidate.votes = tally.votes;
+
+        float sum = 0.0f;
+        for (int j = 0; j < tally.best.size(); j++)
+        {
+            sum += tally.best.at(j);
+        }
+
+        candidate.meanBestDistance = sum / tally.best.size();
+        all.append(candidate);
+    }
+
+    const int size = qBound(0, count, all.size());
+
+    switch (ranking)
+    {
+    case CANDIDATE_RANKING_MEAN_BEST:
+        std::partial_sort(all.begin(), all.begin() + size, all.end(), LessMeanBestDistance());
+        break;
+    case CANDIDATE_RANKING_VOTES:
+        std::partial_sort(all.begin(), all.begin() + size, all.end(), MoreVotes());
+        break;
+    default:
+        std::partial_sort(all.begin(), all.begin() + size, all.end(), LessMinDistance());
+        break;
+    }
+
+    all.resize(size);
+
+    return all;
+}
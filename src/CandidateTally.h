@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CANDIDATETALLY_H
+#define CANDIDATETALLY_H
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <QMetaType>
+#include <QtGlobal>
+#include <limits>
+
+/**
+ * @brief A person matched by the frames of one search, with the scores
+ * aggregated over the frames.
+ */
+struct SearchCandidate
+{
+    SearchCandidate() :
+        personId(std::numeric_limits<quint32>::max()),
+        minDistance(std::numeric_limits<float>::max()),
+        meanBestDistance(std::numeric_limits<float>::max()),
+        votes(0) {}
+
+    quint32 personId;
+    float minDistance;          /**< The smallest distance of the frames. */
+    float meanBestDistance;     /**< Mean of the SEARCH_CANDIDATE_BEST_COUNT smallest distances. */
+    quint32 votes;              /**< Number of frames whose best match was the person. */
+};
+
+Q_DECLARE_METATYPE(SearchCandidate)
+
+/**
+ * @brief Tally of the results of the frames of one search by person.
+ *
+ * Each searched frame gives its best match (or no match) and, if the search
+ * was exhaustive, the best distance of every person below the threshold.
+ * The tally keeps, for each person, the smallest distance, the number of
+ * frames it was the best match of and its few smallest distances, so the
+ * candidates can be ranked without keeping the results of the frames.
+ * Searches that stop at the first match only give the match, so the
+ * distances of the other persons are missing from their tallies.
+ */
+class CandidateTally
+{
+public:
+    /**
+     * @brief Constructor.
+     *
+     * @param bestCount     Number of smallest distances averaged per person.
+     */
+    explicit CandidateTally(const int bestCount);
+
+    void clear();
+
+    /**
+     * @brief Add the result of a frame.
+     *
+     * @param distance  The distance of the best match.
+     * @param personId  The person of the best match, or the maximum value of
+     *                  quint32 if the frame didn't match.
+     * @param personDistances   The best distance of each person in the
+     *                          frame, including the best match. If empty,
+     *                          only the best match is tallied.
+     */
+    void add(const float distance, const quint32 personId,
+             const QVector<QPair<float, quint32> > &personDistances = QVector<QPair<float, quint32> >());
+
+    quint32 frameCount() const          { return frames; }
+    quint32 matchedFrameCount() const   { return matchedFrames; }
+
+    /**
+     * @brief Return the best candidates.
+     *
+     * @param count     Maximum number of candidates.
+     * @param ranking   CANDIDATE_RANKING_MIN, CANDIDATE_RANKING_MEAN_BEST or
+     *                  CANDIDATE_RANKING_VOTES.
+     * @return QVector<SearchCandidate>     The candidates, best first.
+     */
+    QVector<SearchCandidate> candidates(const int count, const int ranking) const;
+
+private:
+    struct Tally
+    {
+        Tally() : minDistance(std::numeric_limits<float>::max()), votes(0) {}
+
+        float minDistance;
+        quint32 votes;
+        QVector<float> best;    // The smallest distances in increasing order.
+    };
+
+    void addDistance(const quint32 personId, const float distance);
+
+    int bestCount;
+
+    quint32 frames;
+    quint32 matchedFrames;
+    QHash<quint32, Tally> tallies;
+
+};
+
+#endif // CANDIDATETALLY_H
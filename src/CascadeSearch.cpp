@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CascadeSearch.h"
+#include "LBPImage.h"
+#include "Constants.h"
+#include <QFileInfo>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+
+CascadeSearch::CascadeSearch(const float fraction, const int minCount) :
+    version(0),
+    isBuilt(false),
+    generation(0)
+{
+    setCutoff(fraction, minCount);
+}
+
+void CascadeSearch::setCutoff(const float fraction, const int minCount)
+{
+    this->fraction = qBound(0.0f, fraction, 1.0f);
+    this->minCount = qMax(minCount, 1);
+}
+
+void CascadeSearch::update(const Database::Snapshot &snapshot)
+{
+    if (isBuilt && snapshot.version() == version)
+    {
+        return;
+    }
+
+    // Slots of another arena generation are different histograms.
+    if (!isBuilt || snapshot.arenaGeneration() != generation)
+    {
+        coarseHistograms.clear();
+        coarsened.clear();
+    }
+
+    version = snapshot.version();
+    isBuilt = true;
+    generation = snapshot.arenaGeneration();
+
+    const int coarseSize = LBPImage::coarseHistogramSize();
+
+    entries.clear();
+    entries.reserve(snapshot.histogramCount());
+
+    for (quint32 personId = 0; personId < snapshot.personCount(); personId++)
+    {
+        for (quint32 trackId = 0; trackId < snapshot.trackCount(personId); trackId++)
+        {
+            for (quint32 histogramId = 0; histogramId < snapshot.histogramCount(personId, trackId); histogramId++)
+            {
+                const quint32 slot = snapshot.histogramSlot(personId, trackId, histogramId);
+
+                if (slot >= static_cast<quint32>(coarsened.size()))
+                {
+                    // Grown geometrically, slots are added one at a time.
+                    const int size = qMax(static_cast<int>(slot) + 1, coarsened.size() * 2);
+                    coarsened.resize(size);
+                    coarseHistograms.resize(static_cast<size_t>(size) * coarseSize);
+                }
+
+                if (!coarsened.testBit(slot))
+                {
+                    float *coarse = &coarseHistograms[static_cast<size_t>(slot) * coarseSize];
+                    if (!LBPImage::coarseHistogram(LBPImage::fromGalleryHistogram(snapshot.getHistogram(personId, trackId, histogramId)), coarse))
+                    {
+                        std::fill(coarse, coarse + coarseSize, 0.0f);
+                    }
+
+                    coarsened.setBit(slot);
+                }
+
+                Entry entry;
+                entry.personId = personId;
+                entry.trackId = trackId;
+                entry.histogramId = histogramId;
+                entry.slot = slot;
+                entries.append(entry);
+            }
+        }
+    }
+}
+
+void CascadeSearch::clear()
+{
+    coarseHistograms.clear();
+    coarsened.clear();
+    entries.clear();
+    isBuilt = false;
+}
+
+CascadeSearch::Result CascadeSearch::search(const Database::Snapshot &snapshot, const Mat &histogram, const float bound,
+                                            const SearchDeadline &deadline)
+{
+    Result result;
+
+    const int coarseSize = LBPImage::coarseHistogramSize();
+    query.resize(coarseSize);
+
+    const Mat galleryHistogram = LBPImage::toGalleryHistogram(histogram);
+    if (entries.isEmpty() || galleryHistogram.empty() || !LBPImage::coarseHistogram(histogram, query.data()))
+    {
+        return result;
+    }
+
+    // Score the whole database with the coarse histograms. The coarse
+    // distance is a lower bound, so histograms above the bound are dropped.
+    ranking.clear();
+    for (int i = 0; i < entries.size(); i++)
+    {
+        if (i % SearchDeadline::CHECK_INTERVAL == 0 && deadline.isOver())
+        {
+            result.completed = false;
+            return result;
+        }
+
+        const float coarseDistance = LBPImage::coarseDistance(query.data(), &coarseHistograms[static_cast<size_t>(entries.at(i).slot) * coarseSize]);
+        if (coarseDistance <= bound)
+        {
+            ranking.push_back(qMakePair(coarseDistance, i));
+        }
+    }
+
+    const int cutoff = qMax(minCount, static_cast<int>(std::ceil(fraction * entries.size())));
+    const int count = qMin(cutoff, static_cast<int>(ranking.size()));
+    std::partial_sort(ranking.begin(), ranking.begin() + count, ranking.end());
+
+    float best = bound;
+    for (int i = 0; i < count; i++)
+    {
+        if (i % SearchDeadline::CHECK_INTERVAL == 0 && deadline.isOver())
+        {
+            result.completed = false;
+            break;
+        }
+
+        // The rest can't be nearer than the best one.
+        if (ranking.at(i).first > best)
+        {
+            break;
+        }
+
+        const Entry &entry = entries.at(ranking.at(i).second);
+
+        int patchesEvaluated;
+        const float distance = LBPImage::galleryDistance(snapshot.getHistogram(entry.personId, entry.trackId, entry.histogramId), galleryHistogram,
+                                                         best, &patchesEvaluated);
+        result.histogramsCompared++;
+        result.patchesEvaluated += patchesEvaluated;
+
+        if (distance < best)
+        {
+            best = distance;
+            result.distance = distance;
+            result.personId = entry.personId;
+        }
+    }
+
+    return result;
+}
+
+CascadeSearch::Evaluation CascadeSearch::evaluate(const Database::Snapshot &snapshot, const QList<Mat> &queries, const float bound)
+{
+    Evaluation evaluation;
+
+    update(snapshot);
+
+    for (int i = 0; i < queries.size(); i++)
+    {
+        const Mat galleryHistogram = LBPImage::toGalleryHistogram(queries.at(i));
+        if (galleryHistogram.empty())
+        {
+            continue;
+        }
+
+        // The exhaustive search, in the same order.
+        float nearest = bound;
+        quint32 nearestPersonId = std::numeric_limits<quint32>::max();
+
+        for (int j = 0; j < entries.size(); j++)
+        {
+            const Entry &entry = entries.at(j);
+            const float distance = LBPImage::galleryDistance(snapshot.getHistogram(entry.personId, entry.trackId, entry.histogramId), galleryHistogram,
+                                                             nearest);
+            if (distance < nearest)
+            {
+                nearest = distance;
+                nearestPersonId = entry.personId;
+            }
+        }
+
+        const Result result = search(snapshot, queries.at(i), bound);
+
+        evaluation.queryCount++;
+        evaluation.cascadeComparisons += result.histogramsCompared;
+        evaluation.exhaustiveComparisons += entries.size();
+
+        if (result.personId == nearestPersonId)
+        {
+            evaluation.samePerson++;
+        }
+
+        if (nearestPersonId == std::numeric_limits<quint32>::max() || result.distance <= nearest)
+        {
+            evaluation.sameNearest++;
+        }
+    }
+
+    return evaluation;
+}
+
+static bool loadDatabase(Database &db, const QString &filename)
+{
+    // Only the histograms are read, so no journal is started.
+    return QFileInfo(filename).suffix() == "fgb" ? db.loadGallery(filename, true) : db.load(filename, true);
+}
+
+bool CascadeSearch::evaluateFiles(const QString &galleryFilename, const QString &testFilename, const float fraction, const int minCount)
+{
+    Database gallery;
+    Database test;
+
+    if (!loadDatabase(gallery, galleryFilename) || !loadDatabase(test, testFilename))
+    {
+        return false;
+    }
+
+    const Database::SnapshotPointer testSnapshot = test.snapshot();
+
+    QList<Mat> queries;
+    for (quint32 personId = 0; personId < testSnapshot->personCount(); personId++)
+    {
+        for (quint32 trackId = 0; trackId < testSnapshot->trackCount(personId); trackId++)
+        {
+            for (quint32 histogramId = 0; histogramId < testSnapshot->histogramCount(personId, trackId); histogramId++)
+            {
+                queries.append(LBPImage::fromGalleryHistogram(testSnapshot->getHistogram(personId, trackId, histogramId)));
+            }
+        }
+    }
+
+    const Database::SnapshotPointer gallerySnapshot = gallery.snapshot();
+
+    CascadeSearch cascade(fraction, minCount);
+    const Evaluation evaluation = cascade.evaluate(*gallerySnapshot, queries, HISTOGRAM_DISTANCE_THRESHOLD);
+
+    if (evaluation.queryCount == 0)
+    {
+        qDebug() << "No queries in the test file:" << testFilename;
+
+        return false;
+    }
+
+    qDebug() << qPrintable(QString("Cascade (fraction %1, min %2): %3 queries, nearest found: %4 %, same person: %5 %, full comparisons: %6 %")
+                           .arg(fraction)
+                           .arg(minCount)
+                           .arg(evaluation.queryCount)
+                           .arg(100.0 * evaluation.sameNearest / evaluation.queryCount, 0, 'f', 2)
+                           .arg(100.0 * evaluation.samePerson / evaluation.queryCount, 0, 'f', 2)
+                           .arg(evaluation.exhaustiveComparisons > 0 ?
+                                    100.0 * evaluation.cascadeComparisons / evaluation.exhaustiveComparisons : 0.0, 0, 'f', 2));
+
+    return true;
+}
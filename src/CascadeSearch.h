@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CASCADESEARCH_H
+#define CASCADESEARCH_H
+
+#include "Database.h"
+#include "SearchDeadline.h"
+#include <QBitArray>
+#include <QList>
+#include <QString>
+#include <QVector>
+#include <QPair>
+#include <QtGlobal>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Coarse-to-fine search of the database.
+ *
+ * The whole database is first scored with the coarse histograms (see
+ * LBPImage::coarseHistogram()), which have a fourth of the bins of the full
+ * histograms. Only the best scoring fraction of the histograms is compared
+ * with the full weighted Chi square distance, in the order of their coarse
+ * distances.
+ *
+ * The coarse distance is a lower bound of the full distance, so histograms
+ * whose coarse distance is bigger than the bound are never candidates, and
+ * the comparing ends when the coarse distance of the next candidate is bigger
+ * than the best full distance. Only the cutoff of the fraction can lose the
+ * nearest histogram.
+ *
+ * The coarse histograms are kept by arena slot (2124 bytes per histogram), so
+ * only the histograms added since the last update are coarsened.
+ */
+class CascadeSearch
+{
+public:
+    struct Result
+    {
+        Result() :
+            distance(std::numeric_limits<float>::max()),
+            personId(std::numeric_limits<quint32>::max()),
+            histogramsCompared(0),
+            patchesEvaluated(0),
+            completed(true) {}
+
+        float distance;                 /**< The smallest distance below the bound. */
+        quint32 personId;               /**< Person of the smallest distance. */
+        quint32 histogramsCompared;     /**< Comparisons with the full distance. */
+        quint64 patchesEvaluated;       /**< Patches compared in them. */
+        bool completed;                 /**< False, if the deadline was over. */
+    };
+
+    /**
+     * @brief Accuracy of the cascade against the exhaustive search.
+     */
+    struct Evaluation
+    {
+        Evaluation() : queryCount(0), sameNearest(0), samePerson(0), cascadeComparisons(0), exhaustiveComparisons(0) {}
+
+        quint32 queryCount;
+        quint32 sameNearest;            /**< Queries whose nearest distance was found. */
+        quint32 samePerson;             /**< Queries with the same result person (or both not found). */
+        quint64 cascadeComparisons;     /**< Full comparisons of the cascade. */
+        quint64 exhaustiveComparisons;  /**< Full comparisons of the exhaustive search. */
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param fraction  Fraction of the histograms compared with the full
+     *                  distance.
+     * @param minCount  Minimum number of histograms compared with the full
+     *                  distance.
+     */
+    CascadeSearch(const float fraction, const int minCount);
+
+    void setCutoff(const float fraction, const int minCount);
+    float getFraction() const   { return fraction; }
+    int getMinCount() const     { return minCount; }
+
+    /**
+     * @brief Coarsen the histograms of the given snapshot, unless they have
+     * been coarsened already.
+     */
+    void update(const Database::Snapshot &snapshot);
+    void clear();
+
+    /**
+     * @brief Search the snapshot given to the last update().
+     *
+     * @param snapshot      The snapshot given to update().
+     * @param histogram     A uniform spatial histogram (as returned by
+     *                      LBPImage::histogram()).
+     * @param bound         Distances bigger than this are not of interest.
+     * @param deadline      The time limit and the stop request of the search.
+     *                      If it is over, the search returns the best match
+     *                      found so far.
+     * @return Result       The best match of the compared candidates.
+     */
+    Result search(const Database::Snapshot &snapshot, const cv::Mat &histogram, const float bound,
+                  const SearchDeadline &deadline = SearchDeadline());
+
+    /**
+     * @brief Compare the cascade to the exhaustive search.
+     *
+     * @param snapshot      The gallery.
+     * @param queries       Uniform spatial histograms of the test set.
+     * @param bound         The distance threshold.
+     */
+    Evaluation evaluate(const Database::Snapshot &snapshot, const QList<cv::Mat> &queries, const float bound);
+
+    /**
+     * @brief Evaluate the cascade with the histograms of a test database file
+     * as queries against a gallery database file (.fdb or .fgb), and log the
+     * accuracy loss.
+     */
+    static bool evaluateFiles(const QString &galleryFilename, const QString &testFilename, const float fraction, const int minCount);
+
+private:
+    struct Entry
+    {
+        quint32 personId;
+        quint32 trackId;
+        quint32 histogramId;
+        quint32 slot;
+    };
+
+    float fraction;
+    int minCount;
+
+    quint64 version;
+    bool isBuilt;
+    quint32 generation;
+
+    std::vector<float> coarseHistograms; // LBPImage::coarseHistogramSize() floats per arena slot.
+    QBitArray coarsened;                 // Slots whose coarse histogram has been computed.
+    QVector<Entry> entries;              // Histograms of the snapshot.
+
+    // Buffers of the search, kept to avoid reallocating them.
+    std::vector<float> query;
+    std::vector<QPair<float, int> > ranking;
+
+};
+
+#endif // CASCADESEARCH_H
@@ -39,6 +39,23 @@
 #define MODE_RECOGNIZE_ONLY         1
 #define MODE_TEST                   2
 
+#define SEARCH_MODE_SEQUENTIAL      0
+#define SEARCH_MODE_PARALLEL        1
+#define SEARCH_MODE_EMBEDDED        2
+#define SEARCH_MODE_INDEXED         3
+#define SEARCH_MODE_INVERTED_FILE   4
+#define SEARCH_MODE_QUANTIZED       5
+#define SEARCH_MODE_PIVOT           6
+#define SEARCH_MODE_CASCADE         7
+#define SEARCH_MODE_BATCHED         8
+
+#define CANDIDATE_RANKING_MIN       0
+#define CANDIDATE_RANKING_MEAN_BEST 1
+#define CANDIDATE_RANKING_VOTES     2
+
+#define LBP_DESCRIPTOR_R1P8         0
+#define LBP_DESCRIPTOR_R2P8         1
+
 #define DISPLAY_FRAME_INFO
 //#define DISPLAY_LANDMARK_LABELS
 
@@ -61,11 +78,10 @@ const bool MAINTAIN_VIDEO_FPS = true;
 // Size of the normalized face image.
 const cv::Size ALIGNED_FACE_IMAGE_SIZE(130, 151);
 
-// LBP parameters.
-const int LBP_GRID_X = 7;
-const int LBP_GRID_Y = 7;
-const int EXTENDED_LBP_RADIUS = 2;
-const int EXTENDED_LBP_SAMPLING_POINTS = 8;
+// LBP descriptor: radius 2 or 1 with 8 sampling points (see LBPDescriptor.h).
+// Histograms of different descriptors are not comparable, so a database must
+// be built with a single descriptor.
+const int DEFAULT_LBP_DESCRIPTOR = LBP_DESCRIPTOR_R2P8;
 
 // This parameter specifies how often key frames are taken. It specifies the
 // length of the delta vector (between landmarks of the last and the current key
@@ -84,6 +100,143 @@ const float DOWN_DISTANCE_FACTOR    = 1.64f;
 const quint32 MIN_SEARCH_TIME_MS = 1000;
 const quint32 MAX_SEARCH_TIME_MS = 1000;
 
+// If true, time-constrained search stops before MIN_SEARCH_TIME_MS as soon as
+// the result is certain (see SearchEngine::AnytimeRule): the person of the
+// smallest distance is the best match of at least ANYTIME_MIN_SUPPORT_FRAMES
+// frames and ANYTIME_MIN_VOTE_SHARE of the matched frames, and in
+// SEARCH_MODE_PARALLEL and SEARCH_MODE_BATCHED the smallest distance of any
+// other person in any frame (or the threshold) is at least ANYTIME_MIN_MARGIN
+// bigger. The other modes stop at the first match of a frame and don't know
+// the distances of the other persons, so they need the support only.
+const bool ANYTIME_SEARCH_ENABLED = true;
+const quint32 ANYTIME_MIN_SUPPORT_FRAMES = 3;
+const float ANYTIME_MIN_VOTE_SHARE = 0.8f;
+const float ANYTIME_MIN_MARGIN = 0.05f;
+
+// A person is not found as soon as n frames have been searched without a
+// single match. If a frame of a person in the database matches with
+// probability ANYTIME_FRAME_MATCH_RATE, and the frames match independently,
+// the person is missed with probability (1 - ANYTIME_FRAME_MATCH_RATE)^n, so
+// n = ceil(log(ANYTIME_FALSE_REJECT_RATE) / log(1 - ANYTIME_FRAME_MATCH_RATE))
+// bounds the rejections by ANYTIME_FALSE_REJECT_RATE (10 frames with the
+// values below). Consecutive frames are correlated, so the bound is optimistic
+// and the match rate should be measured at the used threshold.
+const float ANYTIME_FRAME_MATCH_RATE = 0.4f;
+const float ANYTIME_FALSE_REJECT_RATE = 0.01f;
+
+// The search engine compares histograms in slices. A slice ends when this many
+// comparisons are done or when the slice has lasted the given time, whichever
+// comes first. Between the slices the search engine returns to its event loop,
+// so that new histograms and stop requests get handled.
+const quint32 SEARCH_SLICE_SIZE = 4096;
+const quint32 SEARCH_SLICE_TIME_MS = 20;
+
+// SEARCH_MODE_SEQUENTIAL: Persons are visited in turns, one comparison at a
+// time, and the search of a histogram ends at the first match.
+// SEARCH_MODE_PARALLEL: Every histogram is compared to the whole database using
+// multiple threads and the best match is used.
+// SEARCH_MODE_EMBEDDED: Queued histograms are scored against the whole
+// database in blocks of EMBEDDED_SEARCH_BLOCK_SIZE with a matrix product of
+// their Hellinger embeddings, and the best candidates are re-ranked with the
+// exact distance (see EmbeddedSearch). The embeddings are recomputed when the
+// database has changed.
+// SEARCH_MODE_INDEXED: Every histogram is searched with the HNSW index of the
+// database (see HnswIndex). Needs HNSW_INDEX_ENABLED, otherwise
+// SEARCH_MODE_SEQUENTIAL is used.
+// SEARCH_MODE_INVERTED_FILE: Every histogram is compared to the centroids of
+// all tracks, and exactly to the histograms of the nearest tracks only (see
+// InvertedFileSearch).
+// SEARCH_MODE_QUANTIZED: Every histogram is compared to the product quantized
+// codes of the whole database, and the best candidates are re-ranked with the
+// exact distance (see QuantizedSearch). Needs the codebook of the database
+// file, otherwise SEARCH_MODE_SEQUENTIAL is used.
+// SEARCH_MODE_PIVOT: Every histogram is compared to the whole database, but
+// histograms that the distances to pivot histograms show to be too far are
+// skipped (see PivotSearch). The result is exact.
+// SEARCH_MODE_CASCADE: Every histogram is compared to the coarse 3x3 grid
+// histograms of the whole database, and only the best scoring fraction is
+// compared with the full distance (see CascadeSearch).
+// SEARCH_MODE_BATCHED: Queued histograms are compared to the whole database
+// in blocks of BATCHED_SEARCH_BLOCK_SIZE, a cache-sized tile of the database
+// at a time (see BatchedSearch). The results are the same as in SEARCH_MODE_PARALLEL.
+const int DEFAULT_SEARCH_MODE = SEARCH_MODE_SEQUENTIAL;
+
+// Number of threads used in SEARCH_MODE_PARALLEL. Zero means one thread per
+// processor core.
+const int SEARCH_THREAD_COUNT = 0;
+
+// Maximum number of candidates re-ranked with the exact distance per histogram
+// in SEARCH_MODE_EMBEDDED.
+const int EMBEDDED_SEARCH_RERANK_COUNT = 64;
+
+// Maximum number of queued histograms searched by one matrix product in
+// SEARCH_MODE_EMBEDDED. The rest are searched in the next blocks.
+const int EMBEDDED_SEARCH_BLOCK_SIZE = 32;
+
+// If true, SEARCH_MODE_INDEXED searches an HNSW index of the histograms (see
+// HnswIndex), which is built by the first search and written next to the
+// database file. Building the index is slow, so it is off by default, and
+// SEARCH_MODE_INDEXED falls back to SEARCH_MODE_SEQUENTIAL.
+const bool HNSW_INDEX_ENABLED = false;
+
+// Maximum number of links of an index node per level (twice as many on level
+// 0), and the number of best nodes kept when the links of a new node are
+// searched. The bigger, the better the recall and the slower the adding.
+const int HNSW_LINK_COUNT = 16;
+const int HNSW_CONSTRUCTION_WIDTH = 100;
+
+// Number of best nodes kept in SEARCH_MODE_INDEXED. The bigger, the better the
+// recall and the slower the search.
+const int HNSW_SEARCH_WIDTH = 64;
+
+// Number of tracks compared exactly in SEARCH_MODE_INVERTED_FILE. The bigger,
+// the better the recall and the slower the search.
+const int IVF_PROBE_COUNT = 8;
+
+// Number of codewords of each patch in the product quantizer (at most 256, so
+// that a code is a byte), and the number of candidates re-ranked with the
+// exact distance per histogram in SEARCH_MODE_QUANTIZED.
+const int PQ_CODEWORD_COUNT = 256;
+const int PQ_RERANK_COUNT = 256;
+
+// Maximum number of histograms sampled from the database for training the
+// codebooks, and the number of k-means iterations.
+const quint32 PQ_TRAINING_SAMPLE_COUNT = 65536;
+const int PQ_TRAINING_ITERATIONS = 20;
+
+// Number of pivots in SEARCH_MODE_PIVOT. The more pivots, the more histograms
+// are skipped, but the more memory the pivot table takes (4 bytes per pivot
+// per histogram) and the more comparisons each search starts with.
+const int PIVOT_COUNT = 16;
+
+// Cutoff of SEARCH_MODE_CASCADE: the fraction of the database histograms, but
+// at least the given number, with the smallest coarse distances are compared
+// with the full distance. The accuracy loss of a cutoff can be measured with
+//    FaceReco --evaluate-cascade <gallery file> <test file> [fraction] [min]
+const float CASCADE_FRACTION = 0.05f;
+const int CASCADE_MIN_COUNT = 64;
+
+// Size of the histograms of a database tile in SEARCH_MODE_BATCHED. The tile
+// should fit in the L2 cache of a core.
+const int BATCHED_SEARCH_TILE_BYTES = 256 * 1024;
+
+// Maximum number of queued histograms searched as one block in
+// SEARCH_MODE_BATCHED. The rest are searched in the next blocks. The deadline
+// of the search is checked between the tiles, and a bigger block makes the
+// tiles slower.
+const int BATCHED_SEARCH_BLOCK_SIZE = 32;
+
+// Number of candidate persons reported after each search (see
+// SearchEngine::searchCandidates()), and how they are ranked:
+// CANDIDATE_RANKING_MIN: By the smallest distance of the frames.
+// CANDIDATE_RANKING_MEAN_BEST: By the mean of the SEARCH_CANDIDATE_BEST_COUNT
+// smallest distances of the frames.
+// CANDIDATE_RANKING_VOTES: By the number of frames whose best match the
+// person was.
+const int SEARCH_CANDIDATE_COUNT = 5;
+const int SEARCH_CANDIDATE_BEST_COUNT = 3;
+const int DEFAULT_CANDIDATE_RANKING = CANDIDATE_RANKING_MIN;
+
 // If true, every detected face track is processed (even if it have only 1
 // frame).
 const bool SHOW_RESULT_WITH_SHORT_TRACKS = true;
@@ -94,4 +247,38 @@ const bool SHOW_RESULT_WITH_SHORT_TRACKS = true;
 // The smaller the value, the bigger chance to end up selecting no person at all.
 const float HISTOGRAM_DISTANCE_THRESHOLD = 0.37f;
 
+// If true, histograms are kept in the database multiplied by the patch weights
+// (see LBPImage::weightHistogram). This removes the weight multiplication from
+// the search. Database files (.fdb) always contain unweighted histograms.
+const bool STORE_WEIGHTED_HISTOGRAMS = true;
+
+// If true, histograms are kept in the database as 16-bit counts (see
+// LBPImage::quantizeHistogram). This halves the memory of the histograms and
+// the memory traffic of the search. Database files (.fdb) always contain float
+// histograms, and gallery files (.fgb) of the other form are converted when
+// they are loaded.
+const bool STORE_QUANTIZED_HISTOGRAMS = true;
+
+// If true, quantized histograms whose fraction of non-zero bins is at most
+// SPARSE_HISTOGRAM_MAX_DENSITY are kept in the database in a sparse form (see
+// LBPImage::sparseHistogram). The distance to a sparse histogram visits only
+// its non-zero bins, one at a time, so it is faster than the vectorized
+// distance of dense histograms only when the histogram is sparse enough.
+// Gallery files (.fgb) always contain dense histograms, so histograms used
+// from a mapped gallery file stay dense.
+const bool STORE_SPARSE_HISTOGRAMS = true;
+const float SPARSE_HISTOGRAM_MAX_DENSITY = 0.5f;
+
+// If true, changes to a loaded or saved database are appended to a journal
+// file next to the database file, and replayed when the database is loaded.
+const bool JOURNAL_ENABLED = true;
+
+// Journal records are written to the file in batches at this interval.
+const int JOURNAL_FLUSH_INTERVAL_MS = 1000;
+
+// The database file is rewritten and the journal emptied when the journal has
+// grown bigger than the given size. This is checked at the given interval.
+const int JOURNAL_COMPACTION_INTERVAL_MS = 60000;
+const qint64 JOURNAL_COMPACTION_SIZE = 64 * 1024 * 1024;
+
 #endif // CONSTANTS_H
@@ -30,19 +30,73 @@
  */
 
 #include "Database.h"
+#include "GalleryFile.h"
+#include "LBPImage.h"
+#include "Constants.h"
 #include <QMutexLocker>
 #include <QtGlobal>
 #include <QFile>
+#include <QFileInfo>
 #include <QDataStream>
 #include <QDebug>
+#include <QByteArray>
+#include <QScopedPointer>
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <cstring>
 
 using namespace cv;
 
+// Types of the journal records.
+const quint8 JOURNAL_ADD_PERSON = 1;
+const quint8 JOURNAL_ADD_TRACK = 2;
+const quint8 JOURNAL_ADD_HISTOGRAM = 3;
+const quint8 JOURNAL_MERGE_PERSON = 4;
+
+// Database files (.fdb) start with the magic, the version and the LBP
+// descriptor. Files without them are of version 1.
+const quint32 DATABASE_FILE_MAGIC = 0x42444652; // "RFDB"
+const quint32 DATABASE_FILE_VERSION = 2;
+
+// Files of version 1 have no descriptor. They were made with the radius 2
+// descriptor.
+const int VERSION1_LBP_DESCRIPTOR = LBP_DESCRIPTOR_R2P8;
+
+static bool isValidDescriptor(const int descriptor)
+{
+    return descriptor == LBP_DESCRIPTOR_R1P8 || descriptor == LBP_DESCRIPTOR_R2P8;
+}
+
+static void reportProgress(Database::ProgressListener *listener, const quint32 done, const quint32 total)
+{
+    if (listener)
+    {
+        listener->progressChanged(total > 0 ? static_cast<int>(100 * static_cast<quint64>(done) / total) : 100);
+    }
+}
+
 Database::Database() :
+    indexFileGeneration(0),
+    lbpDescriptor(DEFAULT_LBP_DESCRIPTOR),
+    fileEpoch(0),
     totalTrackCount(0),
     totalHistogramCount(0),
-    sizeInBytes(0)
+    sizeInBytes(0),
+    databaseIsGallery(false),
+    currentSnapshot(0),
+    acquiringReaders(0)
+{
+    publishSnapshot();
+}
+
+Database::~Database()
 {
+    Snapshot *snapshot = currentSnapshot.fetchAndStoreOrdered(0);
+    snapshot->refs.deref();
+    retiredSnapshots.append(snapshot);
+
+    // Snapshots still referenced are left alone.
+    reclaimSnapshots();
 }
 
 bool Database::isEmpty() const
@@ -120,7 +174,7 @@ const quint64 Database::size() const
 {
     QMutexLocker locker(&mutex);
 
-    return sizeInBytes;
+    return arena.size();
 }
 
 const quint64 Database::size(quint32 personId) const
@@ -130,12 +184,37 @@ const quint64 Database::size(quint32 personId) const
     if (personId < static_cast<quint32>(persons.size()))
     {
         const Person& person = *persons.at(personId).data();
-        return person.size();
+
+        // The histograms are in the arena, so the size is counted from the
+        // slots of the person.
+        quint64 personSize = 0;
+        for (quint32 trackId = 0; trackId < person.trackCount(); trackId++)
+        {
+            const QVector<quint32> arenaSlots = person.getTrack(trackId).getArenaSlots();
+            for (int i = 0; i < arenaSlots.size(); i++)
+            {
+                personSize += arena.slotSize(arenaSlots.at(i));
+            }
+        }
+
+        return personSize;
     }
 
     return 0;
 }
 
+const float Database::bytesPerHistogram() const
+{
+    QMutexLocker locker(&mutex);
+
+    if (arena.histogramCount() == 0)
+    {
+        return 0.0f;
+    }
+
+    return static_cast<float>(arena.size()) / arena.histogramCount();
+}
+
 const Mat Database::getHistogram(quint32 personId, quint32 trackId, quint32 histogramId) const
 {
     QMutexLocker locker(&mutex);
@@ -198,10 +277,79 @@ const Person* Database::getPerson(quint32 personId) const
     return 0;
 }
 
-quint32 Database::addPerson(QSharedPointer<Person> &person)
+int Database::descriptor() const
+{
+    QMutexLocker locker(&mutex);
+
+    return lbpDescriptor;
+}
+
+bool Database::setDescriptor(const int descriptor)
 {
     QMutexLocker locker(&mutex);
 
+    if (descriptor == lbpDescriptor)
+    {
+        return true;
+    }
+
+    if (!isValidDescriptor(descriptor))
+    {
+        qDebug() << "Invalid LBP descriptor:" << descriptor;
+
+        return false;
+    }
+
+    // The histograms and the file of the journal are of the current
+    // descriptor.
+    if (!persons.isEmpty() || journal.isOpen())
+    {
+        qDebug() << "LBP descriptor can be changed only in an empty database.";
+
+        return false;
+    }
+
+    lbpDescriptor = descriptor;
+
+    // A codebook is trained on histograms of one descriptor.
+    quantizer.clear();
+    publishSnapshot();
+
+    qDebug() << "LBP descriptor of the database set to:" << (descriptor == LBP_DESCRIPTOR_R1P8 ? "R1P8" : "R2P8");
+
+    return true;
+}
+
+quint32 Database::addPerson(QSharedPointer<Person> &person, const int descriptor)
+{
+    QMutexLocker locker(&mutex);
+
+    if (descriptor != lbpDescriptor)
+    {
+        qDebug() << "Histograms of another LBP descriptor can't be added to the database.";
+
+        return INVALID_ID;
+    }
+
+    if (journal.isOpen())
+    {
+        QByteArray record;
+        QDataStream stream(&record, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_2);
+        stream << JOURNAL_ADD_PERSON << *person.data();
+
+        journal.append(record);
+    }
+
+    const quint32 personId = insertPerson(person);
+
+    publishSnapshot();
+
+    return personId;
+}
+
+quint32 Database::insertPerson(QSharedPointer<Person> &person)
+{
     Q_ASSERT(person->histogramCount() > 0);
 
     totalTrackCount += person->trackCount();
@@ -209,8 +357,17 @@ quint32 Database::addPerson(QSharedPointer<Person> &person)
     sizeInBytes += person->size();
 
     const quint32 personId = persons.size();
+    person->attach(arena, personId);
     persons.append(person);
 
+    QVector<QVector<quint32> > tracks;
+    tracks.reserve(person->trackCount());
+    for (quint32 i = 0; i < person->trackCount(); i++)
+    {
+        tracks.append(person->getTrack(i).getArenaSlots());
+    }
+    layout.append(tracks);
+
     // The database now owns and manages the given person object. The caller
     // won't be able to directly access it after resetting the shared pointer.
     person.reset();
@@ -218,10 +375,36 @@ quint32 Database::addPerson(QSharedPointer<Person> &person)
     return personId;
 }
 
-quint32 Database::addTrack(quint32 personId, QSharedPointer<Track> &track)
+quint32 Database::addTrack(quint32 personId, QSharedPointer<Track> &track, const int descriptor)
 {
     QMutexLocker locker(&mutex);
 
+    if (descriptor != lbpDescriptor)
+    {
+        qDebug() << "Histograms of another LBP descriptor can't be added to the database.";
+
+        return INVALID_ID;
+    }
+
+    if (journal.isOpen())
+    {
+        QByteArray record;
+        QDataStream stream(&record, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_2);
+        stream << JOURNAL_ADD_TRACK << personId << *track.data();
+
+        journal.append(record);
+    }
+
+    const quint32 trackId = insertTrack(personId, track);
+
+    publishSnapshot();
+
+    return trackId;
+}
+
+quint32 Database::insertTrack(quint32 personId, QSharedPointer<Track> &track)
+{
     Q_ASSERT(personId < static_cast<quint32>(persons.size()));
     Person& person = *persons.at(personId).data();
 
@@ -230,6 +413,8 @@ quint32 Database::addTrack(quint32 personId, QSharedPointer<Track> &track)
     sizeInBytes += track->size();
 
     const quint32 trackId = person.addTrack(track);
+    track->attach(arena, personId, trackId);
+    layout[personId].append(track->getArenaSlots());
 
     // The database now owns and manages the given track object. The caller
     // won't be able to directly access it after resetting the shared pointer.
@@ -238,26 +423,86 @@ quint32 Database::addTrack(quint32 personId, QSharedPointer<Track> &track)
     return trackId;
 }
 
-quint32 Database::addHistogram(quint32 personId, quint32 trackId, const Mat &histogram)
+quint32 Database::addHistogram(quint32 personId, quint32 trackId, const Mat &histogram, const int descriptor)
 {
     QMutexLocker locker(&mutex);
 
+    if (descriptor != lbpDescriptor)
+    {
+        qDebug() << "Histograms of another LBP descriptor can't be added to the database.";
+
+        return INVALID_ID;
+    }
+
+    // The histogram is journaled only once it is known to be valid, so that
+    // the replay doesn't stop at it.
+    const quint32 histogramId = insertHistogram(personId, trackId, histogram);
+    if (histogramId == INVALID_ID)
+    {
+        return INVALID_ID;
+    }
+
+    if (journal.isOpen())
+    {
+        const char* dataPtr = reinterpret_cast<char*>(histogram.data);
+        const int dataSize = static_cast<int>(histogram.step[0] * histogram.rows);
+
+        QByteArray record;
+        QDataStream stream(&record, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_2);
+        stream << JOURNAL_ADD_HISTOGRAM << personId << trackId <<
+                  histogram.rows << histogram.cols << histogram.type() <<
+                  histogram.step[0] << QByteArray::fromRawData(dataPtr, dataSize);
+
+        journal.append(record);
+    }
+
+    publishSnapshot();
+
+    return histogramId;
+}
+
+quint32 Database::insertHistogram(quint32 personId, quint32 trackId, const Mat &histogram)
+{
     Q_ASSERT(personId < static_cast<quint32>(persons.size()));
     Person& person = *persons[personId].data();
 
+    const quint32 histogramId = person.getTrack(trackId).histogramCount();
+    if (!person.addHistogram(trackId, histogram))
+    {
+        qDebug() << "A histogram that is not valid can't be added to the database.";
+
+        return INVALID_ID;
+    }
+
     totalHistogramCount++;
     sizeInBytes += histogram.step[0] * histogram.rows;
 
-    return person.addHistogram(trackId, histogram);
+    layout[personId][trackId].append(person.getTrack(trackId).getArenaSlots().at(histogramId));
+
+    return histogramId;
 }
 
-bool Database::save(const QString &filename)
+bool Database::save(const QString &filename, ProgressListener *listener)
 {
     QMutexLocker locker(&mutex);
 
-    QFile file(filename);
+    if (journal.isOpen() && filename == databaseFilename && !databaseIsGallery)
+    {
+        // The file and the journal contain everything.
+        return journal.flush();
+    }
+
+    locker.unlock();
+
+    return checkpoint(filename, false, listener);
+}
 
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+bool Database::writeDatabase(const State &state, const QString &filename, ProgressListener *listener)
+{
+    QSaveFile file(filename);
+
+    if (!file.open(QIODevice::WriteOnly))
     {
         qDebug() << "Failed to open a file for writing:" << filename;
 
@@ -267,15 +512,50 @@ bool Database::save(const QString &filename)
     QDataStream fileStream(&file);
     fileStream.setVersion(QDataStream::Qt_5_2);
 
-    const quint32 personCount = persons.size();
-    fileStream << totalTrackCount << totalHistogramCount << sizeInBytes << personCount;
+    const quint32 personCount = state.persons.size();
+    fileStream << DATABASE_FILE_MAGIC << DATABASE_FILE_VERSION << static_cast<qint32>(state.descriptor);
+    fileStream << state.totalTrackCount << state.totalHistogramCount << state.sizeInBytes << personCount;
 
+    // Persons are written in the format of operator<<(QDataStream&, const
+    // Person&), but from the captured state.
+    quint32 histogramsWritten = 0;
     for (quint32 i = 0; i < personCount; i++)
     {
-        fileStream << *persons.at(i).data();
+        const PersonState &person = state.persons.at(i);
+
+        fileStream << static_cast<quint32>(person.tracks.size()) << person.sizeInBytes <<
+                      person.histogramCount << person.name;
+
+        const char* dataPtr = reinterpret_cast<char*>(person.faceImage.data);
+        const int dataSize = static_cast<int>(person.faceImage.step[0] * person.faceImage.rows);
+        fileStream << person.faceImage.rows << person.faceImage.cols << person.faceImage.type() <<
+                      person.faceImage.step[0] << QByteArray::fromRawData(dataPtr, dataSize);
+
+        for (int j = 0; j < person.tracks.size(); j++)
+        {
+            const TrackState &track = person.tracks.at(j);
+
+            fileStream << track.sizeInBytes << static_cast<quint32>(track.arenaSlots.size());
+
+            for (int k = 0; k < track.arenaSlots.size(); k++)
+            {
+                // Files always contain unweighted histograms.
+                const Mat histogram = LBPImage::fromGalleryHistogram(state.arena.histogram(track.arenaSlots.at(k)));
+
+                const char* dataPtr = reinterpret_cast<char*>(histogram.data);
+                const int dataSize = static_cast<int>(histogram.step[0] * histogram.rows);
+
+                fileStream << histogram.rows << histogram.cols << histogram.type() <<
+                              histogram.step[0] << QByteArray::fromRawData(dataPtr, dataSize);
+            }
+
+            histogramsWritten += track.arenaSlots.size();
+            reportProgress(listener, histogramsWritten, state.totalHistogramCount);
+        }
     }
 
-    if (fileStream.status() != QDataStream::Ok)
+    // The file replaces the old one only if everything was written.
+    if (fileStream.status() != QDataStream::Ok || !file.commit())
     {
         qDebug() << "Failed to save database to file:" << filename;
 
@@ -287,10 +567,50 @@ bool Database::save(const QString &filename)
     return true;
 }
 
-bool Database::load(const QString &filename)
+bool Database::load(const QString &filename, const bool readOnly)
 {
     QMutexLocker locker(&mutex);
 
+    // A checkpoint of the same file may be replacing it and its journals.
+    while (filename == checkpointFilename)
+    {
+        checkpointFinished.wait(&mutex);
+    }
+
+    fileEpoch++;
+    journal.close();
+    databaseFilename.clear();
+    quantizer.clear();
+
+    const bool ok = readDatabase(filename);
+    rebuildLayout();
+
+    if (ok)
+    {
+        if (!readOnly)
+        {
+            readIndex(filename);
+        }
+
+        readCodebook(filename);
+
+        // The previous journal exists, if the last checkpoint failed.
+        replayJournal(Journal::previousFilename(filename));
+        replayJournal(Journal::filename(filename));
+
+        if (!readOnly)
+        {
+            startJournal(filename, false, false);
+        }
+    }
+
+    publishSnapshot();
+
+    return ok;
+}
+
+bool Database::readDatabase(const QString &filename)
+{
     QFile file(filename);
 
     if (!file.open(QIODevice::ReadOnly))
@@ -303,10 +623,41 @@ bool Database::load(const QString &filename)
     QDataStream fileStream(&file);
     fileStream.setVersion(QDataStream::Qt_5_2);
 
+    // Files of version 1 start with the track count.
+    quint32 magic;
+    quint32 version = 1;
+    qint32 fileDescriptor = VERSION1_LBP_DESCRIPTOR;
+
+    fileStream >> magic;
+    if (magic == DATABASE_FILE_MAGIC)
+    {
+        fileStream >> version >> fileDescriptor;
+    }
+
+    if (fileStream.status() != QDataStream::Ok ||
+        (version != 1 && version != DATABASE_FILE_VERSION) ||
+        !isValidDescriptor(fileDescriptor))
+    {
+        qDebug() << "Not a valid database file:" << filename;
+
+        return false;
+    }
+
     persons.clear();
+    index.release();
+    arena.clear();
+    lbpDescriptor = fileDescriptor;
 
     quint32 personCount;
-    fileStream >> totalTrackCount >> totalHistogramCount >> sizeInBytes >> personCount;
+    if (version == 1)
+    {
+        totalTrackCount = magic;
+        fileStream >> totalHistogramCount >> sizeInBytes >> personCount;
+    }
+    else
+    {
+        fileStream >> totalTrackCount >> totalHistogramCount >> sizeInBytes >> personCount;
+    }
 
     for (quint32 i = 0; i < personCount; i++)
     {
@@ -314,6 +665,7 @@ bool Database::load(const QString &filename)
 
         fileStream >> *person.data();
 
+        person->attach(arena, i);
         persons.append(person);
     }
 
@@ -329,35 +681,1012 @@ bool Database::load(const QString &filename)
     return true;
 }
 
-void Database::clear()
+bool Database::saveGallery(const QString &filename, ProgressListener *listener)
 {
     QMutexLocker locker(&mutex);
 
-    persons.clear();
-    totalTrackCount = 0;
-    totalHistogramCount = 0;
-    sizeInBytes = 0;
+    if (journal.isOpen() && filename == databaseFilename && databaseIsGallery)
+    {
+        // The file and the journal contain everything.
+        return journal.flush();
+    }
 
-    qDebug() << "Database cleared.";
+    locker.unlock();
+
+    return checkpoint(filename, true, listener);
 }
 
-int Database::mergePerson(const quint32 personId1, const quint32 personId2)
+bool Database::writeGallery(const State &state, const QString &filename, ProgressListener *listener)
+{
+    QSaveFile file(filename);
+
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "Failed to open a file for writing:" << filename;
+
+        return false;
+    }
+
+    GalleryFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, GALLERY_FILE_MAGIC, sizeof(header.magic));
+    header.version = GALLERY_FILE_VERSION;
+    header.descriptor = state.descriptor;
+    header.flags = (STORE_WEIGHTED_HISTOGRAMS ? GALLERY_FLAG_WEIGHTED : 0) |
+                   (state.arena.histogramType() == CV_16UC1 ? GALLERY_FLAG_QUANTIZED : 0);
+    // Sparse histograms are written in the dense form, so that all
+    // histograms of the file are of the same size.
+    const quint64 valueSize = CV_ELEM_SIZE(state.arena.histogramType());
+    header.histogramSize = LBPImage::denseGalleryHistogramSize();
+    header.histogramStride = static_cast<quint32>(alignSize(static_cast<size_t>(header.histogramSize * valueSize), GALLERY_HISTOGRAM_ALIGNMENT) / valueSize);
+    header.personCount = state.persons.size();
+
+    QVector<GalleryPersonEntry> personTable(state.persons.size());
+    QVector<GalleryTrackEntry> trackTable;
+    QList<QByteArray> names;
+    QList<Mat> faceImages;
+
+    quint32 histogramCount = 0;
+    for (int i = 0; i < state.persons.size(); i++)
+    {
+        const PersonState &person = state.persons.at(i);
+
+        GalleryPersonEntry &entry = personTable[i];
+        std::memset(&entry, 0, sizeof(entry));
+
+        entry.firstTrack = trackTable.size();
+        entry.trackCount = person.tracks.size();
+
+        for (int j = 0; j < person.tracks.size(); j++)
+        {
+            const TrackState &track = person.tracks.at(j);
+
+            GalleryTrackEntry trackEntry;
+            trackEntry.sizeInBytes = track.sizeInBytes;
+            trackEntry.firstHistogram = histogramCount;
+            trackEntry.histogramCount = track.arenaSlots.size();
+            trackTable.append(trackEntry);
+
+            histogramCount += track.arenaSlots.size();
+        }
+
+        names.append(person.name.toUtf8());
+        entry.nameSize = names.last().size();
+
+        // Face images are stored in the same format as they are given to
+        // Person::setFaceImage().
+        Mat faceImage;
+        if (!person.faceImage.empty())
+        {
+            cvtColor(person.faceImage, faceImage, CV_RGB2BGR);
+        }
+
+        faceImages.append(faceImage);
+        entry.faceImageRows = faceImage.rows;
+        entry.faceImageCols = faceImage.cols;
+        entry.faceImageType = faceImage.type();
+        entry.faceImageStep = static_cast<quint32>(faceImage.step[0]);
+    }
+
+    header.trackCount = trackTable.size();
+    header.histogramCount = histogramCount;
+
+    // Compute offsets.
+    header.personTableOffset = sizeof(GalleryFileHeader);
+    header.trackTableOffset = header.personTableOffset + personTable.size() * sizeof(GalleryPersonEntry);
+
+    quint64 offset = header.trackTableOffset + trackTable.size() * sizeof(GalleryTrackEntry);
+    for (int i = 0; i < personTable.size(); i++)
+    {
+        personTable[i].nameOffset = offset;
+        offset += names.at(i).size();
+
+        personTable[i].faceImageOffset = offset;
+        offset += faceImages.at(i).step[0] * faceImages.at(i).rows;
+    }
+
+    header.histogramBlockOffset = alignSize(static_cast<size_t>(offset), GALLERY_HISTOGRAM_ALIGNMENT);
+    header.fileSize = header.histogramBlockOffset +
+                      static_cast<quint64>(histogramCount) * header.histogramStride * valueSize;
+
+    // Write.
+    bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    ok = ok && file.write(reinterpret_cast<const char*>(personTable.constData()), personTable.size() * sizeof(GalleryPersonEntry)) ==
+               static_cast<qint64>(personTable.size() * sizeof(GalleryPersonEntry));
+    ok = ok && file.write(reinterpret_cast<const char*>(trackTable.constData()), trackTable.size() * sizeof(GalleryTrackEntry)) ==
+               static_cast<qint64>(trackTable.size() * sizeof(GalleryTrackEntry));
+
+    for (int i = 0; ok && i < personTable.size(); i++)
+    {
+        const Mat &faceImage = faceImages.at(i);
+        const qint64 faceImageSize = faceImage.step[0] * faceImage.rows;
+
+        ok = file.write(names.at(i)) == names.at(i).size();
+        ok = ok && file.write(reinterpret_cast<const char*>(faceImage.data), faceImageSize) == faceImageSize;
+    }
+
+    const QByteArray padding(static_cast<int>(header.histogramBlockOffset - offset), 0);
+    ok = ok && file.write(padding) == padding.size();
+
+    const qint64 histogramBytes = header.histogramSize * valueSize;
+    const QByteArray histogramPadding(static_cast<int>((header.histogramStride - header.histogramSize) * valueSize), 0);
+    quint32 histogramsWritten = 0;
+    for (int i = 0; ok && i < state.persons.size(); i++)
+    {
+        const PersonState &person = state.persons.at(i);
+        for (int j = 0; ok && j < person.tracks.size(); j++)
+        {
+            const QVector<quint32> &slotsOfTrack = person.tracks.at(j).arenaSlots;
+            for (int k = 0; ok && k < slotsOfTrack.size(); k++)
+            {
+                const Mat histogram = LBPImage::denseGalleryHistogram(state.arena.histogram(slotsOfTrack.at(k)));
+
+                ok = histogram.cols == static_cast<int>(header.histogramSize) &&
+                     file.write(reinterpret_cast<const char*>(histogram.data), histogramBytes) == histogramBytes;
+                ok = ok && file.write(histogramPadding) == histogramPadding.size();
+            }
+
+            histogramsWritten += slotsOfTrack.size();
+            reportProgress(listener, histogramsWritten, histogramCount);
+        }
+    }
+
+    // The file replaces the old one only if everything was written.
+    if (!ok || !file.commit())
+    {
+        qDebug() << "Failed to save database to file:" << filename;
+
+        return false;
+    }
+
+    qDebug() << "Database saved to file:" << filename;
+
+    return true;
+}
+
+bool Database::loadGallery(const QString &filename, const bool readOnly)
 {
     QMutexLocker locker(&mutex);
 
-    if (personId1 < static_cast<quint32>(persons.size()) &&
-        personId2 < static_cast<quint32>(persons.size()) &&
-        personId1 != personId2)
+    // A checkpoint of the same file may be replacing it and its journals.
+    while (filename == checkpointFilename)
     {
-        Person& updatedPerson = *persons[personId1].data();
-        const Person& personToAdd = *persons.at(personId2).data();
+        checkpointFinished.wait(&mutex);
+    }
 
-        updatedPerson = updatedPerson + personToAdd;
+    fileEpoch++;
+    journal.close();
+    databaseFilename.clear();
+    quantizer.clear();
 
-        persons.removeAt(personId2);
+    const bool ok = readGallery(filename);
+    rebuildLayout();
 
-        return personId2 > personId1 ? personId1 : personId1 - 1;
+    if (ok)
+    {
+        if (!readOnly)
+        {
+            readIndex(filename);
+        }
+
+        readCodebook(filename);
+
+        // The previous journal exists, if the last checkpoint failed.
+        replayJournal(Journal::previousFilename(filename));
+        replayJournal(Journal::filename(filename));
+
+        if (!readOnly)
+        {
+            startJournal(filename, true, false);
+        }
     }
 
-    return -1;
+    publishSnapshot();
+
+    return ok;
+}
+
+bool Database::readGallery(const QString &filename)
+{
+    QScopedPointer<QFile> file(new QFile(filename));
+
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Failed to open a file for reading:" << filename;
+
+        return false;
+    }
+
+    GalleryFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    const quint64 fileSize = file->size();
+
+    const bool headerRead = file->read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header);
+    const bool fileIsWeighted = (header.flags & GALLERY_FLAG_WEIGHTED) != 0;
+    const bool fileIsQuantized = (header.flags & GALLERY_FLAG_QUANTIZED) != 0;
+    const int fileHistogramType = fileIsQuantized ? CV_16UC1 : CV_32FC1;
+    const quint64 valueSize = CV_ELEM_SIZE(fileHistogramType);
+
+    // Files of version 1 have no descriptor.
+    const int fileDescriptor = header.version == 1 ? VERSION1_LBP_DESCRIPTOR : static_cast<int>(header.descriptor);
+
+    if (!headerRead ||
+        std::memcmp(header.magic, GALLERY_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        (header.version != 1 && header.version != GALLERY_FILE_VERSION) ||
+        !isValidDescriptor(fileDescriptor) ||
+        header.fileSize != fileSize ||
+        header.histogramBlockOffset % GALLERY_HISTOGRAM_ALIGNMENT != 0 ||
+        (header.histogramStride * valueSize) % GALLERY_HISTOGRAM_ALIGNMENT != 0 ||
+        header.histogramStride < header.histogramSize ||
+        header.personTableOffset < sizeof(header) ||
+        header.trackTableOffset + static_cast<quint64>(header.trackCount) * sizeof(GalleryTrackEntry) > header.histogramBlockOffset ||
+        header.personTableOffset + static_cast<quint64>(header.personCount) * sizeof(GalleryPersonEntry) > header.trackTableOffset ||
+        header.histogramBlockOffset + static_cast<quint64>(header.histogramCount) * header.histogramStride * valueSize != fileSize)
+    {
+        qDebug() << "Not a valid gallery file:" << filename;
+
+        return false;
+    }
+
+    // Read the tables and the names and the face images, which are in front
+    // of the histograms.
+    const QByteArray tables = file->read(header.histogramBlockOffset - sizeof(header));
+    if (tables.size() != static_cast<int>(header.histogramBlockOffset - sizeof(header)))
+    {
+        qDebug() << "Failed to load database from a file:" << filename;
+
+        return false;
+    }
+
+    // Offsets are from the beginning of the file.
+    const char *tableData = tables.constData();
+    const quint64 tableOffset = sizeof(header);
+
+    const GalleryPersonEntry *personTable = reinterpret_cast<const GalleryPersonEntry*>(tableData + (header.personTableOffset - tableOffset));
+    const GalleryTrackEntry *trackTable = reinterpret_cast<const GalleryTrackEntry*>(tableData + (header.trackTableOffset - tableOffset));
+
+    // Validate the tables and build the owners of the histograms.
+    QVector<HistogramArena::Owner> owners(header.histogramCount);
+
+    for (quint32 i = 0; i < header.personCount; i++)
+    {
+        const GalleryPersonEntry &entry = personTable[i];
+        const quint64 faceImageSize = static_cast<quint64>(entry.faceImageStep) * entry.faceImageRows;
+
+        if (entry.firstTrack + static_cast<quint64>(entry.trackCount) > header.trackCount ||
+            entry.nameOffset < tableOffset || entry.nameOffset + entry.nameSize > header.histogramBlockOffset ||
+            entry.faceImageOffset < tableOffset || entry.faceImageOffset + faceImageSize > header.histogramBlockOffset ||
+            entry.faceImageRows < 0 || entry.faceImageCols < 0 ||
+            (entry.faceImageRows > 0 && (entry.faceImageType != CV_8UC3 ||
+             static_cast<quint64>(entry.faceImageCols) * CV_ELEM_SIZE(CV_8UC3) > entry.faceImageStep)))
+        {
+            qDebug() << "Not a valid gallery file:" << filename;
+
+            return false;
+        }
+
+        for (quint32 j = 0; j < entry.trackCount; j++)
+        {
+            const GalleryTrackEntry &trackEntry = trackTable[entry.firstTrack + j];
+
+            if (trackEntry.firstHistogram + static_cast<quint64>(trackEntry.histogramCount) > header.histogramCount)
+            {
+                qDebug() << "Not a valid gallery file:" << filename;
+
+                return false;
+            }
+
+            for (quint32 k = 0; k < trackEntry.histogramCount; k++)
+            {
+                HistogramArena::Owner &owner = owners[trackEntry.firstHistogram + k];
+                owner.personId = i;
+                owner.trackId = j;
+            }
+        }
+    }
+
+    persons.clear();
+    index.release();
+    arena.clear();
+    lbpDescriptor = fileDescriptor;
+    totalTrackCount = 0;
+    totalHistogramCount = 0;
+    sizeInBytes = 0;
+
+    // Histograms are used from the file if they are in the form used by the
+    // search. Otherwise they are converted to the arena.
+    if (fileIsWeighted == STORE_WEIGHTED_HISTOGRAMS && fileIsQuantized == STORE_QUANTIZED_HISTOGRAMS)
+    {
+        if (!arena.map(file.take(), header.histogramBlockOffset, owners, fileHistogramType, header.histogramSize, header.histogramStride))
+        {
+            qDebug() << "Failed to map a file to memory:" << filename;
+
+            return false;
+        }
+    }
+    else
+    {
+        const qint64 slotSize = header.histogramStride * valueSize;
+        Mat histogram(1, header.histogramStride, fileHistogramType);
+
+        for (quint32 i = 0; i < header.histogramCount; i++)
+        {
+            if (file->read(reinterpret_cast<char*>(histogram.data), slotSize) != slotSize)
+            {
+                qDebug() << "Failed to load database from a file:" << filename;
+
+                arena.clear();
+
+                return false;
+            }
+
+            // Convert to the plain float histogram, and from there to the
+            // form of the database.
+            Mat h = histogram.colRange(0, header.histogramSize);
+            h = fileIsQuantized ? LBPImage::dequantizeHistogram(h) : h;
+            h = fileIsWeighted ? LBPImage::unweightHistogram(h) : h;
+
+            const Mat galleryHistogram = LBPImage::toGalleryHistogram(h);
+            quint32 slot;
+            if (galleryHistogram.empty() ||
+                !arena.append(galleryHistogram, owners.at(i).personId, owners.at(i).trackId, &slot))
+            {
+                qDebug() << "Not a valid gallery file:" << filename;
+
+                arena.clear();
+
+                return false;
+            }
+        }
+    }
+
+    for (quint32 i = 0; i < header.personCount; i++)
+    {
+        const GalleryPersonEntry &entry = personTable[i];
+
+        QSharedPointer<Person> person(new Person(QString::fromUtf8(tableData + (entry.nameOffset - tableOffset), entry.nameSize)));
+
+        if (entry.faceImageRows > 0)
+        {
+            Mat faceImage;
+            Mat(entry.faceImageRows, entry.faceImageCols, entry.faceImageType,
+                const_cast<char*>(tableData + (entry.faceImageOffset - tableOffset)), entry.faceImageStep).copyTo(faceImage);
+            person->setFaceImage(faceImage);
+        }
+
+        for (quint32 j = 0; j < entry.trackCount; j++)
+        {
+            const GalleryTrackEntry &trackEntry = trackTable[entry.firstTrack + j];
+
+            QSharedPointer<Track> track(new Track);
+            track->attach(arena, i, j, trackEntry.firstHistogram, trackEntry.histogramCount, trackEntry.sizeInBytes);
+            person->addTrack(track);
+        }
+
+        totalTrackCount += person->trackCount();
+        totalHistogramCount += person->histogramCount();
+        sizeInBytes += person->size();
+
+        persons.append(person);
+    }
+
+    qDebug() << "Database loaded from file:" << filename;
+
+    return true;
+}
+
+bool Database::convertToGallery(const QString &databaseFilename, const QString &galleryFilename)
+{
+    Database db;
+
+    return db.load(databaseFilename, true) && db.saveGallery(galleryFilename);
+}
+
+void Database::clear()
+{
+    QMutexLocker locker(&mutex);
+
+    // The database is no longer the one in the file.
+    fileEpoch++;
+    journal.close();
+    databaseFilename.clear();
+    quantizer.clear();
+
+    persons.clear();
+    index.release();
+    arena.clear();
+    lbpDescriptor = DEFAULT_LBP_DESCRIPTOR;
+    indexFilename.clear();
+    totalTrackCount = 0;
+    totalHistogramCount = 0;
+    sizeInBytes = 0;
+    layout.clear();
+
+    publishSnapshot();
+
+    qDebug() << "Database cleared.";
+}
+
+int Database::mergePerson(const quint32 personId1, const quint32 personId2)
+{
+    QMutexLocker locker(&mutex);
+
+    const int personId = merge(personId1, personId2);
+
+    if (personId != -1)
+    {
+        if (journal.isOpen())
+        {
+            QByteArray record;
+            QDataStream stream(&record, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_5_2);
+            stream << JOURNAL_MERGE_PERSON << personId1 << personId2;
+
+            journal.append(record);
+        }
+
+        publishSnapshot();
+    }
+
+    return personId;
+}
+
+int Database::merge(const quint32 personId1, const quint32 personId2)
+{
+    if (personId1 < static_cast<quint32>(persons.size()) &&
+        personId2 < static_cast<quint32>(persons.size()) &&
+        personId1 != personId2)
+    {
+        Person& updatedPerson = *persons[personId1].data();
+        const Person& personToAdd = *persons.at(personId2).data();
+
+        updatedPerson = updatedPerson + personToAdd;
+
+        persons.removeAt(personId2);
+
+        // Update owners of the histograms in the arena. Ids of the persons
+        // after the removed person have changed too.
+        for (int i = qMin(personId1, personId2); i < persons.size(); i++)
+        {
+            persons.at(i)->attach(arena, i);
+        }
+
+        rebuildLayout();
+
+        return personId2 > personId1 ? personId1 : personId1 - 1;
+    }
+
+    return -1;
+}
+
+bool Database::flushJournal()
+{
+    QMutexLocker locker(&mutex);
+
+    return journal.flush();
+}
+
+qint64 Database::journalSize() const
+{
+    QMutexLocker locker(&mutex);
+
+    return journal.size();
+}
+
+bool Database::compact()
+{
+    // A running checkpoint empties the journal anyway, so compaction doesn't
+    // wait for it.
+    if (!checkpointMutex.tryLock())
+    {
+        return true;
+    }
+
+    QMutexLocker locker(&mutex);
+
+    bool ok = true;
+    if (journal.isOpen() && journal.size() > 0)
+    {
+        // The file is taken with the mutex held, so the file written is the
+        // file of the captured state.
+        const QString filename = databaseFilename;
+        ok = writeCheckpoint(locker, filename, databaseIsGallery, 0);
+    }
+
+    locker.unlock();
+    checkpointMutex.unlock();
+
+    return ok;
+}
+
+bool Database::checkpoint(const QString &filename, const bool isGallery, ProgressListener *listener)
+{
+    QMutexLocker checkpointLocker(&checkpointMutex);
+    QMutexLocker locker(&mutex);
+
+    return writeCheckpoint(locker, filename, isGallery, listener);
+}
+
+bool Database::writeCheckpoint(QMutexLocker &locker, const QString &filename, const bool isGallery, ProgressListener *listener)
+{
+    // Called with the checkpoint mutex and the mutex locked. The mutex is
+    // released while the file is written.
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // The file is written to a temporary file, which replaces the old file
+    // only when it is complete. If the old file is mapped, the histograms are
+    // used from the new file after that (see remapGallery()).
+    const bool remap = isGallery && !arena.mappedFilename().isEmpty() &&
+                       QFileInfo(arena.mappedFilename()).absoluteFilePath() == QFileInfo(filename).absoluteFilePath();
+
+    const State state = captureState();
+    const quint32 epoch = fileEpoch;
+
+    // Changes made from now on go to the journal of the file.
+    const bool sameFile = journal.isOpen() && filename == databaseFilename;
+    if (sameFile)
+    {
+        if (!journal.rotate())
+        {
+            return false;
+        }
+    }
+    else
+    {
+        journal.close();
+        QFile::remove(Journal::previousFilename(filename));
+        startJournal(filename, isGallery, true);
+    }
+
+    checkpointFilename = filename;
+    locker.unlock();
+
+    const bool ok = isGallery ? writeGallery(state, filename, listener) : writeDatabase(state, filename, listener);
+
+    if (ok && HNSW_INDEX_ENABLED)
+    {
+        writeIndex(state, filename);
+    }
+
+    locker.relock();
+
+    checkpointFilename.clear();
+    checkpointFinished.wakeAll();
+
+    // If the database was loaded or cleared meanwhile, the journal is of
+    // another file. Loading waits for the checkpoints of the same file.
+    const bool sameDatabase = fileEpoch == epoch;
+
+    if (ok)
+    {
+        // The file contains everything in the previous journal now.
+        QFile::remove(Journal::previousFilename(filename));
+
+        if (sameDatabase)
+        {
+            databaseIsGallery = isGallery;
+        }
+
+        // The arena may have been cleared meanwhile even if the file is the
+        // same.
+        if (remap && sameDatabase && arena.generation() == state.arena.generation())
+        {
+            remapGallery(state, filename);
+        }
+    }
+    else if (!sameFile)
+    {
+        // The journal is of no use without the file.
+        if (sameDatabase)
+        {
+            journal.close();
+            databaseFilename.clear();
+        }
+
+        QFile::remove(Journal::filename(filename));
+    }
+
+    qDebug() << "Checkpoint of" << state.totalHistogramCount << "histograms" <<
+                (ok ? "finished" : "failed") << "in" << timer.elapsed() << "ms:" << filename;
+
+    return ok;
+}
+
+bool Database::remapGallery(const State &state, const QString &filename)
+{
+    // Called with the mutex locked, after the gallery file of the state has
+    // replaced the mapped file. Searches of older snapshots keep the mapping
+    // of the old file until they finish, so nothing is copied.
+
+    QScopedPointer<QFile> file(new QFile(filename));
+
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Failed to open a file for reading:" << filename;
+
+        return false;
+    }
+
+    // The histograms are in the file in the order of the persons and their
+    // tracks.
+    QVector<quint32> fileSlots;
+    for (int i = 0; i < state.persons.size(); i++)
+    {
+        const PersonState &person = state.persons.at(i);
+        for (int j = 0; j < person.tracks.size(); j++)
+        {
+            fileSlots += person.tracks.at(j).arenaSlots;
+        }
+    }
+
+    GalleryFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+
+    if (file->read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+        std::memcmp(header.magic, GALLERY_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.histogramCount != static_cast<quint32>(fileSlots.size()) ||
+        header.fileSize != static_cast<quint64>(file->size()))
+    {
+        qDebug() << "Not a valid gallery file:" << filename;
+
+        return false;
+    }
+
+    if (!arena.remap(file.take(), header.histogramBlockOffset, fileSlots, header.histogramSize, header.histogramStride))
+    {
+        qDebug() << "Failed to map a file to memory:" << filename;
+
+        return false;
+    }
+
+    index.relocate(arena.view());
+    publishSnapshot();
+
+    return true;
+}
+
+Database::State Database::captureState() const
+{
+    // Called with the mutex locked. Only the arena slots of the histograms
+    // are copied.
+
+    State state;
+    state.persons.resize(persons.size());
+
+    for (int i = 0; i < persons.size(); i++)
+    {
+        const Person &person = *persons.at(i).data();
+        PersonState &personState = state.persons[i];
+
+        personState.name = person.getName();
+        personState.faceImage = person.getFaceImage();
+        personState.sizeInBytes = person.size();
+        personState.histogramCount = person.histogramCount();
+        personState.tracks.resize(person.trackCount());
+
+        for (quint32 j = 0; j < person.trackCount(); j++)
+        {
+            const Track &track = person.getTrack(j);
+
+            personState.tracks[j].sizeInBytes = track.size();
+            personState.tracks[j].arenaSlots = track.getArenaSlots();
+        }
+    }
+
+    state.arena = arena.view();
+    state.descriptor = lbpDescriptor;
+    state.totalTrackCount = totalTrackCount;
+    state.totalHistogramCount = totalHistogramCount;
+    state.sizeInBytes = sizeInBytes;
+
+    return state;
+}
+
+void Database::readIndex(const QString &filename)
+{
+    // Called with the mutex locked, when the file has been just loaded. The
+    // index file is read by the first search with the index.
+
+    indexFilename = HNSW_INDEX_ENABLED ? filename : QString();
+    indexFileGeneration = arena.generation();
+}
+
+void Database::readCodebook(const QString &filename)
+{
+    // Called with the mutex locked. Without a codebook the histograms can't
+    // be searched with their codes (see QuantizedSearch).
+
+    QSharedPointer<ProductQuantizer> codebook(new ProductQuantizer);
+
+    if (codebook->read(ProductQuantizer::filename(filename)))
+    {
+        if (codebook->descriptor() != lbpDescriptor)
+        {
+            qDebug() << "Codebook file is of another LBP descriptor:" << ProductQuantizer::filename(filename);
+
+            return;
+        }
+
+        quantizer = codebook;
+    }
+}
+
+void Database::writeIndex(const State &state, const QString &filename)
+{
+    // The histograms of the file are in the order of the persons and the
+    // tracks, and they get their slots in that order when the file is loaded.
+    QVector<quint32> order;
+    order.reserve(state.totalHistogramCount);
+
+    for (int i = 0; i < state.persons.size(); i++)
+    {
+        const PersonState &person = state.persons.at(i);
+        for (int j = 0; j < person.tracks.size(); j++)
+        {
+            order += person.tracks.at(j).arenaSlots;
+        }
+    }
+
+    // An index of the previous version of the file is of no use. If the index
+    // is not up to date, it is not built here.
+    if (index.generation() != state.arena.generation() || index.nodeCount() < state.arena.histogramCount())
+    {
+        QFile::remove(HnswIndex::filename(filename));
+    }
+    else if (!index.write(HnswIndex::filename(filename), order, QFileInfo(filename).size()))
+    {
+        QFile::remove(HnswIndex::filename(filename));
+    }
+}
+
+void Database::startJournal(const QString &filename, const bool isGallery, const bool truncate)
+{
+    // Called with the mutex locked, when the file has been just loaded or a
+    // checkpoint to a new file starts. At the start of a checkpoint, the
+    // journal is truncated, because the file will contain everything before
+    // it.
+
+    databaseFilename = filename;
+    databaseIsGallery = isGallery;
+
+    if (JOURNAL_ENABLED)
+    {
+        journal.open(Journal::filename(filename), truncate);
+    }
+}
+
+void Database::replayJournal(const QString &filename)
+{
+    // Called with the mutex locked.
+
+    const QList<QByteArray> records = Journal::read(filename);
+
+    int i = 0;
+    for (; i < records.size(); i++)
+    {
+        QDataStream stream(records.at(i));
+        stream.setVersion(QDataStream::Qt_5_2);
+
+        quint8 type;
+        stream >> type;
+
+        bool ok = false;
+
+        if (type == JOURNAL_ADD_PERSON)
+        {
+            QSharedPointer<Person> person(new Person);
+            stream >> *person.data();
+
+            ok = stream.status() == QDataStream::Ok && person->histogramCount() > 0;
+            if (ok)
+            {
+                insertPerson(person);
+            }
+        }
+        else if (type == JOURNAL_ADD_TRACK)
+        {
+            quint32 personId;
+            QSharedPointer<Track> track(new Track);
+            stream >> personId >> *track.data();
+
+            ok = stream.status() == QDataStream::Ok && personId < static_cast<quint32>(persons.size());
+            if (ok)
+            {
+                insertTrack(personId, track);
+            }
+        }
+        else if (type == JOURNAL_ADD_HISTOGRAM)
+        {
+            quint32 personId;
+            quint32 trackId;
+            int rows;
+            int cols;
+            int matType;
+            size_t step;
+            QByteArray data;
+            stream >> personId >> trackId >> rows >> cols >> matType >> step >> data;
+
+            // The histogram must be a row of the size and type of the
+            // histograms of the database.
+            ok = stream.status() == QDataStream::Ok &&
+                 personId < static_cast<quint32>(persons.size()) &&
+                 trackId < persons.at(personId)->trackCount() &&
+                 rows == 1 && cols == LBPImage::histogramSize() && matType == CV_32FC1 &&
+                 step == static_cast<size_t>(cols) * CV_ELEM_SIZE(matType) &&
+                 static_cast<quint64>(rows) * step == static_cast<quint64>(data.size());
+            if (ok)
+            {
+                Mat histogram;
+                Mat(rows, cols, matType, data.data(), step).copyTo(histogram);
+
+                ok = insertHistogram(personId, trackId, histogram) != INVALID_ID;
+            }
+        }
+        else if (type == JOURNAL_MERGE_PERSON)
+        {
+            quint32 personId1;
+            quint32 personId2;
+            stream >> personId1 >> personId2;
+
+            ok = stream.status() == QDataStream::Ok && merge(personId1, personId2) != -1;
+        }
+
+        if (!ok)
+        {
+            qDebug() << "Invalid record in a journal file:" << filename;
+            break;
+        }
+    }
+
+    if (i > 0)
+    {
+        qDebug() << "Replayed" << i << "records from a journal file:" << filename;
+    }
+}
+
+HnswIndex::Result Database::searchIndex(const Mat &histogram, const int ef, const float bound, quint32 *personId) const
+{
+    if (!HNSW_INDEX_ENABLED)
+    {
+        return HnswIndex::Result();
+    }
+
+    // The index is brought up to date with the latest snapshot. The index has
+    // a lock of its own, so the mutex is locked only to look up the index
+    // file and the owner.
+    const SnapshotPointer current = snapshot();
+
+    {
+        QMutexLocker indexLocker(&indexMutex);
+
+        if (index.nodeCount() == 0 || index.generation() != current->arenaGeneration())
+        {
+            QMutexLocker locker(&mutex);
+            const QString filename = indexFileGeneration == current->arenaGeneration() ? indexFilename : QString();
+            locker.unlock();
+
+            if (!filename.isEmpty())
+            {
+                index.read(HnswIndex::filename(filename), current->arena, QFileInfo(filename).size());
+            }
+        }
+
+        index.update(current->arena);
+    }
+
+    HnswIndex::Result result = index.search(histogram, ef, bound);
+
+    if (result.slot != std::numeric_limits<quint32>::max())
+    {
+        QMutexLocker locker(&mutex);
+
+        // The database may have been cleared or loaded meanwhile.
+        if (arena.generation() == current->arenaGeneration() && result.slot < arena.histogramCount())
+        {
+            *personId = arena.owner(result.slot).personId;
+        }
+        else
+        {
+            result = HnswIndex::Result();
+        }
+    }
+
+    return result;
+}
+
+float Database::Snapshot::compression() const
+{
+    if (arena.histogramBytes() == 0)
+    {
+        return 1.0f;
+    }
+
+    const quint64 denseBytes = static_cast<quint64>(arena.histogramCount()) *
+                               LBPImage::denseGalleryHistogramSize() * CV_ELEM_SIZE(arena.histogramType());
+
+    return static_cast<float>(denseBytes) / arena.histogramBytes();
+}
+
+Database::SnapshotPointer Database::snapshot() const
+{
+    // While the reader is counted, the snapshot it reads can't be deleted.
+    acquiringReaders.fetchAndAddOrdered(1);
+
+    const Snapshot *snapshot = currentSnapshot.loadAcquire();
+    snapshot->refs.ref();
+
+    acquiringReaders.fetchAndAddOrdered(-1);
+
+    return SnapshotPointer(snapshot);
+}
+
+void Database::rebuildLayout()
+{
+    // Called with the mutex locked, when the persons are replaced or merged.
+    layout.clear();
+    layout.reserve(persons.size());
+
+    for (int i = 0; i < persons.size(); i++)
+    {
+        const Person &person = *persons.at(i).data();
+
+        QVector<QVector<quint32> > tracks;
+        tracks.reserve(person.trackCount());
+
+        for (quint32 j = 0; j < person.trackCount(); j++)
+        {
+            // Slot vectors are implicitly shared with the tracks.
+            tracks.append(person.getTrack(j).getArenaSlots());
+        }
+
+        layout.append(tracks);
+    }
+}
+
+void Database::publishSnapshot()
+{
+    // Called with the mutex locked.
+
+    Snapshot *snapshot = new Snapshot;
+    Snapshot *previous = currentSnapshot.load();
+
+    snapshot->snapshotVersion = previous ? previous->snapshotVersion + 1 : 0;
+    snapshot->arena = arena.view();
+    snapshot->codebook = quantizer;
+
+    // The layout is implicitly shared, so publishing doesn't copy it.
+    snapshot->layout = layout;
+    snapshot->totalHistogramCount = arena.histogramCount();
+
+    snapshot->refs.ref();
+    currentSnapshot.fetchAndStoreOrdered(snapshot);
+
+    if (previous)
+    {
+        previous->refs.deref();
+        retiredSnapshots.append(previous);
+    }
+
+    reclaimSnapshots();
+}
+
+void Database::reclaimSnapshots()
+{
+    // A reader that is acquiring a snapshot may have read the pointer of a
+    // retired snapshot without incrementing its reference count yet. Readers
+    // that start acquiring after this point get the current snapshot.
+    if (acquiringReaders.loadAcquire() != 0)
+    {
+        return;
+    }
+
+    for (int i = retiredSnapshots.size() - 1; i >= 0; i--)
+    {
+        if (retiredSnapshots.at(i)->refs.loadAcquire() == 0)
+        {
+            delete retiredSnapshots.takeAt(i);
+        }
+    }
 }
@@ -33,17 +33,38 @@
 #define DATABASE_H
 
 #include "Person.h"
+#include "HistogramArena.h"
+#include "HnswIndex.h"
+#include "ProductQuantizer.h"
+#include "Journal.h"
 #include <QList>
+#include <QVector>
 #include <QSharedPointer>
 #include <QMutex>
-#include <QPair>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QAtomicPointer>
 #include <QImage>
-#include <limits>
 
 class Database
 {
 public:
+    class Snapshot;
+    class SnapshotPointer;
+
+    /**
+     * @brief Interface for following the progress of a checkpoint.
+     */
+    class ProgressListener
+    {
+    public:
+        virtual ~ProgressListener() {}
+        virtual void progressChanged(const int percent) = 0;
+    };
+
     Database();
+    ~Database();
 
     bool isEmpty() const;
 
@@ -53,197 +74,430 @@ public:
     const quint32 histogramCount() const;
     const quint32 histogramCount(quint32 personId) const;
     const quint32 histogramCount(quint32 personId, quint32 trackId) const;
+    /**
+     * @brief Return memory used by the histograms of the database in bytes.
+     *
+     * This includes the alignment padding of the histograms, the unused part of
+     * the histogram arena and the side table of the arena.
+     */
     const quint64 size() const;
     const quint64 size(quint32 personId) const;
+    const float bytesPerHistogram() const;
 
     const cv::Mat getHistogram(quint32 personId, quint32 trackId, quint32 histogramId) const;
     QString getName(quint32 personId) const;
     const QImage getFaceImage(quint32 personId) const;
     const Person* getPerson(quint32 personId) const;
 
-    quint32 addPerson(QSharedPointer<Person> &person);
-    quint32 addTrack(quint32 personId, QSharedPointer<Track> &track);
-    quint32 addHistogram(quint32 personId, quint32 trackId, const cv::Mat &histogram);
+    /**
+     * @brief Return the LBP descriptor of the histograms of the database.
+     *
+     * The descriptor is stored in the files of the database and taken from
+     * there when a file is loaded. An empty database has
+     * DEFAULT_LBP_DESCRIPTOR.
+     */
+    int descriptor() const;
+
+    /**
+     * @brief Set the LBP descriptor of an empty database.
+     *
+     * The descriptor can't be changed once the database has persons, or is
+     * journaled to a file of another descriptor. Empty the database first.
+     *
+     * @param descriptor    LBP_DESCRIPTOR_R1P8 or LBP_DESCRIPTOR_R2P8.
+     * @return bool         True, if the database has the descriptor now.
+     */
+    bool setDescriptor(const int descriptor);
 
-    bool save(const QString &filename);
-    bool load(const QString &filename);
+    /**
+     * @brief Add histograms to the database.
+     *
+     * @param descriptor    LBP descriptor of the histograms. If it is not the
+     *                      descriptor of the database, nothing is added.
+     * @return quint32      Id of the added object, or INVALID_ID if the
+     *                      descriptor doesn't match or the histogram is not
+     *                      valid.
+     */
+    quint32 addPerson(QSharedPointer<Person> &person, const int descriptor);
+    quint32 addTrack(quint32 personId, QSharedPointer<Track> &track, const int descriptor);
+    quint32 addHistogram(quint32 personId, quint32 trackId, const cv::Mat &histogram, const int descriptor);
+
+    static const quint32 INVALID_ID = 0xffffffff;
+
+    /**
+     * @brief Save the database to a database file (.fdb).
+     *
+     * After saving (or loading), changes to the database are appended to the
+     * journal of the file (see Journal) if JOURNAL_ENABLED is true. Saving
+     * again to the same file only flushes the journal. Otherwise the file is
+     * written as a checkpoint (see checkpoint()).
+     */
+    bool save(const QString &filename, ProgressListener *listener=0);
+
+    /**
+     * @brief Load the database from a database file, and replay the changes
+     * in the journal of the file.
+     *
+     * @param readOnly      If true, no journal is started and no index file
+     *                      is used, so nothing is written next to the file.
+     *                      For tools that only read the histograms.
+     */
+    bool load(const QString &filename, const bool readOnly=false);
     void clear();
 
-    int mergePerson(const quint32 personId1, const quint32 personId2);
+    /**
+     * @brief Save the database to a binary gallery file (see GalleryFile.h).
+     */
+    bool saveGallery(const QString &filename, ProgressListener *listener=0);
 
-public:
-    struct Indices
-    {
-        Indices() : personId(0), trackId(0), histogramId(0) {}
-        Indices(quint32 i1, quint32 i2, quint32 i3) : personId(i1), trackId(i2), histogramId(i3) {}
+    /**
+     * @brief Load the database from a binary gallery file.
+     *
+     * The histograms are not read, but the file is mapped to memory and the
+     * histograms are used from there. Only the tables, the names and the face
+     * images are read. See load() for readOnly.
+     */
+    bool loadGallery(const QString &filename, const bool readOnly=false);
 
-        bool operator==(const Indices& rhs) const
-        {
-            return this->personId == rhs.personId &&
-                   this->trackId == rhs.trackId &&
-                   this->histogramId == rhs.histogramId;
-        }
+    /**
+     * @brief Convert a database file (.fdb) to a binary gallery file (.fgb).
+     */
+    static bool convertToGallery(const QString &databaseFilename, const QString &galleryFilename);
 
-        bool operator!=(const Indices& rhs) const
-        {
-            return this->personId != rhs.personId ||
-                   this->trackId != rhs.trackId ||
-                   this->histogramId != rhs.histogramId;
-        }
+    bool flushJournal();
+    qint64 journalSize() const;
 
-        quint32 personId;
-        quint32 trackId;
-        quint32 histogramId;
-    };
+    /**
+     * @brief Rewrite the file of the database and empty the journal.
+     *
+     * The file is written as a checkpoint, so the mutex of the database is
+     * held only while the state is captured. Nothing is done if another
+     * checkpoint is running.
+     */
+    bool compact();
+
+    /**
+     * @brief Write the database to a file without blocking the writers.
+     *
+     * The persons and the arena slots of their histograms are captured while
+     * the database is locked, which doesn't copy the histograms. The file is
+     * written from the captured state without the lock, so histograms can be
+     * added meanwhile. The file is written to a temporary file, which replaces
+     * the file only when it has been completely written.
+     *
+     * Changes made during the checkpoint are kept in the journal of the file.
+     * If the file is the current file of the database, the journal is first
+     * moved to the previous journal (see Journal::rotate()), which is removed
+     * when the file has been written. Loading replays both journals.
+     *
+     * Checkpoints are serialized. Loading and clearing don't wait for them,
+     * except that loading the file being written waits until it is done.
+     * This is called by save(), saveGallery() and compact().
+     *
+     * If the file is the mapped gallery file of the database, the new file is
+     * mapped after it has replaced the old one. Searches of older snapshots
+     * keep the mapping of the old file until they finish.
+     *
+     * @param filename      The file to write.
+     * @param isGallery     If true, the file is written as a binary gallery
+     *                      file. Otherwise as a database file.
+     * @param listener      If not null, notified of the progress.
+     * @return bool         True, if the file was written.
+     */
+    bool checkpoint(const QString &filename, const bool isGallery, ProgressListener *listener=0);
+
+    int mergePerson(const quint32 personId1, const quint32 personId2);
 
     /**
-     * @brief Iterator to be used in searching.
+     * @brief Return the latest snapshot of the histograms.
      *
-     * Note: Database must have at least one person and every person must have at
-     * least one track with at least one histogram in order to this iterator to
-     * work.
+     * This method doesn't lock, so it doesn't wait for the writers of the
+     * database. The snapshot doesn't change when histograms are added later.
      */
-    class Iterator
+    SnapshotPointer snapshot() const;
+
+    /**
+     * @brief Find the nearest histogram of the given histogram with the index
+     * of the database (see HnswIndex).
+     *
+     * The index is used only if HNSW_INDEX_ENABLED is true, otherwise
+     * nothing is found. It is not updated by the writers, but here: the
+     * histograms of the latest snapshot that are not in the index yet are
+     * added to it before the search, without the mutex of the database. The
+     * first search reads the index
+     * file of the loaded file, if there is one, and builds the rest. The
+     * index is written next to the file of the database on every checkpoint
+     * if it is up to date. Merging persons only changes the owners of the
+     * histograms, which are looked up when the nearest one is found.
+     *
+     * @param histogram     A histogram in the form returned by
+     *                      LBPImage::toGalleryHistogram().
+     * @param ef            Width of the search (see HnswIndex::search()).
+     * @param bound         Distances bigger than this are not of interest.
+     * @param personId      The owner of the nearest histogram is written
+     *                      here, if it was found.
+     */
+    HnswIndex::Result searchIndex(const cv::Mat &histogram, const int ef, const float bound, quint32 *personId) const;
+
+public:
+    /**
+     * @brief Immutable view to the histograms of the database.
+     *
+     * Snapshots are published by the database whenever histograms are added,
+     * merged, loaded or cleared. The snapshot is read without locking. The
+     * histograms are in the form returned by LBPImage::toGalleryHistogram().
+     */
+    class Snapshot
     {
     public:
-        Iterator(const Database &db) : db(db)
+        quint64 version() const         { return snapshotVersion; }
+
+        bool isEmpty() const            { return layout.isEmpty(); }
+        quint32 personCount() const     { return layout.size(); }
+        quint32 histogramCount() const  { return totalHistogramCount; }
+
+        quint32 trackCount(quint32 personId) const
         {
-            reset();
+            return layout.at(personId).size();
         }
 
-        void reset()
+        quint32 histogramCount(quint32 personId, quint32 trackId) const
         {
-            personId = 0;
-            memory.clear();
-
-            const quint32 personCount = db.personCount();
-            for (quint32 i = 0; i < personCount; i++)
-            {
-                QList<quint32> trackList;
-                for (quint32 j = 0; j < db.trackCount(i); j++)
-                {
-                    trackList.append(0);
-                }
-
-                memory.append(qMakePair(0, trackList));
-            }
+            return layout.at(personId).at(trackId).size();
         }
 
-        Indices indices() const
+        const cv::Mat getHistogram(quint32 personId, quint32 trackId, quint32 histogramId) const
         {
-            quint32 trackId = memory.at(personId).first;
-            quint32 histogramId = memory.at(personId).second.at(trackId);
+            return arena.histogram(layout.at(personId).at(trackId).at(histogramId));
+        }
 
-            return Indices(personId, trackId, histogramId);
+        const uchar* histogramData(quint32 personId, quint32 trackId, quint32 histogramId) const
+        {
+            return arena.data(layout.at(personId).at(trackId).at(histogramId));
         }
 
-        bool isAtBeginning() const
+        int histogramSize(quint32 personId, quint32 trackId, quint32 histogramId) const
         {
-            const Indices currentIndices = indices();
-            return currentIndices.personId == 0 &&
-                   currentIndices.trackId == 0 &&
-                   currentIndices.histogramId == 0 ? true : false;
+            return arena.histogramSize(layout.at(personId).at(trackId).at(histogramId));
         }
 
-        Iterator& operator++() // Prefix increment.
+        int histogramType() const       { return arena.histogramType(); }
+
+        /**
+         * @brief Return the arena slot of a histogram.
+         *
+         * Slots identify the histograms of snapshots of the same arena
+         * generation: the histogram of a slot never changes.
+         */
+        quint32 histogramSlot(quint32 personId, quint32 trackId, quint32 histogramId) const
         {
-            quint32 &trackId = memory[personId].first;
-            const quint32 currentPersonId = personId;
-            const quint32 currentTrackId = trackId;
-            const QList<quint32> &trackList = memory.at(personId).second;
-            quint32 &nextHistogramId = memory[personId].second[currentTrackId];
+            return layout.at(personId).at(trackId).at(histogramId);
+        }
 
-            nextHistogramId++;
+        quint32 arenaGeneration() const { return arena.generation(); }
 
-            if (db.trackCount(personId) > 1)
-            {
-                while (true)
-                {
-                    trackId++;
-                    if (trackId == db.trackCount(personId))
-                    {
-                        trackId = 0;
-                    }
-                    if (trackList.at(trackId) == db.histogramCount(personId, trackId))
-                    {
-                        if (trackId == currentTrackId)
-                        {
-                            trackId = std::numeric_limits<quint32>::max();
-                            break;
-                        }
-                        else
-                        {
-                            continue;
-                        }
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                if (trackList.at(trackId) == db.histogramCount(personId, trackId))
-                {
-                    trackId = std::numeric_limits<quint32>::max();
-                }
-            }
+        /**
+         * @brief Return the codebook of the database file, or null if the
+         * file has none (see ProductQuantizer::trainCodebook()).
+         */
+        QSharedPointer<const ProductQuantizer> quantizer() const { return codebook; }
+
+        /**
+         * @brief Return the size of the histograms in the dense form divided
+         * by their stored size (see LBPImage::sparseHistogram()).
+         */
+        float compression() const;
+
+    private:
+        friend class Database;
+        friend class SnapshotPointer;
+
+        Snapshot() : snapshotVersion(0), totalHistogramCount(0) {}
+
+        quint64 snapshotVersion;
+        quint32 totalHistogramCount;
+
+        // Arena slots of the histograms of each track of each person.
+        QVector<QVector<QVector<quint32> > > layout;
+        HistogramArena::View arena;
+        QSharedPointer<const ProductQuantizer> codebook;
+
+        // Number of snapshot pointers, plus one while the snapshot is the
+        // latest one.
+        mutable QAtomicInt refs;
 
-            if (db.personCount() > 1)
+    };
+
+    /**
+     * @brief Reference counting pointer to a snapshot.
+     */
+    class SnapshotPointer
+    {
+    public:
+        SnapshotPointer() : d(0) {}
+        SnapshotPointer(const SnapshotPointer &other) : d(other.d)
+        {
+            if (d)
             {
-                while (true)
-                {
-                    personId++;
-                    if (personId == db.personCount())
-                    {
-                        personId = 0;
-                    }
-                    if (memory.at(personId).first == std::numeric_limits<quint32>::max())
-                    {
-                        if (personId == currentPersonId)
-                        {
-                            reset();
-                            break;
-                        }
-                        else
-                        {
-                            continue;
-                        }
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+                d->refs.ref();
             }
-            else
+        }
+
+        ~SnapshotPointer()  { reset(); }
+
+        SnapshotPointer& operator=(const SnapshotPointer &other)
+        {
+            if (other.d)
             {
-                 if (memory.at(personId).first == std::numeric_limits<quint32>::max())
-                 {
-                     reset();
-                 }
+                other.d->refs.ref();
             }
 
+            reset();
+            d = other.d;
+
             return *this;
         }
 
+        // Snapshots are deleted by the database, when there are no more
+        // references to them.
+        void reset()
+        {
+            if (d)
+            {
+                d->refs.deref();
+                d = 0;
+            }
+        }
+
+        bool isNull() const                     { return d == 0; }
+        const Snapshot* operator->() const      { return d; }
+        const Snapshot& operator*() const       { return *d; }
+
     private:
-        const Database &db;
-        quint32 personId;
-        QList<QPair<quint32, QList<quint32> > > memory;
+        friend class Database;
+
+        // Takes an already counted reference.
+        explicit SnapshotPointer(const Snapshot *d) : d(d) {}
+
+        const Snapshot *d;
+
+    };
+
+private:
+    // State of the database captured for a checkpoint.
+    struct TrackState
+    {
+        quint64 sizeInBytes;
+        QVector<quint32> arenaSlots;
+    };
+
+    struct PersonState
+    {
+        QString name;
+        cv::Mat faceImage;
+        quint64 sizeInBytes;
+        quint32 histogramCount;
+        QVector<TrackState> tracks;
+    };
 
+    struct State
+    {
+        QVector<PersonState> persons;
+        HistogramArena::View arena;
+        int descriptor;
+        quint32 totalTrackCount;
+        quint32 totalHistogramCount;
+        quint64 sizeInBytes;
     };
 
+private:
+    // These are called with the mutex locked.
+    quint32 insertPerson(QSharedPointer<Person> &person);
+    quint32 insertTrack(quint32 personId, QSharedPointer<Track> &track);
+    quint32 insertHistogram(quint32 personId, quint32 trackId, const cv::Mat &histogram);
+    int merge(const quint32 personId1, const quint32 personId2);
+
+    State captureState() const;
+    bool writeCheckpoint(QMutexLocker &locker, const QString &filename, const bool isGallery, ProgressListener *listener);
+    bool remapGallery(const State &state, const QString &filename);
+    bool readDatabase(const QString &filename);
+    bool readGallery(const QString &filename);
+
+    void readIndex(const QString &filename);
+    void readCodebook(const QString &filename);
+    void startJournal(const QString &filename, const bool isGallery, const bool truncate);
+    void replayJournal(const QString &filename);
+
+    void rebuildLayout();
+    void publishSnapshot();
+    void reclaimSnapshots();
+
+    // These don't need the mutex.
+    static bool writeDatabase(const State &state, const QString &filename, ProgressListener *listener);
+    static bool writeGallery(const State &state, const QString &filename, ProgressListener *listener);
+    void writeIndex(const State &state, const QString &filename);
+
 private:
     QList<QSharedPointer<Person> > persons;
 
+    // All histograms of the persons. Histograms returned by the database
+    // point to the arena, so they are valid until the database is cleared or
+    // loaded.
+    HistogramArena arena;
+
+    // Index of the histograms of the arena, built by searchIndex(). It has a
+    // lock of its own, and indexMutex serializes the builds. The index file
+    // of the loaded file is read by the first build of its generation.
+    mutable HnswIndex index;
+    mutable QMutex indexMutex;
+    QString indexFilename;
+    quint32 indexFileGeneration;
+
+    // LBP descriptor of the histograms.
+    int lbpDescriptor;
+
+    // Codebook of the file of the database, read when the file is loaded.
+    QSharedPointer<const ProductQuantizer> quantizer;
+
     mutable QMutex mutex;
 
+    // Serializes checkpoints. Locked before the mutex. Loading and clearing
+    // don't take it, so they don't wait for a file to be written.
+    QMutex checkpointMutex;
+
+    // The file being written by a checkpoint, and the condition signalled
+    // when it is done. Loading the file waits for it.
+    QString checkpointFilename;
+    QWaitCondition checkpointFinished;
+
+    // Incremented when the database is loaded or cleared.
+    quint32 fileEpoch;
+
     quint32 totalTrackCount;
     quint32 totalHistogramCount;
     quint64 sizeInBytes;
 
+    // The file the database was last loaded from or saved to, and its
+    // journal.
+    QString databaseFilename;
+    bool databaseIsGallery;
+    Journal journal;
+
+    // Arena slots of the histograms of each track of each person, updated
+    // when histograms are added. Snapshots share it, so a write copies only
+    // the vectors on the path to the changed track.
+    QVector<QVector<QVector<quint32> > > layout;
+
+    // The latest snapshot. Replaced by the writers while holding the mutex.
+    QAtomicPointer<Snapshot> currentSnapshot;
+
+    // Number of readers between reading the current snapshot pointer and
+    // incrementing its reference count.
+    mutable QAtomicInt acquiringReaders;
+
+    // Replaced snapshots, which are deleted when no longer referenced.
+    QList<Snapshot*> retiredSnapshots;
+
 };
 
 #endif // DATABASE_H
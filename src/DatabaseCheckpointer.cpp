@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "DatabaseCheckpointer.h"
+#include <QFileInfo>
+#include <QElapsedTimer>
+
+DatabaseCheckpointer::DatabaseCheckpointer(QObject *parent) :
+    QObject(parent),
+    db(0),
+    lastPercent(-1)
+{
+    connect(this, SIGNAL(triggerCheckpoint(QString)), this, SLOT(handleCheckpoint(QString)), Qt::QueuedConnection);
+}
+
+void DatabaseCheckpointer::checkpoint(const QString &filename)
+{
+    emit triggerCheckpoint(filename);
+}
+
+void DatabaseCheckpointer::progressChanged(const int percent)
+{
+    if (percent != lastPercent)
+    {
+        lastPercent = percent;
+        emit checkpointProgress(percent);
+    }
+}
+
+void DatabaseCheckpointer::handleCheckpoint(const QString &filename)
+{
+    Q_ASSERT(db);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    lastPercent = -1;
+
+    const bool isGallery = QFileInfo(filename).suffix() == "fgb";
+
+    // The same file and format only needs flushing of the journal.
+    const bool success = isGallery ? db->saveGallery(filename, this) : db->save(filename, this);
+
+    emit checkpointFinished(success, static_cast<quint32>(timer.elapsed()));
+}
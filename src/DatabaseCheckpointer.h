@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DATABASECHECKPOINTER_H
+#define DATABASECHECKPOINTER_H
+
+#include "Database.h"
+#include <QObject>
+#include <QString>
+
+/**
+ * @brief Writes checkpoints of the database in the background.
+ *
+ * The checkpoint (see Database::checkpoint()) is written in the thread of this
+ * object, so the database can be used at full rate meanwhile. Files with the
+ * suffix "fgb" are written as binary gallery files, others as database files.
+ * This object is meant to be run in its own thread.
+ */
+class DatabaseCheckpointer : public QObject, public Database::ProgressListener
+{
+    Q_OBJECT
+public:
+    explicit DatabaseCheckpointer(QObject *parent = 0);
+
+    void setDatabase(Database *db)   { this->db = db; }
+
+    void checkpoint(const QString &filename);
+
+    // Called in the thread of this object during the checkpoint.
+    void progressChanged(const int percent);
+
+signals:
+    void triggerCheckpoint(const QString &filename);
+    void checkpointProgress(const int percent);
+    void checkpointFinished(const bool success, const quint32 durationMs);
+
+private slots:
+    void handleCheckpoint(const QString &filename);
+
+private:
+    Database *db;
+    int lastPercent;
+
+};
+
+#endif // DATABASECHECKPOINTER_H
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "EmbeddedSearch.h"
+#include "LBPImage.h"
+#include <QtGlobal>
+#include <algorithm>
+
+using namespace cv;
+
+// Number of database rows scored by one matrix product. The deadline of the
+// search is checked between the products.
+const int GEMM_TILE_ROWS = 4096;
+
+EmbeddedSearch::EmbeddedSearch(const int rerankCount) :
+    rerankCount(qMax(rerankCount, 1)),
+    version(0),
+    isBuilt(false),
+    histogramType(CV_32FC1)
+{
+}
+
+void EmbeddedSearch::update(const Database::Snapshot &snapshot)
+{
+    if (isBuilt && snapshot.version() == version)
+    {
+        return;
+    }
+
+    version = snapshot.version();
+    isBuilt = true;
+    histogramType = snapshot.histogramType();
+
+    const int embeddingSize = LBPImage::histogramSize();
+
+    entries.resize(snapshot.histogramCount());
+    norms.resize(snapshot.histogramCount());
+    embeddings.create(snapshot.histogramCount(), embeddingSize, CV_32FC1);
+
+    int n = 0;
+    for (quint32 personId = 0; personId < snapshot.personCount(); personId++)
+    {
+        for (quint32 trackId = 0; trackId < snapshot.trackCount(personId); trackId++)
+        {
+            for (quint32 histogramId = 0; histogramId < snapshot.histogramCount(personId, trackId); histogramId++)
+            {
+                Entry &entry = entries[n];
+                entry.histogram = snapshot.histogramData(personId, trackId, histogramId);
+                entry.personId = personId;
+                entry.histogramSize = snapshot.histogramSize(personId, trackId, histogramId);
+
+                float *embedding = embeddings.ptr<float>(n);
+                const Mat histogram = LBPImage::fromGalleryHistogram(snapshot.getHistogram(personId, trackId, histogramId));
+
+                if (LBPImage::embedHistogram(histogram, embedding))
+                {
+                    norms[n] = static_cast<float>(norm(embeddings.row(n), NORM_L2SQR));
+                }
+                else
+                {
+                    // The histogram is never a candidate.
+                    std::fill(embedding, embedding + embeddingSize, 0.0f);
+                    norms[n] = std::numeric_limits<float>::infinity();
+                }
+
+                n++;
+            }
+        }
+    }
+}
+
+void EmbeddedSearch::clear()
+{
+    entries.clear();
+    norms.clear();
+    embeddings.release();
+    isBuilt = false;
+}
+
+QVector<EmbeddedSearch::Result> EmbeddedSearch::search(const QList<Mat> &histograms, const float bound, const SearchDeadline &deadline)
+{
+    QVector<Result> results(histograms.size());
+
+    const int histogramCount = entries.size();
+    if (histograms.isEmpty() || histogramCount == 0)
+    {
+        return results;
+    }
+
+    // Embed the histograms to the rows of the query matrix.
+    QVector<float> queryNorms(histograms.size());
+    queries.create(histograms.size(), LBPImage::histogramSize(), CV_32FC1);
+
+    for (int i = 0; i < histograms.size(); i++)
+    {
+        if (LBPImage::embedHistogram(histograms.at(i), queries.ptr<float>(i)))
+        {
+            queryNorms[i] = static_cast<float>(norm(queries.row(i), NORM_L2SQR));
+        }
+        else
+        {
+            queries.row(i).setTo(Scalar(0.0));
+            queryNorms[i] = std::numeric_limits<float>::infinity();
+        }
+    }
+
+    // Dot products of every histogram with every database histogram.
+    scores.create(histograms.size(), histogramCount, CV_32FC1);
+
+    for (int start = 0; start < histogramCount; start += GEMM_TILE_ROWS)
+    {
+        if (deadline.isOver())
+        {
+            for (int i = 0; i < results.size(); i++)
+            {
+                results[i].completed = false;
+            }
+
+            return results;
+        }
+
+        const int end = qMin(start + GEMM_TILE_ROWS, histogramCount);
+        Mat tileScores = scores.colRange(start, end);
+        gemm(queries, embeddings.rowRange(start, end), 1.0, noArray(), 0.0, tileScores, GEMM_2_T);
+    }
+
+    const int count = qMin(rerankCount, histogramCount);
+    candidates.resize(histogramCount);
+
+    for (int i = 0; i < histograms.size(); i++)
+    {
+        Result &result = results[i];
+
+        if (deadline.isOver())
+        {
+            for (int j = i; j < results.size(); j++)
+            {
+                results[j].completed = false;
+            }
+
+            break;
+        }
+
+        if (queryNorms.at(i) == std::numeric_limits<float>::infinity())
+        {
+            continue;
+        }
+
+        const float *score = scores.ptr<float>(i);
+        for (int j = 0; j < histogramCount; j++)
+        {
+            candidates[j] = qMakePair(queryNorms.at(i) + norms.at(j) - 2.0f * score[j], static_cast<quint32>(j));
+        }
+
+        std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end());
+        std::sort(candidates.begin(), candidates.begin() + count);
+
+        const Mat histogram = LBPImage::toGalleryHistogram(histograms.at(i));
+        float best = bound;
+
+        for (int j = 0; j < count; j++)
+        {
+            // The bound of the embeddings is never bigger than the exact
+            // distance, so the rest of the candidates can't be better.
+            if (candidates.at(j).first >= best)
+            {
+                break;
+            }
+
+            const Entry &entry = entries.at(candidates.at(j).second);
+            const Mat databaseHistogram(1, entry.histogramSize, histogramType, const_cast<uchar*>(entry.histogram));
+
+            int patchesEvaluated;
+            const float distance = LBPImage::galleryDistance(databaseHistogram, histogram, best, &patchesEvaluated);
+            result.histogramsCompared++;
+            result.patchesEvaluated += patchesEvaluated;
+
+            if (distance < best)
+            {
+                best = distance;
+                result.distance = distance;
+                result.personId = entry.personId;
+            }
+        }
+    }
+
+    return results;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef EMBEDDEDSEARCH_H
+#define EMBEDDEDSEARCH_H
+
+#include "Database.h"
+#include "SearchDeadline.h"
+#include <QList>
+#include <QVector>
+#include <QPair>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Search of the database with a matrix product of the Hellinger
+ * embeddings of the histograms (see LBPImage::embedHistogram()).
+ *
+ * The embeddings of the histograms of a snapshot are kept in one matrix, a
+ * row per histogram. A block of histograms is scored against the whole
+ * database with cv::gemm(), a tile of database rows at a time, which gives a
+ * lower bound of the weighted Chi square distance of every pair. The
+ * candidates with the smallest bounds are then re-ranked with the exact
+ * distance. The re-ranking of a histogram ends when the bound of the next
+ * candidate is bigger than the best exact distance, so the result is exact
+ * (up to rounding) whenever it ends before the last candidate.
+ *
+ * The embeddings take as much memory as float histograms.
+ */
+class EmbeddedSearch
+{
+public:
+    struct Result
+    {
+        Result() :
+            distance(std::numeric_limits<float>::max()),
+            personId(std::numeric_limits<quint32>::max()),
+            histogramsCompared(0),
+            patchesEvaluated(0),
+            completed(true) {}
+
+        float distance;                 /**< The smallest distance below the bound. */
+        quint32 personId;               /**< Person of the smallest distance. */
+        quint32 histogramsCompared;     /**< Exact comparisons of re-ranking. */
+        quint64 patchesEvaluated;       /**< Patches compared in them. */
+        bool completed;                 /**< False, if the deadline was over. */
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param rerankCount   Maximum number of candidates re-ranked with the
+     *                      exact distance per histogram.
+     */
+    explicit EmbeddedSearch(const int rerankCount);
+
+    /**
+     * @brief Compute the embeddings of the given snapshot, unless they have
+     * been computed for it already.
+     */
+    void update(const Database::Snapshot &snapshot);
+    void clear();
+
+    /**
+     * @brief Search the database for each of the given histograms.
+     *
+     * The deadline is checked between the tiles of the matrix product and
+     * before the re-ranking of each histogram. If it is over, the histograms
+     * not re-ranked yet are not searched.
+     *
+     * @param histograms    Uniform spatial histograms (as returned by
+     *                      LBPImage::histogram()).
+     * @param bound         Distances bigger than this are not of interest.
+     * @param deadline      The time limit and the stop request of the search.
+     * @return QVector<Result>  The best match of each histogram.
+     */
+    QVector<Result> search(const QList<cv::Mat> &histograms, const float bound, const SearchDeadline &deadline = SearchDeadline());
+
+private:
+    struct Entry
+    {
+        const uchar *histogram;
+        quint32 personId;
+        int histogramSize;      // Number of values in the histogram.
+    };
+
+    int rerankCount;
+
+    quint64 version;
+    bool isBuilt;
+    int histogramType;
+
+    QVector<Entry> entries;
+    cv::Mat embeddings;         // Row i is the embedding of entries[i].
+    QVector<float> norms;       // Squared norms of the rows.
+
+    // Buffers of the search, kept to avoid reallocating them.
+    cv::Mat queries;
+    cv::Mat scores;
+    std::vector<QPair<float, quint32> > candidates;
+
+};
+
+#endif // EMBEDDEDSEARCH_H
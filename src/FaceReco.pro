@@ -36,7 +36,26 @@ HEADERS += \
     HistogramWriter.h \
     HeadTracker.h \
     ChehraHeadTracker.h \
-    LBPImage.h
+    LBPImage.h \
+    LBPDescriptor.h \
+    ParallelSearch.h \
+    BatchExtractor.h \
+    HistogramArena.h \
+    GalleryFile.h \
+    Journal.h \
+    JournalMaintainer.h \
+    DatabaseCheckpointer.h \
+    SearchSchedule.h \
+    EmbeddedSearch.h \
+    HnswIndex.h \
+    InvertedFileSearch.h \
+    ProductQuantizer.h \
+    QuantizedSearch.h \
+    PivotSearch.h \
+    CascadeSearch.h \
+    BatchedSearch.h \
+    CandidateTally.h \
+    SearchDeadline.h
 
 SOURCES += main.cpp \
     CaptureSource.cpp \
@@ -50,7 +69,23 @@ SOURCES += main.cpp \
     HistogramWriter.cpp \
     HeadTracker.cpp \
     ChehraHeadTracker.cpp \
-    LBPImage.cpp
+    LBPImage.cpp \
+    ParallelSearch.cpp \
+    BatchExtractor.cpp \
+    HistogramArena.cpp \
+    Journal.cpp \
+    JournalMaintainer.cpp \
+    DatabaseCheckpointer.cpp \
+    SearchSchedule.cpp \
+    EmbeddedSearch.cpp \
+    HnswIndex.cpp \
+    InvertedFileSearch.cpp \
+    ProductQuantizer.cpp \
+    QuantizedSearch.cpp \
+    PivotSearch.cpp \
+    CascadeSearch.cpp \
+    BatchedSearch.cpp \
+    CandidateTally.cpp
 
 FORMS += \
     MainWindow.ui
@@ -37,6 +37,7 @@
 #include <QElapsedTimer>
 #include <QDebug>
 #include <QMutexLocker>
+#include <QStringList>
 #include <QtGlobal>
 #include <limits>
 
@@ -54,13 +55,15 @@ FrameProcesser::FrameProcesser(QObject *parent) :
     QObject(parent),
     lastTrackMonitorFrameData(TRACK_WINDOW_HEIGHT, TRACK_WINDOW_WIDTH, CV_8UC3),
     trackWindowImg(TRACK_WINDOW_HEIGHT, TRACK_WINDOW_WIDTH, CV_8UC3),
-    maintainVideoFPS(MAINTAIN_VIDEO_FPS)
+    maintainVideoFPS(MAINTAIN_VIDEO_FPS),
+    lbpDescriptor(DEFAULT_LBP_DESCRIPTOR)
 {
     connect(this, SIGNAL(triggerFrameProcess()), this, SLOT(processFrame()), Qt::QueuedConnection);
     connect(this, SIGNAL(triggerStart(QString)), this, SLOT(handleStart(QString)), Qt::QueuedConnection);
     connect(this, SIGNAL(triggerStop()), this, SLOT(handleStop()), Qt::QueuedConnection);
     connect(this, SIGNAL(triggerTogglePause()), this, SLOT(handleTogglePause()), Qt::QueuedConnection);
     connect(this, SIGNAL(triggerSetMode(int)), this, SLOT(handleSetMode(int)), Qt::QueuedConnection);
+    connect(this, SIGNAL(triggerSetLBPDescriptor(int)), this, SLOT(handleSetLBPDescriptor(int)), Qt::QueuedConnection);
     connect(&histogramWriter, SIGNAL(personAdded(quint32)), this, SLOT(personAdded(quint32)));
     connect(&histogramWriter, SIGNAL(trackAdded(quint32)), this, SLOT(trackAdded(quint32)));
     connect(&histogramWriter, SIGNAL(histogramAdded(quint32)), this, SLOT(histogramAdded(quint32)));
@@ -71,6 +74,8 @@ FrameProcesser::FrameProcesser(QObject *parent) :
     searchEngine.moveToThread(&searchEngineThread);
     connect(&searchEngine, SIGNAL(personFound(quint32,quint32,quint32,quint32)), this, SLOT(handlePersonFound(quint32,quint32,quint32,quint32)));
     connect(&searchEngine, SIGNAL(personNotFound(quint32,quint32,quint32)), this, SLOT(handlePersonNotFound(quint32,quint32,quint32)));
+    connect(&searchEngine, SIGNAL(searchStatistics(SearchStatistics)), this, SLOT(handleSearchStatistics(SearchStatistics)));
+    connect(&searchEngine, SIGNAL(searchCandidates(QVector<SearchCandidate>)), this, SLOT(handleSearchCandidates(QVector<SearchCandidate>)));
     searchEngineThread.start();
 
     // Setup worker object and thread for histogram writer.
@@ -197,6 +202,11 @@ void FrameProcesser::setMode(const int mode)
     emit triggerSetMode(mode);
 }
 
+void FrameProcesser::setLBPDescriptor(const int descriptor)
+{
+    emit triggerSetLBPDescriptor(descriptor);
+}
+
 void FrameProcesser::handleStart(const QString &sourceFilename)
 {
     // Create capture source object.
@@ -232,6 +242,12 @@ void FrameProcesser::handleStart(const QString &sourceFilename)
     trackLost = false;
     detectedPersonIsRecognized = false;
 
+    // Histograms are calculated with the descriptor of the database. The
+    // database can't be loaded while processing, and its descriptor is
+    // changed only through setLBPDescriptor().
+    lbpDescriptor = db->descriptor();
+    histogramWriter.setDescriptor(lbpDescriptor);
+
     tracker->reset();
 
     if (cap->isCameraSourceEnabled())
@@ -311,6 +327,37 @@ void FrameProcesser::handleSetMode(const int mode)
     qDebug() << "Processing mode set to:" << modeStr;
 }
 
+void FrameProcesser::handleSetLBPDescriptor(const int descriptor)
+{
+    // Frames of a running track must all be of the same descriptor.
+    if (shouldContinueWorking)
+    {
+        qDebug() << "LBP descriptor can't be changed while processing.";
+        return;
+    }
+
+    if (!db->setDescriptor(descriptor))
+    {
+        return;
+    }
+
+    // Histograms of a paused track are of the previous descriptor, so the
+    // track is dropped and a new one is started when processing continues.
+    searchEngine.stop();
+    histogramWriter.stop();
+    histogramBuffer.clear();
+    trackLost = true;
+    trackFrameIndex = 0;
+
+    if (!tracker.isNull())
+    {
+        tracker->reset();
+    }
+
+    lbpDescriptor = descriptor;
+    histogramWriter.setDescriptor(lbpDescriptor);
+}
+
 void FrameProcesser::processFrame()
 {
     if (!shouldContinueWorking)
@@ -364,8 +411,9 @@ void FrameProcesser::processFrame()
         cvtColor(processedFaceImg, processedFaceImg, CV_BGR2GRAY);
         processedFaceImg.convertTo(processedFaceImg, CV_8UC1);
 
-        // Calculate LBP image and histogram for the face image.
-        LBPImage lbpImg(processedFaceImg);
+        // Calculate LBP image and histogram for the face image. The image is
+        // shown in the track window, so it is kept from the same pass.
+        LBPImage lbpImg(processedFaceImg, lbpDescriptor, true);
 
         imPlotGrid(lbpImg.image(), 7, 7);
 
@@ -539,6 +587,7 @@ void FrameProcesser::handlePersonFound(const quint32 personId, const quint32 sea
 
     emit personChanged(personId, false);
     emit searchStatisticsChanged(searchTime, histogramsSearched, histogramsCompared);
+    emit searchDetailsChanged(lastSearchStatistics);
 }
 
 void FrameProcesser::handlePersonNotFound(const quint32 searchTime, const quint32 histogramsSearched, const quint32 histogramsCompared)
@@ -576,6 +625,17 @@ void FrameProcesser::handlePersonNotFound(const quint32 searchTime, const quint3
     histogramBuffer.clear();
 
     emit searchStatisticsChanged(searchTime, histogramsSearched, histogramsCompared);
+    emit searchDetailsChanged(lastSearchStatistics);
+}
+
+void FrameProcesser::handleSearchStatistics(const SearchStatistics &statistics)
+{
+    lastSearchStatistics = statistics;
+}
+
+void FrameProcesser::handleSearchCandidates(const QVector<SearchCandidate> &candidates)
+{
+    lastSearchCandidates = candidates;
 }
 
 void FrameProcesser::personAdded(const quint32 personId)
@@ -595,13 +655,30 @@ void FrameProcesser::histogramAdded(const quint32 personId)
 
 void FrameProcesser::outputResult(const bool personFound, const quint32 personId, const quint32 searchTime, const quint32 histogramsSearched, const quint32 histogramsCompared)
 {
-    QString s = QString("%1: label: %2%3, search time: %4 ms, hm: %5, hc: %6")
+    QString s = QString("%1: label: %2%3, search time: %4 ms, hm: %5, hc: %6, pe: %7 %, ct: %8 us, cr: %9, pr: %10 %")
             .arg(printedTrackIndex)
             .arg(mode != MODE_LEARN_AND_RECOGNIZE && !personFound ? "NOT FOUND" : QString::number(personId))
             .arg(mode == MODE_LEARN_AND_RECOGNIZE && !personFound ? " (NEW)" : "")
             .arg(searchTime)
             .arg(histogramsSearched)
-            .arg(histogramsCompared);
+            .arg(histogramsCompared)
+            .arg(100.0f * lastSearchStatistics.patchesEvaluated, 0, 'f', 1)
+            .arg(lastSearchStatistics.comparisonTime, 0, 'f', 2)
+            .arg(lastSearchStatistics.compression, 0, 'f', 2)
+            .arg(100.0f * lastSearchStatistics.pruningRate, 0, 'f', 1);
+
+    // Candidates as "personId (min distance, votes)".
+    if (lastSearchCandidates.size() > 1)
+    {
+        QStringList candidates;
+        for (int i = 0; i < lastSearchCandidates.size(); i++)
+        {
+            const SearchCandidate &candidate = lastSearchCandidates.at(i);
+            candidates.append(QString("%1 (%2, %3)").arg(candidate.personId).arg(candidate.minDistance, 0, 'f', 3).arg(candidate.votes));
+        }
+
+        s += ", candidates: " + candidates.join(", ");
+    }
 
     qDebug() << qPrintable(s);
 }
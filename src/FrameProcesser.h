@@ -78,6 +78,16 @@ public:
     void togglePause();
     void setMode(const int mode);
 
+    /**
+     * @brief Select the LBP descriptor of new histograms.
+     *
+     * The descriptor is set to the database too, so it can be changed only
+     * while the database is empty (see Database::setDescriptor()).
+     *
+     * @param descriptor    LBP_DESCRIPTOR_R1P8 or LBP_DESCRIPTOR_R2P8.
+     */
+    void setLBPDescriptor(const int descriptor);
+
 private:
     void setLastCaptureFrame(const cv::Mat &data);
     void setLastTrackMonitorFrame(const cv::Mat &data);
@@ -87,6 +97,7 @@ signals:
     void triggerStop();
     void triggerTogglePause();
     void triggerSetMode(const int mode);
+    void triggerSetLBPDescriptor(const int descriptor);
     void triggerFrameProcess();
 
     void newTrackDetected();
@@ -97,16 +108,20 @@ signals:
     void personUpdated(const quint32 personId);
     void personNotFound();
     void searchStatisticsChanged(const quint32 searchTime, const quint32 histogramsUsed, const quint32 histogramsCompared);
+    void searchDetailsChanged(const SearchStatistics &statistics);
 
 private slots:
     void handleStart(const QString &sourceFilename);
     void handleStop();
     void handleTogglePause();
     void handleSetMode(const int mode);
+    void handleSetLBPDescriptor(const int descriptor);
     void processFrame();
 
     void handlePersonFound(const quint32 personId, const quint32 searchTime, const quint32 histogramsSearched, const quint32 histogramsCompared);
     void handlePersonNotFound(const quint32 searchTime, const quint32 histogramsSearched, const quint32 histogramsCompared);
+    void handleSearchStatistics(const SearchStatistics &statistics);
+    void handleSearchCandidates(const QVector<SearchCandidate> &candidates);
 
     void personAdded(const quint32 personId);
     void trackAdded(const quint32 personId);
@@ -146,10 +161,15 @@ private:
     bool isWriting;
     bool searchDone;
     int mode; // 0: recognize and learn, 1: recognize only, 2: test mode
+    int lbpDescriptor;  // Of the database, taken when processing is started.
 
     quint32 detectedPersonId;
     bool detectedPersonIsRecognized;
 
+    // Statistics of the last search, received before the result.
+    SearchStatistics lastSearchStatistics;
+    QVector<SearchCandidate> lastSearchCandidates;
+
     // Worker object and thread for search engine.
     SearchEngine searchEngine;
     QThread searchEngineThread;
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GALLERYFILE_H
+#define GALLERYFILE_H
+
+#include <QtGlobal>
+
+/*
+ * Binary gallery file (.fgb)
+ *
+ * The file can be mapped to memory and the histograms used directly from
+ * there. All values are in the byte order of the machine that wrote the file.
+ *
+ *  GalleryFileHeader
+ *  GalleryPersonEntry[personCount]
+ *  GalleryTrackEntry[trackCount]
+ *  Names (UTF-8) and face images (BGR) of the persons
+ *  Padding to a multiple of 64 bytes
+ *  Histograms[histogramCount], each histogramStride values
+ *
+ * Histograms are ordered by person and track, so the histograms of a track
+ * are consecutive.
+ */
+
+// Version 1 has no descriptor, and its histograms are of
+// LBP_DESCRIPTOR_R2P8.
+#define GALLERY_FILE_VERSION        2
+
+// Histograms are in the weighted form (see LBPImage::weightHistogram()).
+#define GALLERY_FLAG_WEIGHTED       0x1
+
+// Histograms are 16-bit counts (see LBPImage::quantizeHistogram()). Otherwise
+// they are floats.
+#define GALLERY_FLAG_QUANTIZED      0x2
+
+const char GALLERY_FILE_MAGIC[8] = { 'F', 'R', 'G', 'A', 'L', 'L', 'E', 'R' };
+
+const quint64 GALLERY_HISTOGRAM_ALIGNMENT = 64;
+
+struct GalleryFileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 flags;
+    quint32 histogramSize;      // Number of values in one histogram.
+    quint32 histogramStride;    // Distance of two histograms in values.
+    quint32 personCount;
+    quint32 trackCount;
+    quint32 histogramCount;
+    quint32 descriptor;         // LBP descriptor of the histograms.
+    quint64 personTableOffset;
+    quint64 trackTableOffset;
+    quint64 histogramBlockOffset;
+    quint64 fileSize;
+};
+
+struct GalleryPersonEntry
+{
+    quint64 nameOffset;
+    quint64 faceImageOffset;
+    quint32 nameSize;           // In bytes.
+    quint32 firstTrack;         // Index to the track table.
+    quint32 trackCount;
+    qint32 faceImageRows;
+    qint32 faceImageCols;
+    qint32 faceImageType;
+    quint32 faceImageStep;
+    quint32 reserved;
+};
+
+struct GalleryTrackEntry
+{
+    quint64 sizeInBytes;        // As returned by Track::size().
+    quint32 firstHistogram;     // Index to the histogram block.
+    quint32 histogramCount;
+};
+
+#endif // GALLERYFILE_H
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HistogramArena.h"
+#include <QDebug>
+#include <cstring>
+
+using namespace cv;
+
+// Size of one chunk. With the LBP histograms one chunk holds about 256
+// histograms (512 quantized histograms, and more sparse histograms).
+const size_t CHUNK_SIZE = 2304 * 1024;
+
+// Number of slots in one block of the slot table.
+const quint32 SLOTS_PER_BLOCK = 1024;
+
+// Histograms are aligned to cache lines.
+const size_t HISTOGRAM_ALIGNMENT = 64;
+
+HistogramArena::Chunk::Chunk(const size_t byteCount) :
+    file(0)
+{
+    buffer = new uchar[byteCount + HISTOGRAM_ALIGNMENT];
+    data = alignPtr(buffer, HISTOGRAM_ALIGNMENT);
+}
+
+HistogramArena::Chunk::Chunk(QFile *file, uchar *data) :
+    data(data),
+    buffer(0),
+    file(file)
+{
+}
+
+HistogramArena::Chunk::~Chunk()
+{
+    // Closing the file unmaps it.
+    delete file;
+    delete[] buffer;
+}
+
+HistogramArena::Locator::Locator() :
+    mappedCount(0),
+    mappedHistogramSize(0),
+    mappedSlotSize(0)
+{
+}
+
+HistogramArena::Location HistogramArena::Locator::locate(const quint32 slot) const
+{
+    if (slot < mappedCount)
+    {
+        Location location;
+        location.data = mappedChunk->data + slot * mappedSlotSize;
+        location.histogramSize = mappedHistogramSize;
+
+        return location;
+    }
+
+    const quint32 tableSlot = slot - mappedCount;
+
+    Q_ASSERT(tableSlot / SLOTS_PER_BLOCK < static_cast<quint32>(blocks.size()));
+
+    return blocks.at(tableSlot / SLOTS_PER_BLOCK)->at(tableSlot % SLOTS_PER_BLOCK);
+}
+
+HistogramArena::HistogramArena() :
+    type(CV_32FC1),
+    chunkSize(0),
+    chunkUsed(0),
+    allocatedBytes(0),
+    mappedBytes(0),
+    totalHistogramBytes(0),
+    arenaGeneration(0)
+{
+}
+
+bool HistogramArena::append(const Mat &histogram, const quint32 personId, const quint32 trackId, quint32 *slot)
+{
+    if (histogram.empty() || histogram.rows != 1 || histogram.channels() != 1 ||
+        (!owners.isEmpty() && histogram.type() != type))
+    {
+        qDebug() << "Not a valid histogram for the arena.";
+
+        return false;
+    }
+
+    if (owners.isEmpty())
+    {
+        type = histogram.type();
+    }
+
+    const size_t histogramBytes = histogram.cols * histogram.elemSize();
+    *slot = owners.size();
+
+    Location &location = newLocation(*slot);
+    location.data = store(histogram.ptr(0), histogramBytes);
+    location.histogramSize = histogram.cols;
+
+    totalHistogramBytes += histogramBytes;
+
+    Owner owner;
+    owner.personId = personId;
+    owner.trackId = trackId;
+    owners.append(owner);
+
+    return true;
+}
+
+const uchar* HistogramArena::store(const uchar *histogram, const size_t histogramBytes)
+{
+    const size_t slotSize = alignSize(histogramBytes, HISTOGRAM_ALIGNMENT);
+
+    if (chunks.isEmpty() || chunkUsed + slotSize > chunkSize)
+    {
+        chunkSize = qMax(CHUNK_SIZE, slotSize);
+        chunkUsed = 0;
+        chunks.append(QSharedPointer<Chunk>(new Chunk(chunkSize)));
+        allocatedBytes += chunkSize;
+    }
+
+    uchar *dst = chunks.last()->data + chunkUsed;
+    std::memcpy(dst, histogram, histogramBytes);
+    std::memset(dst + histogramBytes, 0, slotSize - histogramBytes);
+    chunkUsed += slotSize;
+
+    return dst;
+}
+
+HistogramArena::Location& HistogramArena::newLocation(const quint32 slot)
+{
+    const quint32 tableSlot = slot - locator.mappedCount;
+    if (tableSlot % SLOTS_PER_BLOCK == 0)
+    {
+        locator.blocks.append(QSharedPointer<LocationBlock>(new LocationBlock(SLOTS_PER_BLOCK)));
+        allocatedBytes += SLOTS_PER_BLOCK * sizeof(Location);
+    }
+
+    // The block vector is referred to only by the pointers, so writing to it
+    // doesn't detach it. Views use only the slots written before they were
+    // taken.
+    return (*locator.blocks.at(locator.blocks.size() - 1))[tableSlot % SLOTS_PER_BLOCK];
+}
+
+bool HistogramArena::map(QFile *file, const qint64 offset, const QVector<Owner> &owners,
+                         const int histogramType, const int histogramSize, const size_t histogramStride)
+{
+    const size_t elemSize = CV_ELEM_SIZE(histogramType);
+
+    Q_ASSERT(this->owners.isEmpty());
+    Q_ASSERT(offset % HISTOGRAM_ALIGNMENT == 0);
+    Q_ASSERT((histogramStride * elemSize) % HISTOGRAM_ALIGNMENT == 0);
+
+    const qint64 mappedSize = static_cast<qint64>(owners.size()) * histogramStride * elemSize;
+
+    uchar *mapping = owners.isEmpty() ? 0 : file->map(offset, mappedSize);
+    if (!owners.isEmpty() && !mapping)
+    {
+        delete file;
+        return false;
+    }
+
+    locator.mappedChunk = QSharedPointer<Chunk>(new Chunk(file, mapping));
+    locator.mappedCount = owners.size();
+    locator.mappedHistogramSize = histogramSize;
+    locator.mappedSlotSize = histogramStride * elemSize;
+
+    this->owners = owners;
+    this->type = histogramType;
+    this->mappedBytes = mappedSize;
+    this->totalHistogramBytes = static_cast<quint64>(owners.size()) * histogramSize * elemSize;
+
+    return true;
+}
+
+bool HistogramArena::remap(QFile *file, const qint64 offset, const QVector<quint32> &fileSlots,
+                           const int histogramSize, const size_t histogramStride)
+{
+    const size_t elemSize = CV_ELEM_SIZE(type);
+
+    Q_ASSERT(offset % HISTOGRAM_ALIGNMENT == 0);
+    Q_ASSERT((histogramStride * elemSize) % HISTOGRAM_ALIGNMENT == 0);
+
+    const qint64 mappedSize = static_cast<qint64>(fileSlots.size()) * histogramStride * elemSize;
+
+    uchar *mapping = fileSlots.isEmpty() ? 0 : file->map(offset, mappedSize);
+    if (!fileSlots.isEmpty() && !mapping)
+    {
+        delete file;
+        return false;
+    }
+
+    // The slot table is built again from the first slot, as the histograms of
+    // the file may be in another order than the slots. The old blocks and the
+    // old mapping are left to the views using them.
+    const Locator previous = locator;
+
+    locator = Locator();
+    locator.mappedChunk = QSharedPointer<Chunk>(new Chunk(file, mapping));
+    allocatedBytes -= previous.blocks.size() * SLOTS_PER_BLOCK * sizeof(Location);
+
+    for (quint32 slot = 0; slot < static_cast<quint32>(owners.size()); slot++)
+    {
+        newLocation(slot) = previous.locate(slot);
+    }
+
+    const size_t slotSize = histogramStride * elemSize;
+
+    for (int i = 0; i < fileSlots.size(); i++)
+    {
+        const quint32 slot = fileSlots.at(i);
+        Q_ASSERT(slot < static_cast<quint32>(owners.size()));
+
+        Location &location = (*locator.blocks.at(slot / SLOTS_PER_BLOCK))[slot % SLOTS_PER_BLOCK];
+        totalHistogramBytes -= location.histogramSize * elemSize;
+        totalHistogramBytes += histogramSize * elemSize;
+
+        location.data = mapping + i * slotSize;
+        location.histogramSize = histogramSize;
+    }
+
+    mappedBytes = mappedSize;
+
+    return true;
+}
+
+QString HistogramArena::mappedFilename() const
+{
+    return locator.mappedChunk ? locator.mappedChunk->filename() : QString();
+}
+
+const Mat HistogramArena::histogram(const quint32 slot) const
+{
+    Q_ASSERT(slot < static_cast<quint32>(owners.size()));
+
+    // The header refers to the arena memory, so no reference counting is done
+    // when it is copied.
+    const Location location = locator.locate(slot);
+
+    return Mat(1, location.histogramSize, type, const_cast<uchar*>(location.data));
+}
+
+const uchar* HistogramArena::data(const quint32 slot) const
+{
+    Q_ASSERT(slot < static_cast<quint32>(owners.size()));
+
+    return locator.locate(slot).data;
+}
+
+int HistogramArena::histogramSize(const quint32 slot) const
+{
+    Q_ASSERT(slot < static_cast<quint32>(owners.size()));
+
+    return locator.locate(slot).histogramSize;
+}
+
+quint64 HistogramArena::slotSize(const quint32 slot) const
+{
+    Q_ASSERT(slot < static_cast<quint32>(owners.size()));
+
+    if (slot < locator.mappedCount)
+    {
+        return locator.mappedSlotSize + sizeof(Owner);
+    }
+
+    const size_t histogramBytes = locator.locate(slot).histogramSize * CV_ELEM_SIZE(type);
+
+    return alignSize(histogramBytes, HISTOGRAM_ALIGNMENT) + sizeof(Location) + sizeof(Owner);
+}
+
+void HistogramArena::setOwner(const quint32 slot, const quint32 personId, const quint32 trackId)
+{
+    Q_ASSERT(slot < static_cast<quint32>(owners.size()));
+
+    Owner &owner = owners[slot];
+    owner.personId = personId;
+    owner.trackId = trackId;
+}
+
+HistogramArena::View HistogramArena::view() const
+{
+    View view;
+    view.chunks = chunks;
+    view.locator = locator;
+    view.type = type;
+    view.count = owners.size();
+    view.totalHistogramBytes = totalHistogramBytes;
+    view.arenaGeneration = arenaGeneration;
+
+    return view;
+}
+
+quint64 HistogramArena::size() const
+{
+    return allocatedBytes + mappedBytes + owners.size() * sizeof(Owner);
+}
+
+void HistogramArena::clear()
+{
+    chunks.clear();
+    owners.clear();
+    locator = Locator();
+    type = CV_32FC1;
+    chunkSize = 0;
+    chunkUsed = 0;
+    allocatedBytes = 0;
+    mappedBytes = 0;
+    totalHistogramBytes = 0;
+    arenaGeneration++;
+}
+
+HistogramArena::View::View() :
+    type(CV_32FC1),
+    count(0),
+    totalHistogramBytes(0),
+    arenaGeneration(0)
+{
+}
+
+const Mat HistogramArena::View::histogram(const quint32 slot) const
+{
+    const Location location = locator.locate(slot);
+
+    return Mat(1, location.histogramSize, type, const_cast<uchar*>(location.data));
+}
+
+const uchar* HistogramArena::View::data(const quint32 slot) const
+{
+    return locator.locate(slot).data;
+}
+
+int HistogramArena::View::histogramSize(const quint32 slot) const
+{
+    return locator.locate(slot).histogramSize;
+}
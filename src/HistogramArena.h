@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HISTOGRAMARENA_H
+#define HISTOGRAMARENA_H
+
+#include "opencv2/opencv.hpp"
+#include <QVector>
+#include <QSharedPointer>
+#include <QFile>
+#include <QtGlobal>
+
+/**
+ * @brief Contiguous storage of the histograms of the database.
+ *
+ * Histograms are stored in chunks of aligned memory, one after the other.
+ * Every histogram starts at a 64-byte boundary (a cache line). A histogram is
+ * referred to by its slot, which is its index in the order of addition. The
+ * person and the track owning each slot are kept in a side table.
+ *
+ * Histograms may be of different sizes (see LBPImage::sparseHistogram()), so
+ * the location and the size of each slot are kept in blocks of a slot table.
+ * Like the chunks, the blocks are never moved.
+ *
+ * The first histograms of the arena may also be in a memory-mapped file (see
+ * map()). Histograms added after that are stored in the chunks.
+ *
+ * Chunks are never moved or freed before clear(), so the returned histograms
+ * stay valid until then. They don't own their data. Searches running across
+ * a clear() must use a view(), which keeps the chunks alive.
+ */
+class HistogramArena
+{
+public:
+    struct Owner
+    {
+        quint32 personId;
+        quint32 trackId;
+    };
+
+    class View;
+
+    HistogramArena();
+
+    /**
+     * @brief Copy a histogram to the arena.
+     *
+     * @param histogram     A single row and single channel histogram (CV_32FC1
+     *                      or CV_16UC1). All histograms in the arena must be
+     *                      of the same type.
+     * @param slot          Slot of the histogram.
+     * @return bool         False, if the histogram is empty or of another
+     *                      type than the histograms in the arena.
+     */
+    bool append(const cv::Mat &histogram, const quint32 personId, const quint32 trackId, quint32 *slot);
+
+    /**
+     * @brief Use histograms of a file as the first histograms of the arena.
+     *
+     * The arena must be empty. The file is mapped to memory and the histograms
+     * are used from there without copying. The arena takes the ownership of
+     * the file.
+     *
+     * @param file              An open file.
+     * @param offset            Offset of the first histogram in the file. Must
+     *                          be a multiple of 64.
+     * @param owners            Owner of each histogram in the file.
+     * @param histogramType     Type of the histograms (CV_32FC1 or CV_16UC1).
+     * @param histogramSize     Number of values in one histogram.
+     * @param histogramStride   Distance of two histograms in values. Must be
+     *                          a multiple of 64 bytes.
+     * @return bool             True, if the file was mapped.
+     */
+    bool map(QFile *file, const qint64 offset, const QVector<Owner> &owners,
+             const int histogramType, const int histogramSize, const size_t histogramStride);
+
+    /**
+     * @brief Use the histograms of a file that has the same histograms as
+     * some slots of the arena.
+     *
+     * The file is mapped to memory and the histograms of the slots are used
+     * from there. The slots and the histograms stay the same, but their data
+     * moves, and sparse histograms may become dense. The previously mapped
+     * file is closed when the views taken before this are destroyed. The
+     * arena takes the ownership of the file.
+     *
+     * @param file              An open file.
+     * @param offset            Offset of the first histogram in the file. Must
+     *                          be a multiple of 64.
+     * @param fileSlots         Slot of each histogram in the file.
+     * @param histogramSize     Number of values in one histogram.
+     * @param histogramStride   Distance of two histograms in values. Must be
+     *                          a multiple of 64 bytes.
+     * @return bool             True, if the file was mapped. Otherwise the
+     *                          arena is not changed.
+     */
+    bool remap(QFile *file, const qint64 offset, const QVector<quint32> &fileSlots,
+               const int histogramSize, const size_t histogramStride);
+
+    /**
+     * @brief Return the name of the mapped file, or an empty string if no
+     * file is mapped.
+     */
+    QString mappedFilename() const;
+
+    const cv::Mat histogram(const quint32 slot) const;
+    const uchar* data(const quint32 slot) const;
+    int histogramSize(const quint32 slot) const;
+
+    /**
+     * @brief Return the memory used by one slot in bytes, including the
+     * alignment padding and the side table entry.
+     */
+    quint64 slotSize(const quint32 slot) const;
+
+    const Owner& owner(const quint32 slot) const    { return owners.at(slot); }
+    void setOwner(const quint32 slot, const quint32 personId, const quint32 trackId);
+
+    quint32 histogramCount() const  { return owners.size(); }
+    int histogramType() const       { return type; }
+
+    /**
+     * @brief Return the bytes of the histograms without the alignment
+     * padding.
+     */
+    quint64 histogramBytes() const  { return totalHistogramBytes; }
+
+    /**
+     * @brief Return the number of times the arena has been cleared. Slots of
+     * different generations are different histograms.
+     */
+    quint32 generation() const      { return arenaGeneration; }
+
+    /**
+     * @brief Return a view to the histograms currently in the arena.
+     *
+     * The view keeps the chunks alive, so its histograms stay valid even
+     * after the arena is cleared. Histograms added later are not guaranteed to
+     * be visible.
+     */
+    View view() const;
+
+    /**
+     * @brief Return the memory used by the arena in bytes, including the side
+     * table, the mapped histograms and the unused part of the last chunk.
+     */
+    quint64 size() const;
+
+    void clear();
+
+private:
+    class Chunk
+    {
+    public:
+        explicit Chunk(const size_t byteCount);
+        Chunk(QFile *file, uchar *data);
+        ~Chunk();
+
+        QString filename() const    { return file ? file->fileName() : QString(); }
+
+        uchar *data;
+
+    private:
+        Chunk(const Chunk&);
+        Chunk& operator=(const Chunk&);
+
+        uchar *buffer;
+        QFile *file;
+    };
+
+    struct Location
+    {
+        const uchar *data;
+        int histogramSize;  // Number of values in the histogram.
+    };
+
+    typedef QVector<Location> LocationBlock;
+
+    // Slots in front of mappedCount are in the mapped file, the rest are in
+    // the slot table. After remap() the table may point to the mapped file
+    // too.
+    class Locator
+    {
+    public:
+        Locator();
+
+        Location locate(const quint32 slot) const;
+
+        QVector<QSharedPointer<LocationBlock> > blocks;
+        QSharedPointer<Chunk> mappedChunk;
+        quint32 mappedCount;
+        int mappedHistogramSize;    // Number of values in one histogram.
+        size_t mappedSlotSize;      // Distance of two histograms in bytes.
+    };
+
+    const uchar* store(const uchar *histogram, const size_t histogramBytes);
+    Location& newLocation(const quint32 slot);
+
+    QVector<QSharedPointer<Chunk> > chunks;
+    QVector<Owner> owners;
+    Locator locator;
+
+    int type;                       // Type of the histograms.
+    size_t chunkSize;               // Size of the last chunk in bytes.
+    size_t chunkUsed;               // Bytes used of the last chunk.
+    quint64 allocatedBytes;         // Bytes of all chunks and blocks.
+    quint64 mappedBytes;            // Bytes of the mapped histograms.
+    quint64 totalHistogramBytes;
+    quint32 arenaGeneration;
+
+public:
+    /**
+     * @brief Read-only access to the histograms of an arena.
+     *
+     * @see HistogramArena::view()
+     */
+    class View
+    {
+    public:
+        View();
+
+        const cv::Mat histogram(const quint32 slot) const;
+        const uchar* data(const quint32 slot) const;
+        int histogramSize(const quint32 slot) const;
+
+        int histogramType() const       { return type; }
+        quint32 histogramCount() const  { return count; }
+        quint64 histogramBytes() const  { return totalHistogramBytes; }
+        quint32 generation() const      { return arenaGeneration; }
+
+    private:
+        friend class HistogramArena;
+
+        QVector<QSharedPointer<Chunk> > chunks;
+        Locator locator;
+        int type;
+        quint32 count;
+        quint64 totalHistogramBytes;
+        quint32 arenaGeneration;
+    };
+
+};
+
+#endif // HISTOGRAMARENA_H
@@ -30,6 +30,7 @@
  */
 
 #include "HistogramWriter.h"
+#include "Constants.h"
 #include <QSharedPointer>
 
 using namespace cv;
@@ -37,6 +38,7 @@ using namespace cv;
 HistogramWriter::HistogramWriter(QObject *parent) :
     QObject(parent),
     shouldContinueWriting(false),
+    descriptor(DEFAULT_LBP_DESCRIPTOR),
     db(0)
 {
     connect(this, SIGNAL(triggerStart(quint32,quint32,bool)), this, SLOT(handleStart(quint32,quint32,bool)), Qt::QueuedConnection);
@@ -51,6 +53,13 @@ void HistogramWriter::pushHistogram(const Mat &histogram)
     histograms.push_front(histogram);
 }
 
+void HistogramWriter::setDescriptor(const int descriptor)
+{
+    QMutexLocker locker(&dataMutex);
+
+    this->descriptor = descriptor;
+}
+
 void HistogramWriter::pushFaceImage(const Mat &faceImage)
 {
     QMutexLocker locker(&dataMutex);
@@ -132,6 +141,10 @@ void HistogramWriter::writeNext(const quint32 personId, const quint32 trackId, c
 
     Mat histogram = popHistogram();
 
+    dataMutex.lock();
+    const int histogramDescriptor = descriptor;
+    dataMutex.unlock();
+
     if (histogram.empty())
     {
         if (stopWhenQueueIsEmpty)
@@ -147,13 +160,23 @@ void HistogramWriter::writeNext(const quint32 personId, const quint32 trackId, c
         if (personId == db->personCount())
         {
             QSharedPointer<Track> track(new Track);
-            track->addHistogram(histogram);
+            if (!track->addHistogram(histogram))
+            {
+                handleStop();
+                return;
+            }
 
             QSharedPointer<Person> person(new Person("<unknown>"));
             person->addTrack(track);
             person->setFaceImage(popFaceImage());
 
-            const quint32 assignedPersonId = db->addPerson(person);
+            const quint32 assignedPersonId = db->addPerson(person, histogramDescriptor);
+            if (assignedPersonId == Database::INVALID_ID)
+            {
+                handleStop();
+                return;
+            }
+
             emit personAdded(assignedPersonId);
         }
 
@@ -161,8 +184,12 @@ void HistogramWriter::writeNext(const quint32 personId, const quint32 trackId, c
         else if (trackId == db->trackCount(personId))
         {
             QSharedPointer<Track> track(new Track);
-            track->addHistogram(histogram);
-            db->addTrack(personId, track);
+            if (!track->addHistogram(histogram) ||
+                db->addTrack(personId, track, histogramDescriptor) == Database::INVALID_ID)
+            {
+                handleStop();
+                return;
+            }
 
             emit trackAdded(personId);
         }
@@ -170,7 +197,11 @@ void HistogramWriter::writeNext(const quint32 personId, const quint32 trackId, c
         // This histogram is a histogram of known person and known track.
         else
         {
-            db->addHistogram(personId, trackId, histogram);
+            if (db->addHistogram(personId, trackId, histogram, histogramDescriptor) == Database::INVALID_ID)
+            {
+                handleStop();
+                return;
+            }
 
             emit histogramAdded(personId);
         }
@@ -45,6 +45,13 @@ public:
 
     void setDatabase(Database *db)   { this->db = db; }
 
+    /**
+     * @brief Set the LBP descriptor of the histograms pushed from now on.
+     *
+     * Histograms are not written to a database of another descriptor.
+     */
+    void setDescriptor(const int descriptor);
+
     void pushHistogram(const cv::Mat &histogram);
     void pushFaceImage(const cv::Mat &faceImage);
 
@@ -108,6 +115,7 @@ private:
 
     QList<cv::Mat>  histograms;
     QList<cv::Mat>  faceImages;
+    int descriptor;
 
     Database *db;
 
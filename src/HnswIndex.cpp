@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HnswIndex.h"
+#include "LBPImage.h"
+#include "Constants.h"
+#include <QSet>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDebug>
+#include <QtGlobal>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <vector>
+
+using namespace cv;
+
+const quint32 INDEX_FILE_MAGIC = 0x57534e48; // "HNSW"
+const quint32 INDEX_FILE_VERSION = 1;
+
+// Levels are capped, so that a bad random number can't make a huge level.
+const int MAX_LEVEL = 16;
+
+const quint32 NO_NODE = std::numeric_limits<quint32>::max();
+
+HnswIndex::HnswIndex() :
+    histogramType(CV_32FC1),
+    entryPoint(NO_NODE),
+    topLevel(-1),
+    linkCount(HNSW_LINK_COUNT),
+    constructionWidth(HNSW_CONSTRUCTION_WIDTH),
+    randomState(0x9e3779b97f4a7c15ULL)
+{
+}
+
+quint32 HnswIndex::nodeCount() const
+{
+    QReadLocker locker(&lock);
+
+    return nodes.size();
+}
+
+quint32 HnswIndex::generation() const
+{
+    QReadLocker locker(&lock);
+
+    return histograms.generation();
+}
+
+void HnswIndex::update(const HistogramArena::View &arena)
+{
+    QWriteLocker locker(&lock);
+
+    // Slots of another generation are other histograms.
+    if (arena.generation() != histograms.generation())
+    {
+        reset();
+    }
+
+    if (arena.histogramCount() < static_cast<quint32>(nodes.size()))
+    {
+        return;
+    }
+
+    if (nodes.isEmpty())
+    {
+        histogramType = arena.histogramType();
+    }
+
+    // The view keeps the histograms of the nodes alive.
+    histograms = arena;
+
+    for (quint32 slot = nodes.size(); slot < arena.histogramCount(); slot++)
+    {
+        Node node;
+        node.histogram = arena.data(slot);
+        node.histogramSize = arena.histogramSize(slot);
+        nodes.append(node);
+
+        insert(slot);
+    }
+}
+
+void HnswIndex::relocate(const HistogramArena::View &arena)
+{
+    QWriteLocker locker(&lock);
+
+    if (arena.generation() != histograms.generation())
+    {
+        return;
+    }
+
+    const int count = qMin(nodes.size(), static_cast<int>(arena.histogramCount()));
+    for (int slot = 0; slot < count; slot++)
+    {
+        nodes[slot].histogram = arena.data(slot);
+        nodes[slot].histogramSize = arena.histogramSize(slot);
+    }
+
+    // Nodes after the view were added from views taken after the move.
+    if (arena.histogramCount() >= static_cast<quint32>(nodes.size()))
+    {
+        histograms = arena;
+    }
+}
+
+HnswIndex::Result HnswIndex::search(const Mat &histogram, const int ef, const float bound) const
+{
+    QReadLocker locker(&lock);
+
+    Result result;
+    if (nodes.isEmpty())
+    {
+        return result;
+    }
+
+    // Descend greedily to level 1, and search level 0 widely.
+    Candidate entry(distance(histogram, entryPoint, std::numeric_limits<float>::max(), &result), entryPoint);
+    for (int level = topLevel; level > 0; level--)
+    {
+        entry = searchLevel(histogram, entry, 1, level, &result).first();
+    }
+
+    const Candidate nearest = searchLevel(histogram, entry, qMax(ef, 1), 0, &result).first();
+    if (nearest.first < bound)
+    {
+        result.distance = nearest.first;
+        result.slot = nearest.second;
+    }
+
+    return result;
+}
+
+void HnswIndex::clear()
+{
+    QWriteLocker locker(&lock);
+
+    reset();
+}
+
+void HnswIndex::release()
+{
+    if (lock.tryLockForWrite())
+    {
+        reset();
+        lock.unlock();
+    }
+}
+
+void HnswIndex::reset()
+{
+    // Called with the lock locked for writing.
+
+    nodes.clear();
+    histograms = HistogramArena::View();
+    histogramType = CV_32FC1;
+    entryPoint = NO_NODE;
+    topLevel = -1;
+    linkCount = HNSW_LINK_COUNT;
+}
+
+float HnswIndex::distance(const Mat &histogram, const quint32 node, const float bound, Result *result) const
+{
+    int patchesEvaluated;
+    const float d = LBPImage::galleryDistance(histogramOf(node), histogram, bound, &patchesEvaluated);
+
+    if (result)
+    {
+        result->histogramsCompared++;
+        result->patchesEvaluated += patchesEvaluated;
+    }
+
+    return d;
+}
+
+Mat HnswIndex::histogramOf(const quint32 node) const
+{
+    const Node &n = nodes.at(node);
+
+    return Mat(1, n.histogramSize, histogramType, const_cast<uchar*>(n.histogram));
+}
+
+void HnswIndex::insert(const quint32 node)
+{
+    // Called with the lock locked for writing.
+
+    const int level = randomLevel();
+    nodes[node].links.resize(level + 1);
+
+    if (entryPoint == NO_NODE)
+    {
+        entryPoint = node;
+        topLevel = level;
+        return;
+    }
+
+    const Mat histogram = histogramOf(node);
+
+    Candidate entry(distance(histogram, entryPoint, std::numeric_limits<float>::max(), 0), entryPoint);
+    for (int l = topLevel; l > level; l--)
+    {
+        entry = searchLevel(histogram, entry, 1, l, 0).first();
+    }
+
+    for (int l = qMin(level, topLevel); l >= 0; l--)
+    {
+        const QVector<Candidate> found = searchLevel(histogram, entry, constructionWidth, l, 0);
+        const QVector<quint32> links = selectLinks(found, linkCount);
+
+        nodes[node].links[l] = links;
+        for (int i = 0; i < links.size(); i++)
+        {
+            addLink(links.at(i), node, l);
+        }
+
+        entry = found.first();
+    }
+
+    if (level > topLevel)
+    {
+        entryPoint = node;
+        topLevel = level;
+    }
+}
+
+int HnswIndex::randomLevel()
+{
+    // xorshift64*
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    const quint64 random = randomState * 0x2545f4914f6cdd1dULL;
+
+    // Uniform in (0, 1].
+    const double uniform = (static_cast<double>(random >> 11) + 1.0) / 9007199254740992.0;
+    const int level = static_cast<int>(-std::log(uniform) / std::log(static_cast<double>(linkCount)));
+
+    return qMin(level, MAX_LEVEL);
+}
+
+QVector<HnswIndex::Candidate> HnswIndex::searchLevel(const Mat &histogram, const Candidate &entry, const int ef, const int level, Result *result) const
+{
+    // Nearest candidates first, and the furthest of the best first.
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > candidates;
+    std::priority_queue<Candidate> best;
+
+    QSet<quint32> visited;
+    visited.insert(entry.second);
+    candidates.push(entry);
+    best.push(entry);
+
+    while (!candidates.empty())
+    {
+        const Candidate candidate = candidates.top();
+        if (candidate.first > best.top().first && static_cast<int>(best.size()) >= ef)
+        {
+            break;
+        }
+
+        candidates.pop();
+
+        const QVector<quint32> &links = nodes.at(candidate.second).links.at(level);
+        for (int i = 0; i < links.size(); i++)
+        {
+            const quint32 link = links.at(i);
+            if (visited.contains(link))
+            {
+                continue;
+            }
+
+            visited.insert(link);
+
+            // Only nodes nearer than the furthest of the best are of interest,
+            // so their comparison can be abandoned.
+            const bool isFull = static_cast<int>(best.size()) >= ef;
+            const float limit = isFull ? best.top().first : std::numeric_limits<float>::max();
+            const float d = distance(histogram, link, limit, result);
+
+            if (!isFull || d < limit)
+            {
+                candidates.push(Candidate(d, link));
+                best.push(Candidate(d, link));
+
+                if (static_cast<int>(best.size()) > ef)
+                {
+                    best.pop();
+                }
+            }
+        }
+    }
+
+    QVector<Candidate> found(static_cast<int>(best.size()));
+    for (int i = found.size() - 1; i >= 0; i--)
+    {
+        found[i] = best.top();
+        best.pop();
+    }
+
+    return found;
+}
+
+QVector<quint32> HnswIndex::selectLinks(const QVector<Candidate> &candidates, const int linkCount) const
+{
+    // A candidate is linked only if it is nearer to the node than to any
+    // candidate linked already. This keeps links to different directions,
+    // instead of linking to a cluster of near nodes only.
+    QVector<quint32> links;
+
+    for (int i = 0; i < candidates.size() && links.size() < linkCount; i++)
+    {
+        const Candidate &candidate = candidates.at(i);
+        const Mat histogram = histogramOf(candidate.second);
+
+        bool isDiverse = true;
+        for (int j = 0; j < links.size() && isDiverse; j++)
+        {
+            isDiverse = distance(histogram, links.at(j), candidate.first, 0) >= candidate.first;
+        }
+
+        if (isDiverse)
+        {
+            links.append(candidate.second);
+        }
+    }
+
+    return links;
+}
+
+void HnswIndex::addLink(const quint32 node, const quint32 link, const int level)
+{
+    QVector<quint32> &links = nodes[node].links[level];
+    links.append(link);
+
+    if (links.size() <= maxLinks(level))
+    {
+        return;
+    }
+
+    // Too many links. Select them again.
+    const Mat histogram = histogramOf(node);
+
+    QVector<Candidate> candidates;
+    candidates.reserve(links.size());
+    for (int i = 0; i < links.size(); i++)
+    {
+        candidates.append(Candidate(distance(histogram, links.at(i), std::numeric_limits<float>::max(), 0), links.at(i)));
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    links = selectLinks(candidates, maxLinks(level));
+}
+
+bool HnswIndex::write(const QString &filename, const QVector<quint32> &order, const qint64 fileSize) const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_2);
+
+    {
+        QReadLocker locker(&lock);
+
+        // Position of each node in the file.
+        QVector<quint32> position(nodes.size(), NO_NODE);
+        quint32 newEntryPoint = NO_NODE;
+        int newTopLevel = -1;
+
+        for (int i = 0; i < order.size(); i++)
+        {
+            const quint32 node = order.at(i);
+            if (node >= static_cast<quint32>(nodes.size()))
+            {
+                qDebug() << "Histogram not in the index:" << node;
+
+                return false;
+            }
+
+            position[node] = i;
+
+            const int level = nodes.at(node).links.size() - 1;
+            if (level > newTopLevel)
+            {
+                newEntryPoint = i;
+                newTopLevel = level;
+            }
+        }
+
+        stream << INDEX_FILE_MAGIC << INDEX_FILE_VERSION << fileSize << static_cast<quint32>(order.size()) <<
+                  newEntryPoint << static_cast<qint32>(newTopLevel) << static_cast<qint32>(linkCount);
+
+        for (int i = 0; i < order.size(); i++)
+        {
+            const Node &node = nodes.at(order.at(i));
+            stream << static_cast<quint32>(node.links.size());
+
+            for (int level = 0; level < node.links.size(); level++)
+            {
+                const QVector<quint32> &links = node.links.at(level);
+
+                QVector<quint32> renumbered;
+                renumbered.reserve(links.size());
+                for (int j = 0; j < links.size(); j++)
+                {
+                    if (position.at(links.at(j)) != NO_NODE)
+                    {
+                        renumbered.append(position.at(links.at(j)));
+                    }
+                }
+
+                stream << renumbered;
+            }
+        }
+    }
+
+    QSaveFile file(filename);
+
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+    {
+        qDebug() << "Failed to write an index file:" << filename;
+
+        return false;
+    }
+
+    return true;
+}
+
+bool HnswIndex::read(const QString &filename, const HistogramArena::View &arena, const qint64 fileSize)
+{
+    QWriteLocker locker(&lock);
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_2);
+
+    quint32 magic;
+    quint32 version;
+    qint64 size;
+    quint32 count;
+    quint32 newEntryPoint;
+    qint32 newTopLevel;
+    qint32 newLinkCount;
+
+    stream >> magic >> version >> size >> count >> newEntryPoint >> newTopLevel >> newLinkCount;
+
+    if (stream.status() != QDataStream::Ok ||
+        magic != INDEX_FILE_MAGIC ||
+        version != INDEX_FILE_VERSION ||
+        size != fileSize ||
+        count > arena.histogramCount() ||
+        (count > 0 && (newEntryPoint >= count || newTopLevel < 0 || newTopLevel > MAX_LEVEL)) ||
+        newLinkCount < 1)
+    {
+        qDebug() << "Index file doesn't match the database:" << filename;
+
+        return false;
+    }
+
+    QVector<Node> readNodes(count);
+    bool ok = true;
+
+    for (quint32 i = 0; ok && i < count; i++)
+    {
+        Node &node = readNodes[i];
+        node.histogram = arena.data(i);
+        node.histogramSize = arena.histogramSize(i);
+
+        quint32 levelCount;
+        stream >> levelCount;
+
+        ok = stream.status() == QDataStream::Ok && levelCount >= 1 && levelCount <= static_cast<quint32>(newTopLevel) + 1;
+        if (ok)
+        {
+            node.links.resize(levelCount);
+        }
+
+        for (quint32 level = 0; ok && level < levelCount; level++)
+        {
+            QVector<quint32> &links = node.links[level];
+            stream >> links;
+
+            ok = stream.status() == QDataStream::Ok;
+            for (int j = 0; ok && j < links.size(); j++)
+            {
+                ok = links.at(j) < count;
+            }
+        }
+    }
+
+    // Links must point to nodes on the same level.
+    for (quint32 i = 0; ok && i < count; i++)
+    {
+        const Node &node = readNodes.at(i);
+        for (int level = 0; ok && level < node.links.size(); level++)
+        {
+            for (int j = 0; ok && j < node.links.at(level).size(); j++)
+            {
+                ok = readNodes.at(node.links.at(level).at(j)).links.size() > level;
+            }
+        }
+    }
+
+    if (!ok || (count > 0 && readNodes.at(newEntryPoint).links.size() != newTopLevel + 1))
+    {
+        qDebug() << "Not a valid index file:" << filename;
+
+        return false;
+    }
+
+    nodes = readNodes;
+    histograms = arena;
+    histogramType = arena.histogramType();
+    entryPoint = count > 0 ? newEntryPoint : NO_NODE;
+    topLevel = count > 0 ? newTopLevel : -1;
+    linkCount = newLinkCount;
+
+    qDebug() << "Index loaded from file:" << filename;
+
+    return true;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HNSWINDEX_H
+#define HNSWINDEX_H
+
+#include "HistogramArena.h"
+#include <QVector>
+#include <QPair>
+#include <QString>
+#include <QReadWriteLock>
+#include <limits>
+
+/**
+ * @brief Hierarchical navigable small world graph over the histograms of an
+ * arena, for approximate nearest neighbour search.
+ *
+ * Every histogram is a node of the graph, and the node of a histogram is its
+ * arena slot. A node is on levels 0 to its level, which is drawn at random so
+ * that each level has about 1 / HNSW_LINKS of the nodes of the level below. On
+ * each level a node is linked to its nearest nodes. The search descends from
+ * the top level greedily, and on level 0 keeps the given number (ef) of best
+ * nodes found, which trades the search time against the recall.
+ *
+ * The distance is the one of LBPImage::galleryDistance(). It is not a metric,
+ * which the graph doesn't need.
+ *
+ * Searching and adding may be done from different threads. A search blocks
+ * adding for the time of one search. The index keeps the view of the arena
+ * it was last updated from, so its histograms stay valid after the arena is
+ * cleared. Updating from a view of another generation of the arena starts a
+ * new index.
+ */
+class HnswIndex
+{
+public:
+    struct Result
+    {
+        Result() :
+            distance(std::numeric_limits<float>::max()),
+            slot(std::numeric_limits<quint32>::max()),
+            histogramsCompared(0),
+            patchesEvaluated(0) {}
+
+        float distance;                 /**< The smallest distance below the bound. */
+        quint32 slot;                   /**< Arena slot of the nearest histogram. */
+        quint32 histogramsCompared;
+        quint64 patchesEvaluated;       /**< Patches compared in all comparisons. */
+    };
+
+    HnswIndex();
+
+    quint32 nodeCount() const;
+
+    /**
+     * @brief Return the generation of the arena of the nodes.
+     */
+    quint32 generation() const;
+
+    /**
+     * @brief Add the histograms of the view which are not in the index yet.
+     *
+     * Slots are never removed from the arena, so the nodes added earlier are
+     * the first slots of the arena. A view of fewer histograms than the index
+     * has is ignored.
+     */
+    void update(const HistogramArena::View &arena);
+
+    /**
+     * @brief Point the nodes to the histograms of the view, after the arena
+     * has moved them (see HistogramArena::remap()).
+     */
+    void relocate(const HistogramArena::View &arena);
+
+    /**
+     * @brief Find the nearest histogram of the given histogram.
+     *
+     * @param histogram     A histogram in the form returned by
+     *                      LBPImage::toGalleryHistogram().
+     * @param ef            Number of best nodes kept in the search of level
+     *                      0. The bigger, the better the recall and the slower
+     *                      the search.
+     * @param bound         Distances bigger than this are not of interest.
+     * @return Result       The nearest histogram found, if its distance is
+     *                      below the bound.
+     */
+    Result search(const cv::Mat &histogram, const int ef, const float bound = std::numeric_limits<float>::max()) const;
+
+    void clear();
+
+    /**
+     * @brief Clear the index, unless it is being used. A stale index is
+     * started again by the next update() anyway.
+     */
+    void release();
+
+    /**
+     * @brief Write the graph to a file.
+     *
+     * The nodes are renumbered to the order of the histograms in the database
+     * file, which is the order of their slots when the file is loaded. Nodes
+     * not in the order are left out.
+     *
+     * @param filename      The index file.
+     * @param order         Slots of the histograms in the order of the file.
+     * @param fileSize      Size of the database file, to detect an index file
+     *                      of some other version of the file.
+     */
+    bool write(const QString &filename, const QVector<quint32> &order, const qint64 fileSize) const;
+
+    /**
+     * @brief Read the graph of the histograms of a database file.
+     *
+     * The histograms of the file must be the first histograms of the view.
+     * If the file doesn't match them, nothing is read. Otherwise the index
+     * is replaced.
+     */
+    bool read(const QString &filename, const HistogramArena::View &arena, const qint64 fileSize);
+
+    /**
+     * @brief Return the index file of a database file.
+     */
+    static QString filename(const QString &databaseFilename)   { return databaseFilename + ".hnsw"; }
+
+private:
+    struct Node
+    {
+        const uchar *histogram;
+        int histogramSize;
+        QVector<QVector<quint32> > links;   // Links of each level.
+    };
+
+    // Distance and node.
+    typedef QPair<float, quint32> Candidate;
+
+    float distance(const cv::Mat &histogram, const quint32 node, const float bound, Result *result) const;
+    cv::Mat histogramOf(const quint32 node) const;
+
+    void reset();
+    void insert(const quint32 node);
+    int randomLevel();
+
+    QVector<Candidate> searchLevel(const cv::Mat &histogram, const Candidate &entry, const int ef, const int level, Result *result) const;
+    QVector<quint32> selectLinks(const QVector<Candidate> &candidates, const int linkCount) const;
+    void addLink(const quint32 node, const quint32 link, const int level);
+
+    int maxLinks(const int level) const     { return level == 0 ? 2 * linkCount : linkCount; }
+
+private:
+    mutable QReadWriteLock lock;
+
+    QVector<Node> nodes;
+    HistogramArena::View histograms;
+    int histogramType;
+    quint32 entryPoint;
+    int topLevel;
+
+    int linkCount;
+    int constructionWidth;
+    quint64 randomState;
+
+};
+
+#endif // HNSWINDEX_H
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "InvertedFileSearch.h"
+#include "LBPImage.h"
+#include <QtGlobal>
+#include <algorithm>
+
+using namespace cv;
+
+InvertedFileSearch::InvertedFileSearch() :
+    version(0),
+    isBuilt(false),
+    generation(0)
+{
+}
+
+void InvertedFileSearch::update(const Database::Snapshot &snapshot)
+{
+    if (isBuilt && snapshot.version() == version)
+    {
+        return;
+    }
+
+    // Slots of another arena generation are different histograms.
+    if (!isBuilt || snapshot.arenaGeneration() != generation)
+    {
+        centroids.clear();
+        centroidOfTrack.clear();
+    }
+
+    version = snapshot.version();
+    isBuilt = true;
+    generation = snapshot.arenaGeneration();
+
+    lists.clear();
+
+    for (quint32 personId = 0; personId < snapshot.personCount(); personId++)
+    {
+        for (quint32 trackId = 0; trackId < snapshot.trackCount(personId); trackId++)
+        {
+            const quint32 histogramCount = snapshot.histogramCount(personId, trackId);
+            if (histogramCount == 0)
+            {
+                continue;
+            }
+
+            const quint32 firstSlot = snapshot.histogramSlot(personId, trackId, 0);
+
+            int index = centroidOfTrack.value(firstSlot, -1);
+            if (index == -1)
+            {
+                Centroid centroid;
+                centroid.sum = Mat::zeros(1, LBPImage::histogramSize(), CV_32FC1);
+                centroid.histogramCount = 0;
+
+                index = centroids.size();
+                centroids.append(centroid);
+                centroidOfTrack.insert(firstSlot, index);
+            }
+
+            // Only the histograms added since the last update are summed.
+            Centroid &centroid = centroids[index];
+            if (centroid.histogramCount < histogramCount)
+            {
+                for (quint32 histogramId = centroid.histogramCount; histogramId < histogramCount; histogramId++)
+                {
+                    const Mat histogram = LBPImage::fromGalleryHistogram(snapshot.getHistogram(personId, trackId, histogramId));
+                    if (histogram.cols == centroid.sum.cols && histogram.type() == CV_32FC1)
+                    {
+                        add(centroid.sum, histogram, centroid.sum);
+                    }
+                }
+
+                centroid.histogramCount = histogramCount;
+                centroid.mean = centroid.sum * (1.0 / histogramCount);
+            }
+
+            List list;
+            list.personId = personId;
+            list.trackId = trackId;
+            list.centroid = index;
+            lists.append(list);
+        }
+    }
+}
+
+void InvertedFileSearch::clear()
+{
+    centroids.clear();
+    centroidOfTrack.clear();
+    lists.clear();
+    isBuilt = false;
+}
+
+InvertedFileSearch::Result InvertedFileSearch::search(const Database::Snapshot &snapshot, const Mat &histogram, const int probeCount,
+                                                      const float bound, const SearchDeadline &deadline)
+{
+    Result result;
+
+    const Mat galleryHistogram = LBPImage::toGalleryHistogram(histogram);
+    if (lists.isEmpty() || galleryHistogram.empty())
+    {
+        return result;
+    }
+
+    // Rank the tracks by the distance to their centroids.
+    ranking.resize(lists.size());
+    for (int i = 0; i < lists.size(); i++)
+    {
+        if (i % SearchDeadline::CHECK_INTERVAL == 0 && deadline.isOver())
+        {
+            result.completed = false;
+            return result;
+        }
+
+        ranking[i] = qMakePair(LBPImage::distance(centroids.at(lists.at(i).centroid).mean, histogram), i);
+    }
+
+    result.histogramsCompared += lists.size();
+    result.patchesEvaluated += static_cast<quint64>(lists.size()) * LBPImage::patchCount();
+
+    const int count = qBound(1, probeCount, lists.size());
+    std::partial_sort(ranking.begin(), ranking.begin() + count, ranking.end());
+
+    // Scan the probed tracks exactly.
+    float best = bound;
+    for (int i = 0; i < count; i++)
+    {
+        if (deadline.isOver())
+        {
+            result.completed = false;
+            break;
+        }
+
+        const List &list = lists.at(ranking.at(i).second);
+        const quint32 histogramCount = snapshot.histogramCount(list.personId, list.trackId);
+
+        for (quint32 histogramId = 0; histogramId < histogramCount; histogramId++)
+        {
+            int patchesEvaluated;
+            const float distance = LBPImage::galleryDistance(snapshot.getHistogram(list.personId, list.trackId, histogramId), galleryHistogram,
+                                                             best, &patchesEvaluated);
+            result.histogramsCompared++;
+            result.patchesEvaluated += patchesEvaluated;
+
+            if (distance < best)
+            {
+                best = distance;
+                result.distance = distance;
+                result.personId = list.personId;
+            }
+        }
+    }
+
+    return result;
+}
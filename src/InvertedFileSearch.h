@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INVERTEDFILESEARCH_H
+#define INVERTEDFILESEARCH_H
+
+#include "Database.h"
+#include "SearchDeadline.h"
+#include <QHash>
+#include <QVector>
+#include <QPair>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Search of the database through the centroids of its tracks.
+ *
+ * The histograms of a track are mostly near-duplicate frames of one face, so
+ * the mean histogram of a track (the centroid) represents it well. A histogram
+ * is first compared to the centroids of all tracks, and then exactly to the
+ * histograms of the tracks of the nearest centroids only. The tracks are the
+ * inverted lists of an IVF index, and the number of probed tracks trades the
+ * search time against the recall.
+ *
+ * The centroids are kept as sums of the histograms, and updated with the
+ * histograms added to the tracks since the last snapshot. Tracks are
+ * identified by the arena slot of their first histogram, which stays the same
+ * when persons are merged.
+ */
+class InvertedFileSearch
+{
+public:
+    struct Result
+    {
+        Result() :
+            distance(std::numeric_limits<float>::max()),
+            personId(std::numeric_limits<quint32>::max()),
+            histogramsCompared(0),
+            patchesEvaluated(0),
+            completed(true) {}
+
+        float distance;                 /**< The smallest distance below the bound. */
+        quint32 personId;               /**< Person of the smallest distance. */
+        quint32 histogramsCompared;     /**< Comparisons to centroids and histograms. */
+        quint64 patchesEvaluated;       /**< Patches compared in them. */
+        bool completed;                 /**< False, if the deadline was over. */
+    };
+
+    InvertedFileSearch();
+
+    /**
+     * @brief Update the centroids to the given snapshot, unless they have been
+     * updated to it already.
+     */
+    void update(const Database::Snapshot &snapshot);
+    void clear();
+
+    /**
+     * @brief Search the snapshot given to the last update().
+     *
+     * @param snapshot      The snapshot given to update().
+     * @param histogram     A uniform spatial histogram (as returned by
+     *                      LBPImage::histogram()).
+     * @param probeCount    Number of tracks of the nearest centroids compared
+     *                      exactly.
+     * @param bound         Distances bigger than this are not of interest.
+     * @param deadline      The time limit and the stop request of the search.
+     *                      If it is over, the search returns the best match
+     *                      found so far.
+     * @return Result       The best match in the probed tracks.
+     */
+    Result search(const Database::Snapshot &snapshot, const cv::Mat &histogram, const int probeCount, const float bound,
+                  const SearchDeadline &deadline = SearchDeadline());
+
+private:
+    struct Centroid
+    {
+        cv::Mat sum;                // Sum of the histograms of the track.
+        cv::Mat mean;
+        quint32 histogramCount;     // Number of histograms in the sum.
+    };
+
+    struct List
+    {
+        quint32 personId;
+        quint32 trackId;
+        int centroid;
+    };
+
+    quint64 version;
+    bool isBuilt;
+    quint32 generation;
+
+    QVector<Centroid> centroids;
+    QHash<quint32, int> centroidOfTrack;    // First slot of a track -> centroid.
+    QVector<List> lists;                    // Tracks of the snapshot.
+
+    // Buffer of the search, kept to avoid reallocating it.
+    std::vector<QPair<float, int> > ranking;
+
+};
+
+#endif // INVERTEDFILESEARCH_H
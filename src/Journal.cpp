@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Journal.h"
+#include "Constants.h"
+#include <QDataStream>
+#include <QDebug>
+
+// Size of the record header: size (quint32) and checksum (quint16).
+const int RECORD_HEADER_SIZE = 6;
+
+Journal::Journal() :
+    flushIntervalMs(JOURNAL_FLUSH_INTERVAL_MS)
+{
+}
+
+Journal::~Journal()
+{
+    close();
+}
+
+bool Journal::open(const QString &filename, const bool truncate)
+{
+    close();
+
+    qint64 validSize = 0;
+    if (!truncate)
+    {
+        read(filename, &validSize);
+    }
+
+    file.setFileName(filename);
+
+    if (!file.open(QIODevice::ReadWrite) || !file.resize(validSize) || !file.seek(validSize))
+    {
+        qDebug() << "Failed to open a journal file:" << filename;
+
+        file.close();
+
+        return false;
+    }
+
+    lastFlush.start();
+
+    return true;
+}
+
+void Journal::close()
+{
+    if (file.isOpen())
+    {
+        flush();
+        file.close();
+    }
+}
+
+bool Journal::rotate()
+{
+    if (!file.isOpen() || !flush())
+    {
+        return false;
+    }
+
+    const QString filename = file.fileName();
+    const QString previousFilename = filename + ".old";
+
+    // Usually there is no previous journal, and the journal just becomes it,
+    // so no records are copied.
+    if (!QFile::exists(previousFilename))
+    {
+        file.close();
+
+        if (!QFile::rename(filename, previousFilename))
+        {
+            qDebug() << "Failed to rename a journal file:" << filename;
+
+            open(filename, false);
+
+            return false;
+        }
+
+        return open(filename, true);
+    }
+
+    // The last rewrite failed, so the records are appended to the previous
+    // journal, which is still needed.
+    qint64 validSize = 0;
+    read(previousFilename, &validSize);
+
+    QFile previous(previousFilename);
+    if (!previous.open(QIODevice::ReadWrite) || !previous.resize(validSize) || !previous.seek(validSize))
+    {
+        qDebug() << "Failed to open a journal file:" << previousFilename;
+
+        return false;
+    }
+
+    // Records after the last valid record are not copied.
+    qint64 size = 0;
+    read(filename, &size);
+
+    file.seek(0);
+    const QByteArray records = file.read(size);
+    file.seek(file.size());
+
+    if (records.size() != size || previous.write(records) != size || !previous.flush())
+    {
+        qDebug() << "Failed to write to a journal file:" << previousFilename;
+
+        previous.resize(validSize);
+
+        return false;
+    }
+
+    if (!file.resize(0) || !file.seek(0))
+    {
+        qDebug() << "Failed to truncate a journal file:" << file.fileName();
+
+        // Otherwise the records would be replayed twice.
+        previous.resize(validSize);
+
+        return false;
+    }
+
+    return true;
+}
+
+void Journal::append(const QByteArray &record)
+{
+    if (!file.isOpen())
+    {
+        return;
+    }
+
+    QDataStream stream(&buffer, QIODevice::WriteOnly | QIODevice::Append);
+    stream << static_cast<quint32>(record.size()) << qChecksum(record.constData(), record.size());
+    stream.writeRawData(record.constData(), record.size());
+
+    if (lastFlush.elapsed() >= flushIntervalMs)
+    {
+        flush();
+    }
+}
+
+bool Journal::flush()
+{
+    lastFlush.restart();
+
+    if (!file.isOpen() || buffer.isEmpty())
+    {
+        return true;
+    }
+
+    const bool ok = file.write(buffer) == buffer.size() && file.flush();
+    buffer.clear();
+
+    if (!ok)
+    {
+        qDebug() << "Failed to write to a journal file:" << file.fileName();
+    }
+
+    return ok;
+}
+
+qint64 Journal::size() const
+{
+    return file.isOpen() ? file.size() + buffer.size() : 0;
+}
+
+QList<QByteArray> Journal::read(const QString &filename, qint64 *validSize)
+{
+    QList<QByteArray> records;
+
+    if (validSize)
+    {
+        *validSize = 0;
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return records;
+    }
+
+    QDataStream stream(&file);
+    qint64 position = 0;
+
+    while (!stream.atEnd())
+    {
+        quint32 recordSize;
+        quint16 checksum;
+        stream >> recordSize >> checksum;
+
+        if (stream.status() != QDataStream::Ok ||
+            recordSize > static_cast<quint64>(file.size() - position - RECORD_HEADER_SIZE))
+        {
+            break;
+        }
+
+        QByteArray record(recordSize, 0);
+        if (stream.readRawData(record.data(), recordSize) != static_cast<int>(recordSize) ||
+            qChecksum(record.constData(), record.size()) != checksum)
+        {
+            break;
+        }
+
+        records.append(record);
+        position += RECORD_HEADER_SIZE + recordSize;
+    }
+
+    if (validSize)
+    {
+        *validSize = position;
+    }
+
+    return records;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <QFile>
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QElapsedTimer>
+
+/**
+ * @brief Append-only log of the changes made to the database.
+ *
+ * Every change is appended as a record: size (quint32), checksum (quint16) and
+ * the data. Records are buffered and written to the file in batches, when the
+ * flush interval has passed since the last write or when flush() is called.
+ * A record that was cut by a crash is detected by its size or checksum and
+ * dropped.
+ */
+class Journal
+{
+public:
+    Journal();
+    ~Journal();
+
+    /**
+     * @brief Open a journal for appending.
+     *
+     * @param filename  The journal file.
+     * @param truncate  If true, the journal is emptied. Otherwise the records
+     *                  after the last valid record are dropped.
+     */
+    bool open(const QString &filename, const bool truncate);
+    void close();
+
+    /**
+     * @brief Move the records to the previous journal of the file and empty
+     * the journal.
+     *
+     * Used when the database file is being rewritten: the records in the
+     * previous journal are needed until the new file has been written. The
+     * journal file is renamed to the previous journal and a new journal file
+     * is started, so no records are copied. Only if the previous journal
+     * already exists (the last rewrite failed), the records are appended to
+     * it.
+     */
+    bool rotate();
+    bool isOpen() const     { return file.isOpen(); }
+
+    void append(const QByteArray &record);
+    bool flush();
+
+    void setFlushInterval(const int ms)     { flushIntervalMs = ms; }
+
+    /**
+     * @brief Return the size of the journal in bytes, including the buffered
+     * records.
+     */
+    qint64 size() const;
+
+    /**
+     * @brief Read all valid records of a journal file.
+     *
+     * @param filename      The journal file.
+     * @param validSize     If not null, the size of the valid part of the file
+     *                      is written here.
+     */
+    static QList<QByteArray> read(const QString &filename, qint64 *validSize=0);
+
+    /**
+     * @brief Return the journal file of a database file.
+     */
+    static QString filename(const QString &databaseFilename)   { return databaseFilename + ".journal"; }
+
+    /**
+     * @brief Return the previous journal file of a database file.
+     */
+    static QString previousFilename(const QString &databaseFilename)   { return filename(databaseFilename) + ".old"; }
+
+private:
+    QFile file;
+    QByteArray buffer;
+    QElapsedTimer lastFlush;
+    int flushIntervalMs;
+
+};
+
+#endif // JOURNAL_H
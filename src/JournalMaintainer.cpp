@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "JournalMaintainer.h"
+#include "Constants.h"
+#include <QDebug>
+
+JournalMaintainer::JournalMaintainer(QObject *parent) :
+    QObject(parent),
+    timer(0),
+    db(0)
+{
+    connect(this, SIGNAL(triggerStart()), this, SLOT(handleStart()), Qt::QueuedConnection);
+    connect(this, SIGNAL(triggerStop()), this, SLOT(handleStop()), Qt::QueuedConnection);
+}
+
+void JournalMaintainer::start()
+{
+    emit triggerStart();
+}
+
+void JournalMaintainer::stop()
+{
+    emit triggerStop();
+}
+
+void JournalMaintainer::handleStart()
+{
+    Q_ASSERT(db);
+
+    if (!timer)
+    {
+        // Created here, so that the timer lives in the thread of this object.
+        timer = new QTimer(this);
+        connect(timer, SIGNAL(timeout()), this, SLOT(handleTimeout()));
+    }
+
+    compactionTimer.start();
+    timer->start(JOURNAL_FLUSH_INTERVAL_MS);
+}
+
+void JournalMaintainer::handleStop()
+{
+    if (timer)
+    {
+        timer->stop();
+    }
+
+    if (db)
+    {
+        db->flushJournal();
+    }
+}
+
+void JournalMaintainer::handleTimeout()
+{
+    db->flushJournal();
+
+    if (compactionTimer.elapsed() >= JOURNAL_COMPACTION_INTERVAL_MS)
+    {
+        compactionTimer.restart();
+
+        if (db->journalSize() >= JOURNAL_COMPACTION_SIZE)
+        {
+            const bool success = db->compact();
+
+            qDebug() << (success ? "Journal compacted." : "Failed to compact journal.");
+
+            emit journalCompacted(success);
+        }
+    }
+}
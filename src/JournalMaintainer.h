@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef JOURNALMAINTAINER_H
+#define JOURNALMAINTAINER_H
+
+#include "Database.h"
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+/**
+ * @brief Flushes the journal of the database and compacts it periodically.
+ *
+ * The journal is flushed every JOURNAL_FLUSH_INTERVAL_MS, so that changes
+ * reach the disk even if no more changes are made. Every
+ * JOURNAL_COMPACTION_INTERVAL_MS the journal is compacted if it is bigger than
+ * JOURNAL_COMPACTION_SIZE. This object is meant to be run in its own thread.
+ */
+class JournalMaintainer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit JournalMaintainer(QObject *parent = 0);
+
+    void setDatabase(Database *db)   { this->db = db; }
+
+    void start();
+    void stop();
+
+signals:
+    void triggerStart();
+    void triggerStop();
+    void journalCompacted(const bool success);
+
+public slots:
+    // Connect to QThread::finished() to stop the timer in its own thread.
+    void handleStop();
+
+private slots:
+    void handleStart();
+    void handleTimeout();
+
+private:
+    QTimer *timer;
+    QElapsedTimer compactionTimer;
+
+    Database *db;
+
+};
+
+#endif // JOURNALMAINTAINER_H
@@ -0,0 +1,610 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LBPDESCRIPTOR_H
+#define LBPDESCRIPTOR_H
+
+#include "opencv2/opencv.hpp"
+#include <QtGlobal>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LBP_USE_SIMD
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief The 7x7 grid of face patches.
+ *
+ * 10 patches are left out (because their weight is zero), so there are
+ * 7 * 7 - 10 = 39 patches. See LBPImage::distance() for the weights.
+ */
+struct FaceGrid
+{
+    enum { X = 7, Y = 7, PATCH_COUNT = 39, COARSE_X = 3, COARSE_Y = 3 };
+
+    static bool isRemoved(const int i, const int j)
+    {
+        return ((j == 0 || j == 6) && (i == 3 || i == 4 || i == 5 || i == 6)) ||
+               ((j == 3 && (i == 2 || i == 3)));
+    }
+
+    static int weight(const int patch)
+    {
+        static const int WEIGHTS[PATCH_COUNT] =
+            { 2, 1, 1, 1, 1, 1, 2,
+              2, 4, 4, 1, 4, 4, 2,
+              1, 1, 1,    1, 1, 1,
+                 1, 1,    1, 1,
+                 1, 1, 1, 1, 1,
+                 1, 1, 2, 1, 1,
+                 1, 1, 1, 1, 1};
+
+        return WEIGHTS[patch];
+    }
+
+    /**
+     * @brief Return the cell of the 3x3 coarse grid that covers most of the
+     * patch on row i and column j (see LBPImage::coarseHistogram()).
+     */
+    static int coarseCell(const int i, const int j)
+    {
+        return (i * COARSE_Y / Y) * COARSE_X + j * COARSE_X / X;
+    }
+};
+
+/**
+ * @brief Mapping of LBP codes to the bins of uniform patterns.
+ *
+ * A pattern is uniform if it has at most two 0-1 transitions in circular
+ * order. Uniform patterns get their own bins in increasing order of the code,
+ * and the rest share the last bin. For 8 sampling points this is the uniform2
+ * pattern of 59 bins.
+ */
+template <int SamplingPoints>
+struct UniformPatterns
+{
+    Q_STATIC_ASSERT(SamplingPoints > 0 && SamplingPoints <= 8);
+
+    enum
+    {
+        CODE_COUNT = 1 << SamplingPoints,
+        BINS = SamplingPoints * (SamplingPoints - 1) + 3
+    };
+
+    UniformPatterns()
+    {
+        int bin = 0;
+        for (int code = 0; code < CODE_COUNT; code++)
+        {
+            const int rotated = ((code << 1) | (code >> (SamplingPoints - 1))) & (CODE_COUNT - 1);
+
+            int transitions = 0;
+            for (int changed = code ^ rotated; changed; changed >>= 1)
+            {
+                transitions += changed & 1;
+            }
+
+            table[code] = static_cast<unsigned char>(transitions <= 2 ? bin++ : BINS - 1);
+        }
+    }
+
+    unsigned char table[CODE_COUNT];
+};
+
+/**
+ * @brief Position and bilinear interpolation weights of one sampling point,
+ * relative to the center pixel.
+ *
+ * The weights are calculated exactly as in
+ * LBPImage::calcExtendedLBPReference(), so that interpolated values are the
+ * same.
+ */
+struct SamplingPoint
+{
+    SamplingPoint() : fx(0), fy(0), cx(0), cy(0), w1(0.0f), w2(0.0f), w3(0.0f), w4(0.0f) {}
+
+    SamplingPoint(const int n, const int radius, const int samplingPoints)
+    {
+        const float x = static_cast<float>(cos(2.0 * CV_PI * n / samplingPoints) * radius);
+        const float y = static_cast<float>(sin(2.0 * CV_PI * n / samplingPoints) * -radius);
+
+        fx = static_cast<int>(floor(x));
+        fy = static_cast<int>(floor(y));
+        cx = static_cast<int>(ceil(x));
+        cy = static_cast<int>(ceil(y));
+
+        const float ty = y - fy;
+        const float tx = x - fx;
+
+        w1 = (1 - tx) * (1 - ty);
+        w2 = tx  * (1 - ty);
+        w3 = (1 - tx) * ty;
+        w4 = tx  * ty;
+    }
+
+    int fx;
+    int fy;
+    int cx;
+    int cy;
+    float w1;
+    float w2;
+    float w3;
+    float w4;
+};
+
+/**
+ * @brief Buffers for calculating histograms, reused from image to image.
+ *
+ * The patch table is rebuilt only when the size of the image or the
+ * descriptor changes. A scratch must not be used by two threads at once.
+ */
+class LBPScratch
+{
+public:
+    LBPScratch() : descriptor(0), rows(0), cols(0) {}
+
+private:
+    template <int Radius, int SamplingPoints, class Grid> friend class LBPDescriptor;
+
+    // The descriptor and the size of the LBP image of the patch table.
+    const void *descriptor;
+    int rows;
+    int cols;
+
+    std::vector<unsigned char> codes;
+    std::vector<int> counts;
+    std::vector<int> offsets;
+};
+
+/**
+ * @brief Extended LBP descriptor of fixed parameters.
+ *
+ * Each configuration is compiled separately, so the loops over the sampling
+ * points and the sizes of the histogram are compile-time constants. The codes
+ * are bit-identical to LBPImage::calcExtendedLBPReference().
+ *
+ * When the number of sampling points is divisible by 4, four of the points lie
+ * on the axes, Radius pixels from the center. There the weights of the
+ * reference implementation are 1 for one pixel and 0 for the others, except
+ * that cos() and sin() give about 1e-16 instead of 0 for some of the points.
+ * Such a weight is too small to change the comparison, so on the axes the bit
+ * is simply pixel >= center. The other points are interpolated with the same
+ * float operations in the same order as in the reference implementation.
+ *
+ * The codes of a row are calculated in one pass, 16 pixels at a time with SSE2
+ * when the processor supports it and OpenCV optimizations are enabled (see
+ * cv::setUseOptimized()).
+ */
+template <int Radius, int SamplingPoints, class Grid>
+class LBPDescriptor
+{
+public:
+    enum
+    {
+        RADIUS = Radius,
+        SAMPLING_POINTS = SamplingPoints,
+        BINS = UniformPatterns<SamplingPoints>::BINS,
+        PATCH_COUNT = Grid::PATCH_COUNT,
+        HISTOGRAM_SIZE = PATCH_COUNT * BINS
+    };
+
+    LBPDescriptor()
+    {
+        for (int k = 0; k < INTERPOLATED_POINTS; k++)
+        {
+            const int n = interpolatedBit(k);
+            interpolated[k] = SamplingPoint(n, Radius, SamplingPoints);
+
+#ifdef LBP_USE_SIMD
+            weights[k][0] = _mm_set1_ps(interpolated[k].w1);
+            weights[k][1] = _mm_set1_ps(interpolated[k].w2);
+            weights[k][2] = _mm_set1_ps(interpolated[k].w3);
+            weights[k][3] = _mm_set1_ps(interpolated[k].w4);
+#endif
+        }
+    }
+
+    /**
+     * @brief Return true, if the image is big enough to have LBP codes.
+     */
+    static bool isApplicable(const cv::Mat &img)
+    {
+        return img.rows > 2 * Radius && img.cols > 2 * Radius;
+    }
+
+    /**
+     * @brief Calculate the LBP image.
+     */
+    cv::Mat image(const cv::Mat &img) const
+    {
+        cv::Mat result(img.rows - 2 * Radius, img.cols - 2 * Radius, CV_8UC1);
+        for (int i = Radius; i < img.rows - Radius; i++)
+        {
+            row(img, i, result.ptr<unsigned char>(i - Radius));
+        }
+
+        return result;
+    }
+
+    /**
+     * @brief Calculate the spatial histogram of the image.
+     *
+     * The codes are counted to the histogram row by row, without making the
+     * LBP image.
+     */
+    cv::Mat histogram(const cv::Mat &img) const
+    {
+        LBPScratch scratch;
+        cv::Mat result(1, HISTOGRAM_SIZE, CV_32FC1);
+        histogram(img, scratch, result.ptr<float>(0));
+
+        return result;
+    }
+
+    /**
+     * @brief Calculate the spatial histogram of the image to the given buffer.
+     *
+     * @param scratch   Buffers of the calculation.
+     * @param result    HISTOGRAM_SIZE floats.
+     */
+    void histogram(const cv::Mat &img, LBPScratch &scratch, float *result) const
+    {
+        PatchCounter counter(img.rows - 2 * Radius, img.cols - 2 * Radius, patterns, scratch, this);
+        scratch.codes.resize(img.cols - 2 * Radius);
+        unsigned char *codes = &scratch.codes[0];
+
+        for (int i = Radius; i < img.rows - Radius; i++)
+        {
+            row(img, i, codes);
+            counter.addRow(i - Radius, codes);
+        }
+
+        counter.histogram(result);
+    }
+
+    /**
+     * @brief Calculate the spatial histogram and the LBP image in one pass.
+     *
+     * The codes of each row are written to the LBP image and counted from
+     * there.
+     */
+    cv::Mat histogram(const cv::Mat &img, cv::Mat &lbpImage) const
+    {
+        LBPScratch scratch;
+        lbpImage.create(img.rows - 2 * Radius, img.cols - 2 * Radius, CV_8UC1);
+        PatchCounter counter(lbpImage.rows, lbpImage.cols, patterns, scratch, this);
+
+        for (int i = Radius; i < img.rows - Radius; i++)
+        {
+            unsigned char *codes = lbpImage.ptr<unsigned char>(i - Radius);
+            row(img, i, codes);
+            counter.addRow(i - Radius, codes);
+        }
+
+        cv::Mat result(1, HISTOGRAM_SIZE, CV_32FC1);
+        counter.histogram(result.ptr<float>(0));
+
+        return result;
+    }
+
+    /**
+     * @brief Calculate the spatial histogram of an LBP image.
+     */
+    cv::Mat spatialHistogram(const cv::Mat &lbpImage) const
+    {
+        LBPScratch scratch;
+        PatchCounter counter(lbpImage.rows, lbpImage.cols, patterns, scratch, this);
+        for (int y = 0; y < lbpImage.rows; y++)
+        {
+            counter.addRow(y, lbpImage.ptr<unsigned char>(y));
+        }
+
+        cv::Mat result(1, HISTOGRAM_SIZE, CV_32FC1);
+        counter.histogram(result.ptr<float>(0));
+
+        return result;
+    }
+
+    /**
+     * @brief Calculate the codes of row i of the source image.
+     *
+     * @param result    Row i - Radius of the LBP image.
+     */
+    void row(const cv::Mat &img, const int i, unsigned char *result) const
+    {
+        const unsigned char *rows[2 * Radius + 1];
+        for (int k = 0; k <= 2 * Radius; k++)
+        {
+            rows[k] = img.ptr<unsigned char>(i - Radius + k);
+        }
+
+        int j = Radius;
+        const int last = img.cols - Radius;
+
+#ifdef LBP_USE_SIMD
+        if (cv::useOptimized() && cv::checkHardwareSupport(CV_CPU_SSE2))
+        {
+            // Loads reach Radius pixels beyond the last pixel of the block,
+            // which is still inside the source row.
+            for (; j + 16 <= last; j += 16)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(result + j - Radius), codesSSE2(rows, j));
+            }
+        }
+#endif
+
+        for (; j < last; j++)
+        {
+            result[j - Radius] = code(rows, j);
+        }
+    }
+
+private:
+    enum
+    {
+        AXIS_POINTS = SamplingPoints % 4 == 0 ? 4 : 0,
+        INTERPOLATED_POINTS = SamplingPoints - AXIS_POINTS,
+        // Sizes of arrays must be positive.
+        INTERPOLATED_SIZE = INTERPOLATED_POINTS > 0 ? INTERPOLATED_POINTS : 1
+    };
+
+    // Bit (sampling point) of the k-th axis point. Axis points are at
+    // (Radius, 0), (0, -Radius), (-Radius, 0) and (0, Radius).
+    static int axisBit(const int k)     { return k * SamplingPoints / 4; }
+    static int axisX(const int k)       { return k == 0 ? Radius : (k == 2 ? -Radius : 0); }
+    static int axisY(const int k)       { return k == 1 ? -Radius : (k == 3 ? Radius : 0); }
+
+    // Bit (sampling point) of the k-th interpolated point.
+    static int interpolatedBit(const int k)
+    {
+        if (AXIS_POINTS == 0)
+        {
+            return k;
+        }
+
+        // Skip the axis points.
+        const int perQuarter = SamplingPoints / 4 - 1;
+        return (k / perQuarter) * (SamplingPoints / 4) + k % perQuarter + 1;
+    }
+
+    unsigned char code(const unsigned char *const *rows, const int j) const
+    {
+        const unsigned char center = rows[Radius][j];
+
+        unsigned char result = 0;
+        for (int k = 0; k < AXIS_POINTS; k++)
+        {
+            result |= (rows[Radius + axisY(k)][j + axisX(k)] >= center) << axisBit(k);
+        }
+
+        for (int k = 0; k < INTERPOLATED_POINTS; k++)
+        {
+            const SamplingPoint &p = interpolated[k];
+            const float t =
+                p.w1 * rows[Radius + p.fy][j + p.fx] +
+                p.w2 * rows[Radius + p.fy][j + p.cx] +
+                p.w3 * rows[Radius + p.cy][j + p.fx] +
+                p.w4 * rows[Radius + p.cy][j + p.cx];
+
+            result |= ((t > center) || (std::abs(t - center) < std::numeric_limits<float>::epsilon())) << interpolatedBit(k);
+        }
+
+        return result;
+    }
+
+#ifdef LBP_USE_SIMD
+    static __m128i load(const unsigned char *p)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+
+    static void toFloat(const __m128i v, __m128 *result)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i low = _mm_unpacklo_epi8(v, zero);
+        const __m128i high = _mm_unpackhi_epi8(v, zero);
+
+        result[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero));
+        result[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero));
+        result[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero));
+        result[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero));
+    }
+
+    __m128i codesSSE2(const unsigned char *const *rows, const int j) const
+    {
+        const __m128i center = load(rows[Radius] + j);
+
+        __m128i result = _mm_setzero_si128();
+        for (int k = 0; k < AXIS_POINTS; k++)
+        {
+            // Unsigned pixel >= center, 0xFF or 0 in each byte.
+            const __m128i pixel = load(rows[Radius + axisY(k)] + j + axisX(k));
+            const __m128i mask = _mm_cmpeq_epi8(_mm_max_epu8(pixel, center), pixel);
+            result = _mm_or_si128(result, _mm_and_si128(mask, _mm_set1_epi8(static_cast<char>(1 << axisBit(k)))));
+        }
+
+        if (INTERPOLATED_POINTS == 0)
+        {
+            return result;
+        }
+
+        __m128 centerF[4];
+        toFloat(center, centerF);
+
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 epsilon = _mm_set1_ps(std::numeric_limits<float>::epsilon());
+
+        for (int k = 0; k < INTERPOLATED_POINTS; k++)
+        {
+            const SamplingPoint &p = interpolated[k];
+            const __m128 *w = weights[k];
+
+            __m128 a[4];
+            __m128 b[4];
+            __m128 c[4];
+            __m128 d[4];
+            toFloat(load(rows[Radius + p.fy] + j + p.fx), a);
+            toFloat(load(rows[Radius + p.fy] + j + p.cx), b);
+            toFloat(load(rows[Radius + p.cy] + j + p.fx), c);
+            toFloat(load(rows[Radius + p.cy] + j + p.cx), d);
+
+            __m128i masks[4];
+            for (int q = 0; q < 4; q++)
+            {
+                // Same operations in the same order as in the scalar code.
+                __m128 t = _mm_add_ps(_mm_mul_ps(w[0], a[q]), _mm_mul_ps(w[1], b[q]));
+                t = _mm_add_ps(t, _mm_mul_ps(w[2], c[q]));
+                t = _mm_add_ps(t, _mm_mul_ps(w[3], d[q]));
+
+                const __m128 greater = _mm_cmpgt_ps(t, centerF[q]);
+                const __m128 equal = _mm_cmplt_ps(_mm_and_ps(_mm_sub_ps(t, centerF[q]), absMask), epsilon);
+                masks[q] = _mm_castps_si128(_mm_or_ps(greater, equal));
+            }
+
+            // The masks are 0 or -1, so packing with saturation keeps them.
+            const __m128i mask = _mm_packs_epi16(_mm_packs_epi32(masks[0], masks[1]), _mm_packs_epi32(masks[2], masks[3]));
+            result = _mm_or_si128(result, _mm_and_si128(mask, _mm_set1_epi8(static_cast<char>(1 << interpolatedBit(k)))));
+        }
+
+        return result;
+    }
+#endif
+
+    /**
+     * @brief Counts the codes of an LBP image in the patches of the grid.
+     *
+     * Columns outside the patches (removed patches and the remainder on the
+     * right) are counted to an extra patch at the end, which is dropped, so
+     * that counting needs no branches.
+     */
+    class PatchCounter
+    {
+    public:
+        PatchCounter(const int rows, const int cols, const UniformPatterns<SamplingPoints> &patterns, LBPScratch &scratch, const void *descriptor) :
+            height(rows / Grid::Y),
+            cols(cols),
+            total(static_cast<float>(static_cast<size_t>(rows) * cols)),
+            patterns(patterns),
+            counts(scratch.counts),
+            offsets(scratch.offsets)
+        {
+            counts.assign(HISTOGRAM_SIZE + BINS, 0);
+
+            if (scratch.descriptor == descriptor && scratch.rows == rows && scratch.cols == cols)
+            {
+                return;
+            }
+
+            scratch.descriptor = descriptor;
+            scratch.rows = rows;
+            scratch.cols = cols;
+
+            // Histogram offset of the patch of each column in each row of
+            // patches.
+            const int width = cols / Grid::X;
+            offsets.assign(Grid::Y * cols, HISTOGRAM_SIZE);
+
+            int patchIndex = 0;
+            for (int i = 0; i < Grid::Y; i++)
+            {
+                for (int j = 0; j < Grid::X; j++)
+                {
+                    if (Grid::isRemoved(i, j))
+                    {
+                        continue;
+                    }
+
+                    for (int x = j * width; x < (j + 1) * width; x++)
+                    {
+                        offsets[i * cols + x] = patchIndex * BINS;
+                    }
+
+                    patchIndex++;
+                }
+            }
+        }
+
+        void addRow(const int y, const unsigned char *codes)
+        {
+            // Rows in the remainder at the bottom are not in any patch.
+            if (height == 0 || y >= Grid::Y * height)
+            {
+                return;
+            }
+
+            const int *rowOffsets = &offsets[(y / height) * cols];
+            const unsigned char *table = patterns.table;
+            int *patternCounts = &counts[0];
+
+            for (int x = 0; x < cols; x++)
+            {
+                patternCounts[rowOffsets[x] + table[codes[x]]]++;
+            }
+        }
+
+        void histogram(float *result) const
+        {
+            for (int i = 0; i < HISTOGRAM_SIZE; i++)
+            {
+                result[i] = static_cast<float>(counts[i]);
+            }
+
+            // Normalize.
+            cv::Mat normalized(1, HISTOGRAM_SIZE, CV_32FC1, result);
+            normalized /= total;
+        }
+
+    private:
+        int height;
+        int cols;
+        float total;
+        const UniformPatterns<SamplingPoints> &patterns;
+        std::vector<int> &counts;
+        std::vector<int> &offsets;
+
+    };
+
+private:
+    UniformPatterns<SamplingPoints> patterns;
+    SamplingPoint interpolated[INTERPOLATED_SIZE];
+
+#ifdef LBP_USE_SIMD
+    __m128 weights[INTERPOLATED_SIZE][4];
+#endif
+
+};
+
+#endif // LBPDESCRIPTOR_H
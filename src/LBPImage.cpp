@@ -30,91 +30,1337 @@
  */
 
 #include "LBPImage.h"
+#include "LBPDescriptor.h"
 #include "Constants.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <limits>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// GCC needs to be told that the function may use AVX instructions. MSVC
+// allows AVX intrinsics in any function.
+#if defined(__GNUC__)
+#define LBP_TARGET_AVX __attribute__((target("avx")))
+#else
+#define LBP_TARGET_AVX
+#endif
+
+static float chiSquareScalar(const float *h1, const float *h2, const int length)
+{
+    float distance = 0.0f;
+    for (int i = 0; i < length; i++)
+    {
+        const float sum = h1[i] + h2[i];
+        if (sum > 0.0f)
+        {
+            const float diff = h1[i] - h2[i];
+            distance += (diff * diff) / sum;
+        }
+    }
+
+    return distance;
+}
+
+#ifdef LBP_USE_SIMD
+
+static inline __m128 chiSquareTermSSE2(const __m128 v1, const __m128 v2)
+{
+    const __m128 sum = _mm_add_ps(v1, v2);
+    const __m128 diff = _mm_sub_ps(v1, v2);
+
+    // Bins where both histograms are empty give 0/0. The mask clears them.
+    const __m128 mask = _mm_cmpgt_ps(sum, _mm_setzero_ps());
+    return _mm_and_ps(mask, _mm_div_ps(_mm_mul_ps(diff, diff), sum));
+}
+
+static float chiSquareSSE2(const float *h1, const float *h2, const int length)
+{
+    // Two accumulators, so that the additions don't wait for each other.
+    __m128 acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps();
+
+    int i = 0;
+    for (; i <= length - 8; i += 8)
+    {
+        acc1 = _mm_add_ps(acc1, chiSquareTermSSE2(_mm_loadu_ps(h1 + i), _mm_loadu_ps(h2 + i)));
+        acc2 = _mm_add_ps(acc2, chiSquareTermSSE2(_mm_loadu_ps(h1 + i + 4), _mm_loadu_ps(h2 + i + 4)));
+    }
+
+    if (i <= length - 4)
+    {
+        acc1 = _mm_add_ps(acc1, chiSquareTermSSE2(_mm_loadu_ps(h1 + i), _mm_loadu_ps(h2 + i)));
+        i += 4;
+    }
+
+    float partial[4];
+    _mm_storeu_ps(partial, _mm_add_ps(acc1, acc2));
+
+    return (partial[0] + partial[1]) + (partial[2] + partial[3]) +
+           chiSquareScalar(h1 + i, h2 + i, length - i);
+}
+
+LBP_TARGET_AVX
+static inline __m256 chiSquareTermAVX(const __m256 v1, const __m256 v2)
+{
+    const __m256 sum = _mm256_add_ps(v1, v2);
+    const __m256 diff = _mm256_sub_ps(v1, v2);
+
+    // Bins where both histograms are empty give 0/0. The mask clears them.
+    const __m256 mask = _mm256_cmp_ps(sum, _mm256_setzero_ps(), _CMP_GT_OQ);
+    return _mm256_and_ps(mask, _mm256_div_ps(_mm256_mul_ps(diff, diff), sum));
+}
+
+// The kernel doesn't leave the AVX state, so that it can be called for every
+// patch of a comparison. The caller must call _mm256_zeroupper() before
+// returning to SSE code.
+LBP_TARGET_AVX
+static inline float chiSquareAVX(const float *h1, const float *h2, const int length)
+{
+    // Two accumulators, so that the additions don't wait for each other.
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i <= length - 16; i += 16)
+    {
+        acc1 = _mm256_add_ps(acc1, chiSquareTermAVX(_mm256_loadu_ps(h1 + i), _mm256_loadu_ps(h2 + i)));
+        acc2 = _mm256_add_ps(acc2, chiSquareTermAVX(_mm256_loadu_ps(h1 + i + 8), _mm256_loadu_ps(h2 + i + 8)));
+    }
+
+    if (i <= length - 8)
+    {
+        acc1 = _mm256_add_ps(acc1, chiSquareTermAVX(_mm256_loadu_ps(h1 + i), _mm256_loadu_ps(h2 + i)));
+        i += 8;
+    }
+
+    const __m256 acc = _mm256_add_ps(acc1, acc2);
+    const __m128 acc4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+
+    float partial[4];
+    _mm_storeu_ps(partial, acc4);
+
+    return (partial[0] + partial[1]) + (partial[2] + partial[3]) +
+           chiSquareScalar(h1 + i, h2 + i, length - i);
+}
+
+/**
+ * @brief chiSquareAVX() called from SSE code.
+ */
+LBP_TARGET_AVX
+static float chiSquareLeaveAVX(const float *h1, const float *h2, const int length)
+{
+    const float distance = chiSquareAVX(h1, h2, length);
+
+    // Leave AVX state before possible SSE code to avoid transition penalty.
+    _mm256_zeroupper();
+
+    return distance;
+}
+
+#endif // LBP_USE_SIMD
+
+// Instruction sets of the Chi square kernels.
+enum ChiSquareKernel
+{
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX
+};
+
+/**
+ * @brief Return the fastest available Chi square kernel.
+ *
+ * The kernel is selected once per comparison, and all patches of the
+ * comparison are compared with it.
+ */
+static ChiSquareKernel chiSquareKernel()
+{
+#ifdef LBP_USE_SIMD
+    if (cv::useOptimized())
+    {
+        if (cv::checkHardwareSupport(CV_CPU_AVX))
+        {
+            return KERNEL_AVX;
+        }
+
+        if (cv::checkHardwareSupport(CV_CPU_SSE2))
+        {
+            return KERNEL_SSE2;
+        }
+    }
+#endif
+
+    return KERNEL_SCALAR;
+}
+
+/**
+ * @brief Unweighted Chi square distance using the fastest available kernel.
+ */
+static float chiSquare(const float *h1, const float *h2, const int length)
+{
+    switch (chiSquareKernel())
+    {
+#ifdef LBP_USE_SIMD
+    case KERNEL_AVX:
+        return chiSquareLeaveAVX(h1, h2, length);
+    case KERNEL_SSE2:
+        return chiSquareSSE2(h1, h2, length);
+#endif
+    default:
+        return chiSquareScalar(h1, h2, length);
+    }
+}
+
+// Chi square distance of quantized histograms (see
+// LBPImage::quantizeHistogram()). The counts are converted to floats, which is
+// exact. The squared differences are exact too, as long as the counts are
+// below 4096.
+
+static float chiSquareScalar(const quint16 *h1, const quint16 *h2, const int length)
+{
+    float distance = 0.0f;
+    for (int i = 0; i < length; i++)
+    {
+        const int sum = h1[i] + h2[i];
+        if (sum > 0)
+        {
+            const float diff = static_cast<float>(h1[i] - h2[i]);
+            distance += (diff * diff) / static_cast<float>(sum);
+        }
+    }
+
+    return distance;
+}
+
+#ifdef LBP_USE_SIMD
+
+static float chiSquareSSE2(const quint16 *h1, const quint16 *h2, const int length)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128 acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps();
+
+    int i = 0;
+    for (; i <= length - 8; i += 8)
+    {
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h1 + i));
+        const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h2 + i));
+
+        acc1 = _mm_add_ps(acc1, chiSquareTermSSE2(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v1, zero)),
+                                                  _mm_cvtepi32_ps(_mm_unpacklo_epi16(v2, zero))));
+        acc2 = _mm_add_ps(acc2, chiSquareTermSSE2(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v1, zero)),
+                                                  _mm_cvtepi32_ps(_mm_unpackhi_epi16(v2, zero))));
+    }
+
+    float partial[4];
+    _mm_storeu_ps(partial, _mm_add_ps(acc1, acc2));
+
+    return (partial[0] + partial[1]) + (partial[2] + partial[3]) +
+           chiSquareScalar(h1 + i, h2 + i, length - i);
+}
+
+LBP_TARGET_AVX
+static inline __m256 toFloatAVX(const quint16 *h)
+{
+    // AVX has no 256-bit integer instructions, so the counts are widened with
+    // SSE2 and only converted with AVX.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h));
+    const __m256i wide = _mm256_insertf128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(v, zero)), _mm_unpackhi_epi16(v, zero), 1);
+
+    return _mm256_cvtepi32_ps(wide);
+}
+
+// Like the float kernel, doesn't leave the AVX state.
+LBP_TARGET_AVX
+static inline float chiSquareAVX(const quint16 *h1, const quint16 *h2, const int length)
+{
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i <= length - 16; i += 16)
+    {
+        acc1 = _mm256_add_ps(acc1, chiSquareTermAVX(toFloatAVX(h1 + i), toFloatAVX(h2 + i)));
+        acc2 = _mm256_add_ps(acc2, chiSquareTermAVX(toFloatAVX(h1 + i + 8), toFloatAVX(h2 + i + 8)));
+    }
+
+    if (i <= length - 8)
+    {
+        acc1 = _mm256_add_ps(acc1, chiSquareTermAVX(toFloatAVX(h1 + i), toFloatAVX(h2 + i)));
+        i += 8;
+    }
+
+    const __m256 acc = _mm256_add_ps(acc1, acc2);
+    const __m128 acc4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+
+    float partial[4];
+    _mm_storeu_ps(partial, acc4);
+
+    return (partial[0] + partial[1]) + (partial[2] + partial[3]) +
+           chiSquareScalar(h1 + i, h2 + i, length - i);
+}
+
+#endif // LBP_USE_SIMD
+
+// The kernels as template arguments of the patch loops (see
+// HistogramLayout::DensePair).
+struct ScalarKernel
+{
+    static float chiSquare(const float *h1, const float *h2, const int length)     { return chiSquareScalar(h1, h2, length); }
+    static float chiSquare(const quint16 *h1, const quint16 *h2, const int length) { return chiSquareScalar(h1, h2, length); }
+};
+
+#ifdef LBP_USE_SIMD
+
+struct SSE2Kernel
+{
+    static float chiSquare(const float *h1, const float *h2, const int length)     { return chiSquareSSE2(h1, h2, length); }
+    static float chiSquare(const quint16 *h1, const quint16 *h2, const int length) { return chiSquareSSE2(h1, h2, length); }
+};
+
+struct AVXKernel
+{
+    LBP_TARGET_AVX
+    static float chiSquare(const float *h1, const float *h2, const int length)     { return chiSquareAVX(h1, h2, length); }
+    LBP_TARGET_AVX
+    static float chiSquare(const quint16 *h1, const quint16 *h2, const int length) { return chiSquareAVX(h1, h2, length); }
+};
+
+#endif // LBP_USE_SIMD
+
+// Bit operations of the masks of sparse histograms.
+
+static inline int lowestBit(const quint64 mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, static_cast<unsigned long>(mask)))
+    {
+        return static_cast<int>(index);
+    }
+
+    _BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+    return static_cast<int>(index) + 32;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+static inline int bitCount(quint64 mask)
+{
+#if defined(_MSC_VER)
+    int count = 0;
+    for (; mask != 0; mask &= mask - 1)
+    {
+        count++;
+    }
+
+    return count;
+#else
+    return __builtin_popcountll(mask);
+#endif
+}
+
+/**
+ * @brief Layout of spatial histograms: the patches of the grid, Bins bins each.
+ *
+ * Quantized histograms (see LBPImage::quantizeHistogram()) are in one of two
+ * forms, which are told apart by their size. Both end with the scale, as a
+ * float in two 16-bit values.
+ *
+ *  Dense:  quint16 counts[SIZE]
+ *  Sparse: quint64 masks[PATCH_COUNT]  (bit b set = bin b of the patch is not zero)
+ *          quint16 starts[PATCH_COUNT] (index of the first count of the patch)
+ *          quint16 counts[]            (non-zero counts in the order of the bins)
+ */
+template <class Grid, int Bins>
+class HistogramLayout
+{
+public:
+    enum
+    {
+        PATCH_COUNT = Grid::PATCH_COUNT,
+        BINS = Bins,
+        SIZE = PATCH_COUNT * Bins,
+        QUANTIZED_SIZE = SIZE + 2,
+        COARSE_SIZE = Grid::COARSE_X * Grid::COARSE_Y * Bins,
+        // Offsets of the parts of a sparse histogram in 16-bit values.
+        SPARSE_MASKS = 0,
+        SPARSE_STARTS = SPARSE_MASKS + 4 * PATCH_COUNT,
+        SPARSE_COUNTS = SPARSE_STARTS + PATCH_COUNT,
+        SPARSE_OVERHEAD = SPARSE_COUNTS + 2
+    };
+
+    HistogramLayout()
+    {
+        // Patches in the order used by the bounded distance. Patches with the
+        // biggest weight come first, so that the bound is exceeded as early as
+        // possible.
+        for (int i = 0; i < PATCH_COUNT; i++)
+        {
+            order[i] = i;
+            weights[i] = static_cast<float>(Grid::weight(i));
+        }
+
+        std::stable_sort(order, order + PATCH_COUNT, HeavierPatch());
+
+        // Coarse cell of each patch, in the order of the patches.
+        int patch = 0;
+        for (int i = 0; i < Grid::Y; i++)
+        {
+            for (int j = 0; j < Grid::X; j++)
+            {
+                if (!Grid::isRemoved(i, j))
+                {
+                    cells[patch++] = Grid::coarseCell(i, j);
+                }
+            }
+        }
+    }
+
+    static bool isValid(const cv::Mat &histogram)
+    {
+        return histogram.rows == 1 &&
+               histogram.cols == SIZE &&
+               histogram.type() == CV_32FC1;
+    }
+
+    static bool isValidQuantized(const cv::Mat &histogram)
+    {
+        return histogram.rows == 1 &&
+               histogram.cols == QUANTIZED_SIZE &&
+               histogram.type() == CV_16UC1;
+    }
+
+    /**
+     * @brief Check the size of a sparse histogram against the counts of its
+     * last patch.
+     *
+     * This is enough for the histograms created by sparse(). Histograms from
+     * files are checked with isConsistentSparse().
+     */
+    static bool isValidSparse(const cv::Mat &histogram)
+    {
+        if (histogram.rows != 1 ||
+            histogram.cols < SPARSE_OVERHEAD ||
+            histogram.cols >= QUANTIZED_SIZE ||
+            histogram.type() != CV_16UC1)
+        {
+            return false;
+        }
+
+        const quint16 *s = histogram.ptr<quint16>(0);
+        const int last = PATCH_COUNT - 1;
+
+        return s[SPARSE_STARTS + last] + bitCount(mask(s, last)) == histogram.cols - SPARSE_OVERHEAD;
+    }
+
+    static bool isConsistentSparse(const cv::Mat &histogram)
+    {
+        if (!isValidSparse(histogram))
+        {
+            return false;
+        }
+
+        const quint16 *s = histogram.ptr<quint16>(0);
+
+        int start = 0;
+        for (int i = 0; i < PATCH_COUNT; i++)
+        {
+            const quint64 m = mask(s, i);
+            if (s[SPARSE_STARTS + i] != start || (BINS < 64 && (m >> BINS) != 0))
+            {
+                return false;
+            }
+
+            start += bitCount(m);
+        }
+
+        // Counts must not be zero, so that the Chi square terms are defined.
+        for (int i = SPARSE_COUNTS; i < histogram.cols - 2; i++)
+        {
+            if (s[i] == 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static float scale(const cv::Mat &quantizedHistogram)
+    {
+        float scale;
+        std::memcpy(&scale, quantizedHistogram.ptr<quint16>(0) + quantizedHistogram.cols - 2, sizeof(scale));
+
+        return scale;
+    }
+
+    static quint64 mask(const quint16 *sparseHistogram, const int patch)
+    {
+        quint64 mask;
+        std::memcpy(&mask, sparseHistogram + SPARSE_MASKS + 4 * patch, sizeof(mask));
+
+        return mask;
+    }
+
+    static const quint16* counts(const quint16 *sparseHistogram, const int patch)
+    {
+        return sparseHistogram + SPARSE_COUNTS + sparseHistogram[SPARSE_STARTS + patch];
+    }
+
+    /**
+     * @brief Convert a dense quantized histogram to the sparse form.
+     */
+    static cv::Mat sparse(const quint16 *q, const int nonZeroCount)
+    {
+        cv::Mat result(1, SPARSE_OVERHEAD + nonZeroCount, CV_16UC1);
+        quint16 *s = result.ptr<quint16>(0);
+        quint16 *counts = s + SPARSE_COUNTS;
+
+        int n = 0;
+        for (int i = 0; i < PATCH_COUNT; i++)
+        {
+            quint64 mask = 0;
+            s[SPARSE_STARTS + i] = static_cast<quint16>(n);
+
+            for (int j = 0; j < BINS; j++)
+            {
+                const quint16 count = q[i * BINS + j];
+                if (count != 0)
+                {
+                    mask |= Q_UINT64_C(1) << j;
+                    counts[n++] = count;
+                }
+            }
+
+            std::memcpy(s + SPARSE_MASKS + 4 * i, &mask, sizeof(mask));
+        }
+
+        // The scale.
+        std::memcpy(counts + n, q + SIZE, 2 * sizeof(quint16));
+
+        return result;
+    }
+
+    /**
+     * @brief Convert a sparse histogram back to the dense form.
+     */
+    static void dense(const quint16 *s, quint16 *q)
+    {
+        std::memset(q, 0, SIZE * sizeof(quint16));
+
+        const quint16 *counts = s + SPARSE_COUNTS;
+        for (int i = 0; i < PATCH_COUNT; i++)
+        {
+            for (quint64 m = mask(s, i); m != 0; m &= m - 1)
+            {
+                q[i * BINS + lowestBit(m)] = *counts++;
+            }
+        }
+
+        std::memcpy(q + SIZE, counts, 2 * sizeof(quint16));
+    }
+
+    /**
+     * @brief Patches of two dense histograms, compared with the Chi square
+     * kernel of the given instruction set (see denseDistance()).
+     *
+     * The distance of each patch is multiplied by the scale. For float
+     * histograms the scale is 1, which doesn't change the result.
+     */
+    template <class T, class Kernel>
+    class DensePair
+    {
+    public:
+        DensePair(const T *h1, const T *h2, const float scale) : h1(h1), h2(h2), scale(scale) {}
+
+        float patchDistance(const int patch) const
+        {
+            const int index = patch * BINS;
+            return scale * Kernel::chiSquare(h1 + index, h2 + index, BINS);
+        }
+
+    private:
+        const T *h1;
+        const T *h2;
+        const float scale;
+    };
+
+    /**
+     * @brief Patches of a sparse and a dense quantized histogram.
+     *
+     * Only the non-zero bins of the sparse histogram are visited. In the
+     * other bins the Chi square term is the count of the dense histogram, so
+     * the counts of the dense patch are summed, and the visited bins are
+     * subtracted from the sum.
+     */
+    class SparseDensePair
+    {
+    public:
+        SparseDensePair(const quint16 *s, const quint16 *q, const float scale) : s(s), q(q), scale(scale) {}
+
+        float patchDistance(const int patch) const
+        {
+            const quint16 *counts = HistogramLayout::counts(s, patch);
+            const quint16 *dense = q + patch * BINS;
+
+            int remaining = 0;
+            for (int i = 0; i < BINS; i++)
+            {
+                remaining += dense[i];
+            }
+
+            float distance = 0.0f;
+            for (quint64 m = mask(s, patch); m != 0; m &= m - 1)
+            {
+                const int count1 = *counts++;
+                const int count2 = dense[lowestBit(m)];
+                const float diff = static_cast<float>(count1 - count2);
+
+                // The count of the sparse histogram is never zero.
+                distance += (diff * diff) / static_cast<float>(count1 + count2);
+                remaining -= count2;
+            }
+
+            return scale * (distance + static_cast<float>(remaining));
+        }
+
+    private:
+        const quint16 *s;
+        const quint16 *q;
+        const float scale;
+    };
+
+    /**
+     * @brief Patches of two sparse histograms.
+     *
+     * The union of the non-zero bins is visited. Where only one of the
+     * histograms has a count, the Chi square term is the count.
+     */
+    class SparsePair
+    {
+    public:
+        SparsePair(const quint16 *s1, const quint16 *s2, const float scale) : s1(s1), s2(s2), scale(scale) {}
+
+        float patchDistance(const int patch) const
+        {
+            const quint16 *counts1 = counts(s1, patch);
+            const quint16 *counts2 = counts(s2, patch);
+            const quint64 mask1 = mask(s1, patch);
+            const quint64 mask2 = mask(s2, patch);
+
+            float distance = 0.0f;
+            int single = 0;
+            for (quint64 m = mask1 | mask2; m != 0; m &= m - 1)
+            {
+                const quint64 bit = m & (~m + 1);
+                if (mask1 & mask2 & bit)
+                {
+                    const int count1 = *counts1++;
+                    const int count2 = *counts2++;
+                    const float diff = static_cast<float>(count1 - count2);
+
+                    distance += (diff * diff) / static_cast<float>(count1 + count2);
+                }
+                else if (mask1 & bit)
+                {
+                    single += *counts1++;
+                }
+                else
+                {
+                    single += *counts2++;
+                }
+            }
+
+            return scale * (distance + static_cast<float>(single));
+        }
+
+    private:
+        const quint16 *s1;
+        const quint16 *s2;
+        const float scale;
+    };
+
+    template <class Pair>
+    float distance(const Pair &pair) const
+    {
+        float distance = 0.0;
+        for (int i = 0; i < PATCH_COUNT; i++)
+        {
+            distance += weights[i] * pair.patchDistance(i);
+        }
+
+        return distance;
+    }
+
+    template <class Pair>
+    float boundedDistance(const Pair &pair, const bool useWeights, const float bound, int *patchesEvaluated) const
+    {
+        float distance = 0.0f;
+
+        int i = 0;
+        while (i < PATCH_COUNT)
+        {
+            const int patch = order[i];
+            const float d = pair.patchDistance(patch);
+
+            distance += useWeights ? weights[patch] * d : d;
+            i++;
+
+            if (distance > bound)
+            {
+                break;
+            }
+        }
+
+        if (patchesEvaluated)
+        {
+            *patchesEvaluated = i;
+        }
+
+        return distance;
+    }
+
+    /**
+     * @brief distance() of two dense histograms.
+     *
+     * The kernel is selected once, not for every patch.
+     */
+    template <class T>
+    float denseDistance(const T *h1, const T *h2, const float scale) const
+    {
+        switch (chiSquareKernel())
+        {
+#ifdef LBP_USE_SIMD
+        case KERNEL_AVX:
+            return distanceAVX(DensePair<T, AVXKernel>(h1, h2, scale));
+        case KERNEL_SSE2:
+            return distance(DensePair<T, SSE2Kernel>(h1, h2, scale));
+#endif
+        default:
+            return distance(DensePair<T, ScalarKernel>(h1, h2, scale));
+        }
+    }
+
+    /**
+     * @brief boundedDistance() of two dense histograms.
+     *
+     * The kernel is selected once, not for every patch.
+     */
+    template <class T>
+    float boundedDenseDistance(const T *h1, const T *h2, const float scale, const bool useWeights, const float bound,
+                               int *patchesEvaluated) const
+    {
+        switch (chiSquareKernel())
+        {
+#ifdef LBP_USE_SIMD
+        case KERNEL_AVX:
+            return boundedDistanceAVX(DensePair<T, AVXKernel>(h1, h2, scale), useWeights, bound, patchesEvaluated);
+        case KERNEL_SSE2:
+            return boundedDistance(DensePair<T, SSE2Kernel>(h1, h2, scale), useWeights, bound, patchesEvaluated);
+#endif
+        default:
+            return boundedDistance(DensePair<T, ScalarKernel>(h1, h2, scale), useWeights, bound, patchesEvaluated);
+        }
+    }
+
+    void multiply(float *h) const
+    {
+        for (int i = 0; i < PATCH_COUNT; i++)
+        {
+            for (int j = 0; j < BINS; j++)
+            {
+                h[i * BINS + j] *= weights[i];
+            }
+        }
+    }
+
+    /**
+     * @brief Sum the weighted patches of each coarse cell.
+     */
+    void coarsen(const float *h, float *result) const
+    {
+        std::fill(result, result + COARSE_SIZE, 0.0f);
+
+        for (int i = 0; i < PATCH_COUNT; i++)
+        {
+            float *cell = result + cells[i] * BINS;
+            for (int j = 0; j < BINS; j++)
+            {
+                cell[j] += weights[i] * h[i * BINS + j];
+            }
+        }
+    }
+
+    void divide(float *h) const
+    {
+        for (int i = 0; i < PATCH_COUNT; i++)
+        {
+            for (int j = 0; j < BINS; j++)
+            {
+                h[i * BINS + j] /= weights[i];
+            }
+        }
+    }
+
+private:
+#ifdef LBP_USE_SIMD
+    // The patch loops of the AVX kernel. The AVX state is left once per
+    // comparison instead of once per patch.
+    template <class Pair>
+    LBP_TARGET_AVX
+    float distanceAVX(const Pair &pair) const
+    {
+        const float result = distance(pair);
+        _mm256_zeroupper();
+
+        return result;
+    }
+
+    template <class Pair>
+    LBP_TARGET_AVX
+    float boundedDistanceAVX(const Pair &pair, const bool useWeights, const float bound, int *patchesEvaluated) const
+    {
+        const float result = boundedDistance(pair, useWeights, bound, patchesEvaluated);
+        _mm256_zeroupper();
+
+        return result;
+    }
+#endif
+
+    struct HeavierPatch
+    {
+        bool operator()(const int patch1, const int patch2) const
+        {
+            return Grid::weight(patch1) > Grid::weight(patch2);
+        }
+    };
+
+    int order[PATCH_COUNT];
+    float weights[PATCH_COUNT];
+    int cells[PATCH_COUNT];
 
-// Uniform2 LBP parameters.
-const int LBP_NUM_PATTERNS = 59;
-const int LBP_NUM_PATCHES = LBP_GRID_X * LBP_GRID_Y - 10; // 10 patches has zero
-                                                          // weight.
-
-// The original uniform2 pattern.
-int UNIFORM_PATTERN[256] =
-{
-   0,1,2,3,4,58,5,6,7,58,58,58,8,58,9,10,11,58,58,58,58,58,58,58,12,58,58,58,13,58,
-   14,15,16,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,17,58,58,58,58,58,58,58,18,
-   58,58,58,19,58,20,21,22,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,
-   58,58,58,58,58,58,58,58,58,58,58,58,23,58,58,58,58,58,58,58,58,58,58,58,58,58,
-   58,58,24,58,58,58,58,58,58,58,25,58,58,58,26,58,27,28,29,30,58,31,58,58,58,32,58,
-   58,58,58,58,58,58,33,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,34,58,58,58,58,
-   58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,58,
-   58,35,36,37,58,38,58,58,58,39,58,58,58,58,58,58,58,40,58,58,58,58,58,58,58,58,58,
-   58,58,58,58,58,58,41,42,43,58,44,58,58,58,45,58,58,58,58,58,58,58,46,47,48,58,49,
-   58,58,58,50,51,52,58,53,54,55,56,57
 };
 
-// The weight map.
-int WEIGHT_MAP[39] =
-    { 2, 1, 1, 1, 1, 1, 2,
-      2, 4, 4, 1, 4, 4, 2,
-      1, 1, 1,    1, 1, 1,
-         1, 1,    1, 1,
-         1, 1, 1, 1, 1,
-         1, 1, 2, 1, 1,
-         1, 1, 1, 1, 1};
+// The descriptors that can be selected at runtime. They all give histograms of
+// the same layout.
+typedef LBPDescriptor<1, 8, FaceGrid> DescriptorR1P8;
+typedef LBPDescriptor<2, 8, FaceGrid> DescriptorR2P8;
+typedef HistogramLayout<FaceGrid, UniformPatterns<8>::BINS> Layout;
+
+Q_STATIC_ASSERT(static_cast<int>(DescriptorR1P8::HISTOGRAM_SIZE) == static_cast<int>(Layout::SIZE));
+Q_STATIC_ASSERT(static_cast<int>(DescriptorR2P8::HISTOGRAM_SIZE) == static_cast<int>(Layout::SIZE));
+
+// The bins of a patch must fit to the mask of a sparse histogram, and the
+// counts to 16-bit indexes.
+Q_STATIC_ASSERT(Layout::BINS <= 64);
+Q_STATIC_ASSERT(Layout::SIZE <= 65535);
+
+static const DescriptorR1P8 DESCRIPTOR_R1P8;
+static const DescriptorR2P8 DESCRIPTOR_R2P8;
+static const Layout LAYOUT;
+
+// Largest count of the smallest value of a histogram that is tried when
+// looking for the exact scale of the histogram (see quantizeHistogram()).
+const int MAX_SMALLEST_COUNT = 8;
+
+/**
+ * @brief Convert the values of a histogram to counts of the given scale.
+ *
+ * @param exact     If true, conversion fails if some value is not exactly a
+ *                  count of the scale. Otherwise values are rounded.
+ * @return bool     False, if the conversion failed.
+ */
+static bool quantize(const float *histogram, const float scale, const bool exact, quint16 *result)
+{
+    const double maxCount = std::numeric_limits<quint16>::max();
+
+    for (int i = 0; i < Layout::SIZE; i++)
+    {
+        const double count = std::floor(histogram[i] / static_cast<double>(scale) + 0.5);
+        if (exact && count > maxCount)
+        {
+            return false;
+        }
+
+        result[i] = static_cast<quint16>(std::min(count, maxCount));
+
+        // Same operation as in the normalization of the histogram.
+        if (exact && static_cast<float>(result[i]) * scale != histogram[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static float quantizedDistance(const cv::Mat &quantizedHistogram1, const cv::Mat &quantizedHistogram2, const bool useWeights, const float bound,
+                               int *patchesEvaluated)
+{
+    const bool isSparse1 = Layout::isValidSparse(quantizedHistogram1);
+    const bool isSparse2 = Layout::isValidSparse(quantizedHistogram2);
+
+    if ((!isSparse1 && !Layout::isValidQuantized(quantizedHistogram1)) ||
+        (!isSparse2 && !Layout::isValidQuantized(quantizedHistogram2)))
+    {
+        if (patchesEvaluated)
+        {
+            *patchesEvaluated = 0;
+        }
+
+        return std::numeric_limits<float>::max();
+    }
+
+    const float scale = Layout::scale(quantizedHistogram1);
+    if (scale != Layout::scale(quantizedHistogram2))
+    {
+        // The histograms are of images of different size. The counts can't be
+        // compared directly.
+        const cv::Mat histogram1 = LBPImage::dequantizeHistogram(quantizedHistogram1);
+        const cv::Mat histogram2 = LBPImage::dequantizeHistogram(quantizedHistogram2);
+
+        return LAYOUT.boundedDenseDistance(histogram1.ptr<float>(0), histogram2.ptr<float>(0), 1.0f, useWeights, bound, patchesEvaluated);
+    }
+
+    const quint16 *h1 = quantizedHistogram1.ptr<quint16>(0);
+    const quint16 *h2 = quantizedHistogram2.ptr<quint16>(0);
+
+    if (isSparse1 && isSparse2)
+    {
+        return LAYOUT.boundedDistance(Layout::SparsePair(h1, h2, scale), useWeights, bound, patchesEvaluated);
+    }
+
+    // Chi square distance is symmetric, so the sparse histogram can be given
+    // first.
+    if (isSparse1 || isSparse2)
+    {
+        return LAYOUT.boundedDistance(isSparse1 ? Layout::SparseDensePair(h1, h2, scale) : Layout::SparseDensePair(h2, h1, scale),
+                                      useWeights, bound, patchesEvaluated);
+    }
+
+    return LAYOUT.boundedDenseDistance(h1, h2, scale, useWeights, bound, patchesEvaluated);
+}
 
-LBPImage::LBPImage()
+LBPImage::LBPImage() :
+    lbpDescriptor(DEFAULT_LBP_DESCRIPTOR)
 {
 }
 
-LBPImage::LBPImage(const cv::Mat &img)
+LBPImage::LBPImage(const cv::Mat &img) :
+    lbpDescriptor(DEFAULT_LBP_DESCRIPTOR)
 {
     create(img);
 }
 
+LBPImage::LBPImage(const cv::Mat &img, const int descriptor) :
+    lbpDescriptor(descriptor)
+{
+    create(img, descriptor);
+}
+
+LBPImage::LBPImage(const cv::Mat &img, const int descriptor, const bool keepImage) :
+    lbpDescriptor(descriptor)
+{
+    create(img, descriptor, keepImage);
+}
+
 void LBPImage::create(const cv::Mat &img)
+{
+    create(img, DEFAULT_LBP_DESCRIPTOR, false);
+}
+
+void LBPImage::create(const cv::Mat &img, const int descriptor)
+{
+    create(img, descriptor, false);
+}
+
+void LBPImage::create(const cv::Mat &img, const int descriptor, const bool keepImage)
 {
     if (img.empty() || img.type() != CV_8UC1)
     {
         return;
     }
 
-    lbpImage = calcExtendedLBP(img, EXTENDED_LBP_RADIUS, EXTENDED_LBP_SAMPLING_POINTS);
-    lbpHistogram = calcSpatialHistogram(lbpImage);
+    sourceImage = img;
+    lbpDescriptor = descriptor;
+    lbpImage = cv::Mat();
+
+    // Unless the image is kept, the histogram is calculated without it.
+    switch (descriptor)
+    {
+    case LBP_DESCRIPTOR_R1P8:
+        if (!DescriptorR1P8::isApplicable(img))
+        {
+            lbpHistogram = cv::Mat();
+        }
+        else
+        {
+            lbpHistogram = keepImage ? DESCRIPTOR_R1P8.histogram(img, lbpImage) : DESCRIPTOR_R1P8.histogram(img);
+        }
+        break;
+    default:
+        if (!DescriptorR2P8::isApplicable(img))
+        {
+            lbpHistogram = cv::Mat();
+        }
+        else
+        {
+            lbpHistogram = keepImage ? DESCRIPTOR_R2P8.histogram(img, lbpImage) : DESCRIPTOR_R2P8.histogram(img);
+        }
+        break;
+    }
+}
+
+const cv::Mat& LBPImage::image() const
+{
+    if (lbpImage.empty() && !sourceImage.empty())
+    {
+        lbpImage = calcExtendedLBP(sourceImage, lbpDescriptor);
+    }
+
+    return lbpImage;
 }
 
 float LBPImage::distance(const cv::Mat &lbpHistogram1, const cv::Mat &lbpHistogram2)
 {
-    if (lbpHistogram1.cols != 2301 || lbpHistogram2.cols != 2301 ||
-        lbpHistogram1.rows != 1 || lbpHistogram2.rows != 1)
+    if (!Layout::isValid(lbpHistogram1) || !Layout::isValid(lbpHistogram2))
+    {
+        return std::numeric_limits<float>::max();
+    }
+
+    return LAYOUT.denseDistance(lbpHistogram1.ptr<float>(0), lbpHistogram2.ptr<float>(0), 1.0f);
+}
+
+float LBPImage::weightedDistance(const cv::Mat &weightedHistogram1, const cv::Mat &weightedHistogram2)
+{
+    if (!Layout::isValid(weightedHistogram1) || !Layout::isValid(weightedHistogram2))
     {
         return std::numeric_limits<float>::max();
     }
 
-    float distance = 0.0;
-    int index = 0;
-    for (int i = 0; i < LBP_NUM_PATCHES; i++)
+    return chiSquare(weightedHistogram1.ptr<float>(0), weightedHistogram2.ptr<float>(0), Layout::SIZE);
+}
+
+float LBPImage::distance(const cv::Mat &lbpHistogram1, const cv::Mat &lbpHistogram2, const float bound, int *patchesEvaluated)
+{
+    if (!Layout::isValid(lbpHistogram1) || !Layout::isValid(lbpHistogram2))
     {
-        const float weight = static_cast<float>(WEIGHT_MAP[i]);
-        for (int j = 0; j < LBP_NUM_PATTERNS; j++)
+        if (patchesEvaluated)
         {
-            const float v1 = lbpHistogram1.at<float>(index);
-            const float v2 = lbpHistogram2.at<float>(index);
-            const float sum = v1 + v2;
-            if (sum > 0.0)
-            {
-                float diff = v1 - v2;
-                distance += weight * (diff * diff) / sum;
-            }
+            *patchesEvaluated = 0;
+        }
+
+        return std::numeric_limits<float>::max();
+    }
+
+    return LAYOUT.boundedDenseDistance(lbpHistogram1.ptr<float>(0), lbpHistogram2.ptr<float>(0), 1.0f, true, bound, patchesEvaluated);
+}
 
-            index++;
+float LBPImage::weightedDistance(const cv::Mat &weightedHistogram1, const cv::Mat &weightedHistogram2, const float bound, int *patchesEvaluated)
+{
+    if (!Layout::isValid(weightedHistogram1) || !Layout::isValid(weightedHistogram2))
+    {
+        if (patchesEvaluated)
+        {
+            *patchesEvaluated = 0;
         }
+
+        return std::numeric_limits<float>::max();
     }
 
-    return distance;
+    return LAYOUT.boundedDenseDistance(weightedHistogram1.ptr<float>(0), weightedHistogram2.ptr<float>(0), 1.0f, false, bound, patchesEvaluated);
+}
+
+int LBPImage::patchCount()
+{
+    return Layout::PATCH_COUNT;
+}
+
+int LBPImage::histogramSize()
+{
+    return Layout::SIZE;
+}
+
+bool LBPImage::coarseHistogram(const cv::Mat &lbpHistogram, float *result)
+{
+    if (!Layout::isValid(lbpHistogram))
+    {
+        return false;
+    }
+
+    LAYOUT.coarsen(lbpHistogram.ptr<float>(0), result);
+
+    return true;
+}
+
+int LBPImage::coarseHistogramSize()
+{
+    return Layout::COARSE_SIZE;
+}
+
+float LBPImage::coarseDistance(const float *coarseHistogram1, const float *coarseHistogram2)
+{
+    return chiSquare(coarseHistogram1, coarseHistogram2, Layout::COARSE_SIZE);
+}
+
+bool LBPImage::calcHistogram(const cv::Mat &img, const int descriptor, LBPScratch &scratch, float *result)
+{
+    if (img.empty() || img.type() != CV_8UC1)
+    {
+        return false;
+    }
+
+    switch (descriptor)
+    {
+    case LBP_DESCRIPTOR_R1P8:
+        if (!DescriptorR1P8::isApplicable(img))
+        {
+            return false;
+        }
+
+        DESCRIPTOR_R1P8.histogram(img, scratch, result);
+        return true;
+    default:
+        if (!DescriptorR2P8::isApplicable(img))
+        {
+            return false;
+        }
+
+        DESCRIPTOR_R2P8.histogram(img, scratch, result);
+        return true;
+    }
+}
+
+cv::Mat LBPImage::weightHistogram(const cv::Mat &lbpHistogram)
+{
+    if (!Layout::isValid(lbpHistogram))
+    {
+        return lbpHistogram;
+    }
+
+    cv::Mat result = lbpHistogram.clone();
+    LAYOUT.multiply(result.ptr<float>(0));
+
+    return result;
+}
+
+cv::Mat LBPImage::unweightHistogram(const cv::Mat &weightedHistogram)
+{
+    if (!Layout::isValid(weightedHistogram))
+    {
+        return weightedHistogram;
+    }
+
+    cv::Mat result = weightedHistogram.clone();
+    LAYOUT.divide(result.ptr<float>(0));
+
+    return result;
+}
+
+bool LBPImage::embedHistogram(const cv::Mat &lbpHistogram, float *result)
+{
+    if (!Layout::isValid(lbpHistogram))
+    {
+        return false;
+    }
+
+    std::memcpy(result, lbpHistogram.ptr<float>(0), Layout::SIZE * sizeof(float));
+    LAYOUT.multiply(result);
+
+    for (int i = 0; i < Layout::SIZE; i++)
+    {
+        result[i] = std::sqrt(result[i]);
+    }
+
+    return true;
+}
+
+cv::Mat LBPImage::quantizeHistogram(const cv::Mat &histogram)
+{
+    if (!Layout::isValid(histogram))
+    {
+        return cv::Mat();
+    }
+
+    const float *h = histogram.ptr<float>(0);
+
+    float smallest = std::numeric_limits<float>::max();
+    float biggest = 0.0f;
+    for (int i = 0; i < Layout::SIZE; i++)
+    {
+        if (h[i] > 0.0f)
+        {
+            smallest = std::min(smallest, h[i]);
+            biggest = std::max(biggest, h[i]);
+        }
+    }
+
+    cv::Mat result = cv::Mat::zeros(1, Layout::QUANTIZED_SIZE, CV_16UC1);
+    quint16 *q = result.ptr<quint16>(0);
+
+    // The values are counts divided by the number of pixels. If the smallest
+    // value is a count of k, the number of pixels is k / smallest.
+    float scale = 0.0f;
+    for (int k = 1; k <= MAX_SMALLEST_COUNT && biggest > 0.0f; k++)
+    {
+        const double pixels = std::floor(k / static_cast<double>(smallest) + 0.5);
+        const float candidate = static_cast<float>(1.0 / pixels);
+
+        if (quantize(h, candidate, true, q))
+        {
+            scale = candidate;
+            break;
+        }
+    }
+
+    if (scale == 0.0f && biggest > 0.0f)
+    {
+        // Not counts of an LBP image. The values are rounded to 16 bits of the
+        // biggest value.
+        scale = biggest / std::numeric_limits<quint16>::max();
+        quantize(h, scale, false, q);
+    }
+
+    std::memcpy(q + Layout::SIZE, &scale, sizeof(scale));
+
+    return result;
+}
+
+cv::Mat LBPImage::dequantizeHistogram(const cv::Mat &quantizedHistogram)
+{
+    cv::Mat denseHistogram = quantizedHistogram;
+    if (Layout::isConsistentSparse(quantizedHistogram))
+    {
+        denseHistogram = cv::Mat(1, Layout::QUANTIZED_SIZE, CV_16UC1);
+        Layout::dense(quantizedHistogram.ptr<quint16>(0), denseHistogram.ptr<quint16>(0));
+    }
+    else if (!Layout::isValidQuantized(quantizedHistogram))
+    {
+        return cv::Mat();
+    }
+
+    const float scale = Layout::scale(denseHistogram);
+    const quint16 *q = denseHistogram.ptr<quint16>(0);
+
+    cv::Mat result(1, Layout::SIZE, CV_32FC1);
+    float *h = result.ptr<float>(0);
+
+    for (int i = 0; i < Layout::SIZE; i++)
+    {
+        h[i] = static_cast<float>(q[i]) * scale;
+    }
+
+    return result;
+}
+
+cv::Mat LBPImage::sparseHistogram(const cv::Mat &quantizedHistogram)
+{
+    if (!Layout::isValidQuantized(quantizedHistogram))
+    {
+        return quantizedHistogram;
+    }
+
+    const quint16 *q = quantizedHistogram.ptr<quint16>(0);
+
+    int nonZeroCount = 0;
+    for (int i = 0; i < Layout::SIZE; i++)
+    {
+        nonZeroCount += q[i] != 0 ? 1 : 0;
+    }
+
+    // The sparse form must be smaller than the dense one, because the forms
+    // are told apart by their size.
+    if (nonZeroCount > SPARSE_HISTOGRAM_MAX_DENSITY * Layout::SIZE ||
+        Layout::SPARSE_OVERHEAD + nonZeroCount >= Layout::QUANTIZED_SIZE)
+    {
+        return quantizedHistogram;
+    }
+
+    return Layout::sparse(q, nonZeroCount);
+}
+
+cv::Mat LBPImage::toGalleryHistogram(const cv::Mat &lbpHistogram)
+{
+    const cv::Mat histogram = STORE_WEIGHTED_HISTOGRAMS ? weightHistogram(lbpHistogram) : lbpHistogram;
+
+    if (!STORE_QUANTIZED_HISTOGRAMS)
+    {
+        return histogram;
+    }
+
+    const cv::Mat quantizedHistogram = quantizeHistogram(histogram);
+
+    return STORE_SPARSE_HISTOGRAMS ? sparseHistogram(quantizedHistogram) : quantizedHistogram;
+}
+
+cv::Mat LBPImage::fromGalleryHistogram(const cv::Mat &galleryHistogram)
+{
+    const cv::Mat histogram = galleryHistogram.type() == CV_16UC1 ? dequantizeHistogram(galleryHistogram) : galleryHistogram;
+
+    return STORE_WEIGHTED_HISTOGRAMS ? unweightHistogram(histogram) : histogram;
+}
+
+cv::Mat LBPImage::denseGalleryHistogram(const cv::Mat &galleryHistogram)
+{
+    if (!Layout::isConsistentSparse(galleryHistogram))
+    {
+        return galleryHistogram;
+    }
+
+    cv::Mat result(1, Layout::QUANTIZED_SIZE, CV_16UC1);
+    Layout::dense(galleryHistogram.ptr<quint16>(0), result.ptr<quint16>(0));
+
+    return result;
+}
+
+int LBPImage::denseGalleryHistogramSize()
+{
+    return STORE_QUANTIZED_HISTOGRAMS ? Layout::QUANTIZED_SIZE : Layout::SIZE;
+}
+
+float LBPImage::galleryDistance(const cv::Mat &galleryHistogram1, const cv::Mat &galleryHistogram2)
+{
+    if (STORE_QUANTIZED_HISTOGRAMS)
+    {
+        return quantizedDistance(galleryHistogram1, galleryHistogram2, !STORE_WEIGHTED_HISTOGRAMS, std::numeric_limits<float>::max(), 0);
+    }
+
+    return STORE_WEIGHTED_HISTOGRAMS ? weightedDistance(galleryHistogram1, galleryHistogram2) :
+                                       distance(galleryHistogram1, galleryHistogram2);
+}
+
+float LBPImage::galleryDistance(const cv::Mat &galleryHistogram1, const cv::Mat &galleryHistogram2, const float bound, int *patchesEvaluated)
+{
+    if (STORE_QUANTIZED_HISTOGRAMS)
+    {
+        return quantizedDistance(galleryHistogram1, galleryHistogram2, !STORE_WEIGHTED_HISTOGRAMS, bound, patchesEvaluated);
+    }
+
+    return STORE_WEIGHTED_HISTOGRAMS ? weightedDistance(galleryHistogram1, galleryHistogram2, bound, patchesEvaluated) :
+                                       distance(galleryHistogram1, galleryHistogram2, bound, patchesEvaluated);
+}
+
+cv::Mat LBPImage::calcExtendedLBP(const cv::Mat &img, const int descriptor)
+{
+    switch (descriptor)
+    {
+    case LBP_DESCRIPTOR_R1P8:
+        return DescriptorR1P8::isApplicable(img) ? DESCRIPTOR_R1P8.image(img) : cv::Mat();
+    default:
+        return DescriptorR2P8::isApplicable(img) ? DESCRIPTOR_R2P8.image(img) : cv::Mat();
+    }
 }
 
-cv::Mat LBPImage::calcExtendedLBP(const cv::Mat &img, const int radius, const int samplingPoints)
+cv::Mat LBPImage::calcExtendedLBPReference(const cv::Mat &img, const int radius, const int samplingPoints)
 {
     cv::Mat result = cv::Mat::zeros(img.rows - 2 * radius, img.cols - 2 * radius, CV_8UC1);
 
@@ -156,39 +1402,6 @@ cv::Mat LBPImage::calcExtendedLBP(const cv::Mat &img, const int radius, const in
 
 cv::Mat LBPImage::calcSpatialHistogram(const cv::Mat &img)
 {
-    cv::Mat result = cv::Mat::zeros(1, LBP_NUM_PATCHES * LBP_NUM_PATTERNS, CV_32FC1);
-
-    const int width = img.cols / LBP_GRID_X;
-    const int height = img.rows / LBP_GRID_Y;
-
-    int patchIndex = 0;
-    for (int i = 0; i < LBP_GRID_Y; i++)
-    {
-        for(int j = 0; j < LBP_GRID_X; j++)
-        {
-            if (((j == 0 || j == 6) && (i == 3 || i == 4 || i == 5 || i == 6)) ||
-                ((j == 3 && (i == 2 || i == 3))))
-            {
-                continue;
-            }
-
-            const cv::Mat patch = cv::Mat(img, cv::Range(i * height, (i + 1) * height), cv::Range(j * width, (j + 1) * width));
-            const int histogramIndex = patchIndex * LBP_NUM_PATTERNS;
-
-            for (int px = 0; px < patch.cols; px++)
-            {
-                for (int py = 0; py < patch.rows; py++)
-                {
-                    result.at<float>(histogramIndex + UNIFORM_PATTERN[patch.at<uchar>(py, px)])++;
-                }
-            }
-
-            patchIndex++;
-        }
-    }
-
-    // Normalize.
-    result /= static_cast<float>(img.total());
-
-    return result;
+    // The layout of the histogram is the same for all descriptors.
+    return DESCRIPTOR_R2P8.spatialHistogram(img);
 }
@@ -34,15 +34,39 @@
 
 #include "opencv2/opencv.hpp"
 
+class LBPScratch;
+
 class LBPImage
 {
 public:
     LBPImage();
     LBPImage(const cv::Mat &img);
+    LBPImage(const cv::Mat &img, const int descriptor);
+    LBPImage(const cv::Mat &img, const int descriptor, const bool keepImage);
 
+    /**
+     * @brief Calculate the histogram of the image.
+     *
+     * @param img           A grayscale and 8-bit image.
+     * @param descriptor    LBP_DESCRIPTOR_R1P8 or LBP_DESCRIPTOR_R2P8. If not
+     *                      given, DEFAULT_LBP_DESCRIPTOR is used.
+     * @param keepImage     If true, the LBP image is kept from the pass that
+     *                      calculates the histogram. Use this when image() is
+     *                      always called.
+     */
     void create(const cv::Mat &img);
+    void create(const cv::Mat &img, const int descriptor);
+    void create(const cv::Mat &img, const int descriptor, const bool keepImage);
 
-    const cv::Mat& image() const        { return lbpImage; }
+    /**
+     * @brief Return the LBP image.
+     *
+     * Unless the image was kept by create(), the histogram is calculated
+     * without the LBP image, so the image is calculated on the first call.
+     * The source image given to create() is referenced, not copied, so it
+     * must not be modified before that.
+     */
+    const cv::Mat& image() const;
     const cv::Mat& histogram() const    { return lbpHistogram; }
 
     /**
@@ -63,12 +87,216 @@ public:
      *      29  30  31  32  33
      *      34  35  36  37  38
      *
+     * NOTE: SSE2 or AVX instructions are used when the processor supports
+     * them and OpenCV optimizations are enabled (see cv::setUseOptimized()).
+     *
      * @param lbpHistogram1     A uniform spatial histogram to compare.
      * @param lbpHistogram2     A uniform spatial histogram to compare.
      * @return float    A weighted Chi square distance between given histograms.
      */
     static float distance(const cv::Mat &lbpHistogram1, const cv::Mat &lbpHistogram2);
 
+    /**
+     * @brief Compare two histograms which are already multiplied by the weights.
+     *
+     * Weighted Chi square distance is the same as the plain Chi square
+     * distance of histograms whose patches are multiplied by the weights:
+     *
+     *    w * (a - b)^2 / (a + b) = (w * a - w * b)^2 / (w * a + w * b)
+     *
+     * This saves the multiplication in the inner loop.
+     *
+     * @param weightedHistogram1    A histogram returned by weightHistogram().
+     * @param weightedHistogram2    A histogram returned by weightHistogram().
+     * @return float    A weighted Chi square distance between given histograms.
+     */
+    static float weightedDistance(const cv::Mat &weightedHistogram1, const cv::Mat &weightedHistogram2);
+
+    /**
+     * @brief Compare two histograms, giving up when the distance exceeds the bound.
+     *
+     * Patches are compared in the order of their weight: first patches 8, 9,
+     * 11 and 12, then patches 0, 6, 7, 13 and 31 and then the rest. After
+     * each patch the partial distance is compared to the bound, and if it is
+     * bigger, the comparison is stopped. Because the terms of the sum are
+     * never negative, the full distance would be bigger too.
+     *
+     * @param lbpHistogram1     A uniform spatial histogram to compare.
+     * @param lbpHistogram2     A uniform spatial histogram to compare.
+     * @param bound             The distance of interest.
+     * @param patchesEvaluated  If not null, number of patches compared is
+     *                          written here.
+     * @return float    The weighted Chi square distance, if it is not bigger
+     *                  than the bound. Otherwise some value bigger than the
+     *                  bound.
+     */
+    static float distance(const cv::Mat &lbpHistogram1, const cv::Mat &lbpHistogram2, const float bound, int *patchesEvaluated=0);
+    static float weightedDistance(const cv::Mat &weightedHistogram1, const cv::Mat &weightedHistogram2, const float bound, int *patchesEvaluated=0);
+
+    static int patchCount();
+    static int histogramSize();
+
+    /**
+     * @brief Calculate the coarse histogram of a histogram.
+     *
+     * The coarse histogram has a 3x3 grid of cells. Each patch of the 7x7
+     * grid is added, multiplied by its weight, to the cell that covers most of
+     * the patch (see FaceGrid::coarseCell()). A cell is thus a weighted sum of
+     * patch histograms, not a histogram of the codes under the cell, and it
+     * is not recomputed from the codes. With 59 bins per cell it has 531
+     * bins.
+     *
+     * The Chi square term (a - b)^2 / (a + b) is convex and grows linearly
+     * with a and b, so the term of a sum is at most the sum of the terms. The
+     * distance of coarse histograms (see coarseDistance()) is therefore at
+     * most the weighted Chi square distance of the histograms, and can be
+     * used to discard candidates cheaply (see CascadeSearch).
+     *
+     * @param lbpHistogram  A uniform spatial histogram.
+     * @param result        coarseHistogramSize() floats.
+     * @return bool         False, if the histogram is not valid. Then the
+     *                      result is not written.
+     */
+    static bool coarseHistogram(const cv::Mat &lbpHistogram, float *result);
+    static int coarseHistogramSize();
+    static float coarseDistance(const float *coarseHistogram1, const float *coarseHistogram2);
+
+    /**
+     * @brief Calculate the histogram of the image to the given buffer.
+     *
+     * This is the same histogram as create() gives, but the buffers of the
+     * calculation are reused (see BatchExtractor).
+     *
+     * @param img           A grayscale and 8-bit image.
+     * @param descriptor    LBP_DESCRIPTOR_R1P8 or LBP_DESCRIPTOR_R2P8.
+     * @param scratch       Buffers of the calculation.
+     * @param result        histogramSize() floats.
+     * @return bool         False, if the image is not grayscale and 8-bit or
+     *                      is too small. Then the result is not written.
+     */
+    static bool calcHistogram(const cv::Mat &img, const int descriptor, LBPScratch &scratch, float *result);
+
+    /**
+     * @brief Multiply each patch of the histogram by its weight.
+     *
+     * The weights are powers of two, so the result can be converted back to
+     * the original histogram without loss of precision.
+     *
+     * @param lbpHistogram  A uniform spatial histogram.
+     * @return cv::Mat      A new weighted histogram.
+     */
+    static cv::Mat weightHistogram(const cv::Mat &lbpHistogram);
+    static cv::Mat unweightHistogram(const cv::Mat &weightedHistogram);
+
+    /**
+     * @brief Calculate the Hellinger embedding of a histogram.
+     *
+     * The embedding is the square root of the weighted histogram. The squared
+     * Euclidean distance of the embeddings of two histograms is
+     *
+     *    sum w * (sqrt(a) - sqrt(b))^2
+     *
+     * and because (a - b)^2 / (a + b) = (sqrt(a) - sqrt(b))^2 * (sqrt(a) +
+     * sqrt(b))^2 / (a + b), where the last factor is between 1 and 2, the
+     * weighted Chi square distance is between one and two times it. The
+     * squared distance is |e1|^2 + |e2|^2 - 2 * e1 . e2, so the histograms
+     * can be compared in bulk with a matrix product (see EmbeddedSearch).
+     *
+     * @param lbpHistogram  A uniform spatial histogram.
+     * @param result        histogramSize() floats.
+     * @return bool         False, if the histogram is not valid. Then the
+     *                      result is not written.
+     */
+    static bool embedHistogram(const cv::Mat &lbpHistogram, float *result);
+
+    /**
+     * @brief Convert a histogram to 16-bit counts.
+     *
+     * The values of a histogram are pixel counts divided by the number of
+     * pixels of the LBP image. The counts are stored as 16-bit integers,
+     * followed by the scale (1 / pixels) as a float in two 16-bit values. The
+     * histogram takes half of the memory of the float histogram, and the
+     * distance is calculated from the counts.
+     *
+     * The conversion is exact for the histograms of create() and their
+     * weighted form. Other histograms are rounded to 16 bits of their biggest
+     * value.
+     *
+     * @param histogram     A CV_32FC1 histogram (weighted or not).
+     * @return cv::Mat      The quantized histogram in 1x2303 CV_16UC1 matrix.
+     */
+    static cv::Mat quantizeHistogram(const cv::Mat &histogram);
+
+    /**
+     * @brief Convert a quantized histogram (dense or sparse) back to floats.
+     *
+     * @return cv::Mat      The histogram in 1x2301 matrix, or an empty matrix
+     *                      if the histogram is not valid.
+     */
+    static cv::Mat dequantizeHistogram(const cv::Mat &quantizedHistogram);
+
+    /**
+     * @brief Convert a quantized histogram to the sparse form, if it has few
+     * non-zero bins.
+     *
+     * The sparse form has a 64-bit mask of the non-zero bins of each patch,
+     * the index of the first count of each patch and the non-zero counts. It
+     * takes 394 bytes plus 2 bytes per non-zero bin, instead of 4606 bytes.
+     * The histogram is converted only if at most SPARSE_HISTOGRAM_MAX_DENSITY
+     * of its bins are non-zero. The forms are told apart by their size: the
+     * sparse form is always smaller than the dense one.
+     *
+     * @param quantizedHistogram    A histogram returned by quantizeHistogram().
+     * @return cv::Mat              The sparse histogram, or the given histogram.
+     */
+    static cv::Mat sparseHistogram(const cv::Mat &quantizedHistogram);
+
+    /**
+     * @brief Convert a histogram to the form stored in the database.
+     *
+     * If STORE_WEIGHTED_HISTOGRAMS is true, the database holds weighted
+     * histograms. If STORE_QUANTIZED_HISTOGRAMS is true, the histograms are
+     * quantized (see quantizeHistogram()), and if STORE_SPARSE_HISTOGRAMS is
+     * true too, the histograms with few non-zero bins are sparse (see
+     * sparseHistogram()). Otherwise the histogram is returned as it is.
+     */
+    static cv::Mat toGalleryHistogram(const cv::Mat &lbpHistogram);
+    static cv::Mat fromGalleryHistogram(const cv::Mat &galleryHistogram);
+
+    /**
+     * @brief Convert a gallery histogram to the dense form, which has the
+     * same size for all histograms.
+     *
+     * @return cv::Mat      The dense histogram, or the given histogram if it
+     *                      is not sparse.
+     */
+    static cv::Mat denseGalleryHistogram(const cv::Mat &galleryHistogram);
+
+    /**
+     * @brief Return the number of values of the dense gallery histogram.
+     */
+    static int denseGalleryHistogramSize();
+
+    /**
+     * @brief Compare two histograms in the form stored in the database.
+     *
+     * For quantized histograms the Chi square terms are calculated from the
+     * counts and multiplied by the scale. The distance differs from the
+     * distance of the float histograms only by rounding. With sparse
+     * histograms only the non-zero bins of the sparse histogram (both
+     * histograms, if both are sparse) are visited.
+     */
+    static float galleryDistance(const cv::Mat &galleryHistogram1, const cv::Mat &galleryHistogram2);
+    static float galleryDistance(const cv::Mat &galleryHistogram1, const cv::Mat &galleryHistogram2, const float bound, int *patchesEvaluated=0);
+
+    /**
+     * @brief Calculate LBP image with the straightforward implementation.
+     *
+     * The descriptors of LBPDescriptor.h must give bit-identical codes to
+     * this one. This is kept for checking that, and for other parameters.
+     */
+    static cv::Mat calcExtendedLBPReference(const cv::Mat &img, const int radius, const int samplingPoints);
+
 private:
     /**
      * @brief Calculate LBP image from the given source image.
@@ -76,12 +304,14 @@ private:
      * NOTE: This function uses so called extended LBP, which uses neighborhood of
      * the given size.
      *
-     * @param img               The source image.
-     * @param radius            Radius (in pixels).
-     * @param samplingPoints    Number of sampling points on a circle of radius.
-     * @return cv::Mat          The LBP image.
+     * NOTE: SSE2 instructions are used when the processor supports them and
+     * OpenCV optimizations are enabled.
+     *
+     * @param img           The source image.
+     * @param descriptor    LBP_DESCRIPTOR_R1P8 or LBP_DESCRIPTOR_R2P8.
+     * @return cv::Mat      The LBP image.
      */
-    cv::Mat calcExtendedLBP(const cv::Mat &img, const int radius, const int samplingPoints);
+    static cv::Mat calcExtendedLBP(const cv::Mat &img, const int descriptor);
 
     /**
      * @brief Create 7x7 uniform spatial histogram.
@@ -124,10 +354,12 @@ private:
      * @param img       A grayscale and 8-bit image.
      * @return cv::Mat  The histogram in 1x2301 matrix.
      */
-    cv::Mat calcSpatialHistogram(const cv::Mat &img);
+    static cv::Mat calcSpatialHistogram(const cv::Mat &img);
 
 private:
-    cv::Mat lbpImage;
+    cv::Mat sourceImage;
+    int lbpDescriptor;
+    mutable cv::Mat lbpImage;
     cv::Mat lbpHistogram;
 
 };
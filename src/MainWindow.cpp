@@ -39,12 +39,15 @@
 #include <QVBoxLayout>
 #include <QFileDialog>
 #include <QStringList>
+#include <QFileInfo>
 
 using namespace FaceReco;
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow)
+    ui(new Ui::MainWindow),
+    processing(false),
+    checkpointRunning(false)
 {
     ui->setupUi(this);
 
@@ -66,12 +69,28 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(&processer, SIGNAL(newTrackDetected()), this, SLOT(clearPersonStatus()));
     connect(&processer, SIGNAL(personNotFound()), this, SLOT(clearPersonStatus()));
     connect(&processer, SIGNAL(searchStatisticsChanged(quint32,quint32,quint32)), this, SLOT(updateSearchStatistics(quint32,quint32,quint32)));
+    connect(&processer, SIGNAL(searchDetailsChanged(SearchStatistics)), this, SLOT(updateSearchDetails(SearchStatistics)));
     connect(&processer, SIGNAL(processingStarted()), this, SLOT(disableDatabaseGroup()));
     connect(&processer, SIGNAL(processingStarted()), this, SLOT(setPauseButton()));
     connect(&processer, SIGNAL(processingStopped()), this, SLOT(enableDatabaseGroup()));
     connect(&processer, SIGNAL(processingStopped()), this, SLOT(setPlayButton()));
     processerThread.start();
 
+    // Setup worker object and thread for journal maintenance.
+    journalMaintainer.moveToThread(&journalMaintainerThread);
+    journalMaintainer.setDatabase(&db);
+    connect(&journalMaintainerThread, SIGNAL(finished()), &journalMaintainer, SLOT(handleStop()));
+    journalMaintainerThread.start();
+    journalMaintainer.start();
+
+    // Setup worker object and thread for saving the database. The database
+    // can be saved while processing.
+    checkpointer.moveToThread(&checkpointerThread);
+    checkpointer.setDatabase(&db);
+    connect(&checkpointer, SIGNAL(checkpointProgress(int)), this, SLOT(updateCheckpointProgress(int)));
+    connect(&checkpointer, SIGNAL(checkpointFinished(bool,quint32)), this, SLOT(finishCheckpoint(bool,quint32)));
+    checkpointerThread.start();
+
     // Setup windows.
 
     QVBoxLayout *layout1 = new QVBoxLayout();
@@ -104,9 +123,11 @@ MainWindow::MainWindow(QWidget *parent) :
 
     ui->personNew->setVisible(false);
     ui->databasePersonCount->setText(QString::number(db.personCount()));
+    ui->descriptorComboBox->setCurrentIndex(db.descriptor());
     ui->databaseTrackCount->setText(QString::number(db.trackCount()));
     ui->databaseHistogramCount->setText(QString::number(db.histogramCount()));
     updateSize(db.size(), ui->databaseSize);
+    ui->databaseSize->setToolTip(QString::number(db.bytesPerHistogram(), 'f', 0) + " bytes per histogram");
 
     if (sourceFilename.isEmpty())
     {
@@ -128,6 +149,10 @@ MainWindow::~MainWindow()
     processer.quitWorkerThreads();
     processerThread.quit();
     processerThread.wait();
+    checkpointerThread.quit();
+    checkpointerThread.wait();
+    journalMaintainerThread.quit();
+    journalMaintainerThread.wait();
     delete ui;
 }
 
@@ -179,6 +204,11 @@ void MainWindow::updateDatabaseStatus()
     ui->databaseAvgHistogramsPerPerson->setText(QString::number(static_cast<float>(histogramCount) / personCount, 'f', 0));
     ui->databaseAvgHistogramsPerTrack->setText(QString::number(static_cast<float>(histogramCount) / trackCount, 'f', 0));
     updateSize(db.size(), ui->databaseSize);
+    ui->databaseSize->setToolTip(QString::number(db.bytesPerHistogram(), 'f', 0) + " bytes per histogram");
+
+    // The descriptor of the database can be changed only while it is empty.
+    ui->descriptorComboBox->setCurrentIndex(db.descriptor());
+    updateDatabaseGroup();
 }
 
 void MainWindow::updateSearchStatistics(const quint32 searchTime, const quint32 histogramsSearched, const quint32 histogramsCompared)
@@ -188,14 +218,38 @@ void MainWindow::updateSearchStatistics(const quint32 searchTime, const quint32
     ui->searchHistogramsCompared->setText(QString::number(histogramsCompared));
 }
 
+void MainWindow::updateSearchDetails(const SearchStatistics &statistics)
+{
+    ui->searchPatchesEvaluated->setText(QString::number(100.0f * statistics.patchesEvaluated, 'f', 1) + " %");
+    ui->searchPatchesEvaluated->setToolTip(QString::number(statistics.comparisonTime, 'f', 2) + " us per comparison, histograms compressed " +
+                                           QString::number(statistics.compression, 'f', 2) + "x, " +
+                                           QString::number(100.0f * statistics.pruningRate, 'f', 1) + " % of histograms pruned");
+}
+
 void MainWindow::disableDatabaseGroup()
 {
-    ui->groupBoxDatabase->setEnabled(false);
+    processing = true;
+    updateDatabaseGroup();
 }
 
 void MainWindow::enableDatabaseGroup()
 {
-    ui->groupBoxDatabase->setEnabled(true);
+    processing = false;
+    updateDatabaseGroup();
+}
+
+void MainWindow::updateCheckpointProgress(const int percent)
+{
+    ui->saveButton->setText("Saving " + QString::number(percent) + " %");
+}
+
+void MainWindow::finishCheckpoint(const bool success, const quint32 durationMs)
+{
+    qDebug() << (success ? "Database saved in" : "Failed to save database in") << durationMs << "ms.";
+
+    checkpointRunning = false;
+    ui->saveButton->setText("Save...");
+    updateDatabaseGroup();
 }
 
 void MainWindow::setPlayButton()
@@ -208,6 +262,20 @@ void MainWindow::setPauseButton()
     ui->processingButton->setText("Pause");
 }
 
+void MainWindow::updateDatabaseGroup()
+{
+    // Saving blocks neither processing nor loading and emptying (see
+    // Database::checkpoint()). Only loading the file being saved waits for
+    // the save.
+    ui->saveButton->setEnabled(!checkpointRunning);
+    ui->loadButton->setEnabled(!processing);
+    ui->emptyButton->setEnabled(!processing);
+    ui->descriptorComboBox->setEnabled(!processing && db.isEmpty());
+    ui->mergeButton->setEnabled(!processing);
+    ui->comboBoxPersonId1->setEnabled(!processing);
+    ui->comboBoxPersonId2->setEnabled(!processing);
+}
+
 void MainWindow::updateSize(const quint64 sizeInBytes, QLabel *sizeLabel)
 {
     Q_ASSERT(sizeLabel);
@@ -274,11 +342,14 @@ void MainWindow::on_saveButton_clicked()
 {
     QString fileName = QFileDialog::getSaveFileName(this, "Save FaceReco database file",
                                                     QCoreApplication::applicationDirPath(),
-                                                    "FaceReco database files (*.fdb)");
+                                                    "FaceReco database files (*.fdb);;FaceReco gallery files (*.fgb)");
 
     if (!fileName.isEmpty())
     {
-        db.save(fileName);
+        checkpointRunning = true;
+        updateDatabaseGroup();
+
+        checkpointer.checkpoint(fileName);
     }
 }
 
@@ -286,11 +357,18 @@ void MainWindow::on_loadButton_clicked()
 {
     QString fileName = QFileDialog::getOpenFileName(this, "Open FaceReco database file",
                                                     QCoreApplication::applicationDirPath(),
-                                                    "FaceReco database files (*.fdb)");
+                                                    "FaceReco database files (*.fdb *.fgb)");
 
     if (!fileName.isEmpty())
     {
-        db.load(fileName);
+        if (QFileInfo(fileName).suffix() == "fgb")
+        {
+            db.loadGallery(fileName);
+        }
+        else
+        {
+            db.load(fileName);
+        }
 
         clearPersonStatus();
         updateDatabaseStatus();
@@ -352,3 +430,9 @@ void MainWindow::on_comboBox_activated(int index)
 {
     processer.setMode(index);
 }
+
+void MainWindow::on_descriptorComboBox_activated(int index)
+{
+    // The items are in the order of the descriptor values.
+    processer.setLBPDescriptor(index);
+}
@@ -34,6 +34,8 @@
 
 #include "FrameProcesser.h"
 #include "Database.h"
+#include "JournalMaintainer.h"
+#include "DatabaseCheckpointer.h"
 #include <QMainWindow>
 #include <QLabel>
 #include <QThread>
@@ -52,6 +54,7 @@ public:
 
 private:
     void updateSize(const quint64 sizeInBytes, QLabel *sizeLabel);
+    void updateDatabaseGroup();
 
 private slots:
     void updateWindows();
@@ -60,8 +63,11 @@ private slots:
     void clearPersonStatus();
     void updateDatabaseStatus();
     void updateSearchStatistics(const quint32 searchTime, const quint32 histogramsSearched, const quint32 histogramsCompared);
+    void updateSearchDetails(const SearchStatistics &statistics);
     void disableDatabaseGroup();
     void enableDatabaseGroup();
+    void updateCheckpointProgress(const int percent);
+    void finishCheckpoint(const bool success, const quint32 durationMs);
     void setPlayButton();
     void setPauseButton();
 
@@ -75,6 +81,7 @@ private slots:
     void on_mergeButton_clicked();
 
     void on_comboBox_activated(int index);
+    void on_descriptorComboBox_activated(int index);
 
 private:
     Ui::MainWindow *ui;
@@ -92,6 +99,17 @@ private:
     // The face database.
     Database db;
 
+    // Worker object and thread for journal flushing and compaction.
+    JournalMaintainer journalMaintainer;
+    QThread journalMaintainerThread;
+
+    // Worker object and thread for saving the database.
+    DatabaseCheckpointer checkpointer;
+    QThread checkpointerThread;
+
+    bool processing;
+    bool checkpointRunning;
+
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ParallelSearch.h"
+#include "LBPImage.h"
+#include <QRunnable>
+#include <QThread>
+#include <QMutexLocker>
+#include <QtGlobal>
+
+using namespace cv;
+
+// Maximum number of histograms in one work unit. Big enough to keep the
+// locking overhead small, small enough to allow stealing from long tracks.
+const quint32 WORK_UNIT_SIZE = 64;
+
+class ParallelSearch::Worker : public QRunnable
+{
+public:
+    Worker(ParallelSearch &search, const int workerId) :
+        search(search),
+        workerId(workerId)
+    {
+    }
+
+    void run()
+    {
+        QElapsedTimer workerTimer;
+        workerTimer.start();
+
+        Result &result = search.results[workerId];
+        result = Result();
+
+        // The best distance of each person. Units of a person may be stolen
+        // by other workers, so the distances are merged in search().
+        QVector<float> &personBest = search.personBests[workerId];
+        personBest.fill(search.bound, search.snapshot->personCount());
+
+        WorkUnit unit;
+        while (search.takeWork(workerId, unit))
+        {
+            if (search.deadline->isOver())
+            {
+                result.completed = false;
+                break;
+            }
+
+            for (quint32 i = unit.firstHistogramId; i < unit.lastHistogramId; i++)
+            {
+                const float bound = personBest.at(unit.personId);
+                const Mat histogram = search.snapshot->getHistogram(unit.personId, unit.trackId, i);
+
+                int patchesEvaluated;
+                const float distance = LBPImage::galleryDistance(histogram, search.histogramToCompare, bound, &patchesEvaluated);
+                result.patchesEvaluated += patchesEvaluated;
+
+                if (distance < bound)
+                {
+                    personBest[unit.personId] = distance;
+
+                    if (distance < result.distance)
+                    {
+                        result.distance = distance;
+                        result.personId = unit.personId;
+                    }
+                }
+            }
+
+            result.histogramsCompared += unit.lastHistogramId - unit.firstHistogramId;
+        }
+
+        result.nsecsElapsed = workerTimer.nsecsElapsed();
+    }
+
+private:
+    ParallelSearch &search;
+    const int workerId;
+
+};
+
+ParallelSearch::ParallelSearch(const int threadCount) :
+    workerCount(threadCount > 0 ? threadCount : QThread::idealThreadCount()),
+    snapshot(0),
+    bound(std::numeric_limits<float>::max()),
+    deadline(0)
+{
+    workerCount = qMax(workerCount, 1);
+
+    pool.setMaxThreadCount(workerCount);
+    queues.reset(new WorkQueue[workerCount]);
+    results.resize(workerCount);
+    personBests.resize(workerCount);
+}
+
+ParallelSearch::~ParallelSearch()
+{
+    pool.waitForDone();
+}
+
+ParallelSearch::Result ParallelSearch::search(const Database::Snapshot &snapshot, const Mat &histogram, const float bound, const SearchDeadline &deadline)
+{
+    this->snapshot = &snapshot;
+    this->histogramToCompare = histogram;
+    this->bound = bound;
+    this->deadline = &deadline;
+
+    distributeWork(snapshot);
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pool.start(new Worker(*this, i));
+    }
+
+    pool.waitForDone();
+
+    // Merge results of the workers.
+    Result result;
+    QVector<float> personBest(snapshot.personCount(), bound);
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        const Result &workerResult = results.at(i);
+        const QVector<float> &workerBest = personBests.at(i);
+
+        for (int personId = 0; personId < workerBest.size(); personId++)
+        {
+            personBest[personId] = qMin(personBest.at(personId), workerBest.at(personId));
+        }
+
+        if (workerResult.distance < result.distance)
+        {
+            result.distance = workerResult.distance;
+            result.personId = workerResult.personId;
+        }
+
+        result.histogramsCompared += workerResult.histogramsCompared;
+        result.patchesEvaluated += workerResult.patchesEvaluated;
+        result.nsecsElapsed += workerResult.nsecsElapsed;
+        result.completed = result.completed && workerResult.completed;
+    }
+
+    for (int personId = 0; personId < personBest.size(); personId++)
+    {
+        if (personBest.at(personId) < bound)
+        {
+            result.personDistances.append(qMakePair(personBest.at(personId), static_cast<quint32>(personId)));
+        }
+    }
+
+    // Units left in queues (if the deadline was over) are dropped.
+    for (int i = 0; i < workerCount; i++)
+    {
+        queues[i].units.clear();
+    }
+
+    this->histogramToCompare = Mat();
+    this->snapshot = 0;
+    this->deadline = 0;
+
+    return result;
+}
+
+void ParallelSearch::distributeWork(const Database::Snapshot &snapshot)
+{
+    const quint32 personCount = snapshot.personCount();
+    for (quint32 personId = 0; personId < personCount; personId++)
+    {
+        WorkQueue &queue = queues[personId % workerCount];
+
+        const quint32 trackCount = snapshot.trackCount(personId);
+        for (quint32 trackId = 0; trackId < trackCount; trackId++)
+        {
+            const quint32 histogramCount = snapshot.histogramCount(personId, trackId);
+            for (quint32 first = 0; first < histogramCount; first += WORK_UNIT_SIZE)
+            {
+                WorkUnit unit;
+                unit.personId = personId;
+                unit.trackId = trackId;
+                unit.firstHistogramId = first;
+                unit.lastHistogramId = qMin(first + WORK_UNIT_SIZE, histogramCount);
+
+                queue.units.append(unit);
+            }
+        }
+    }
+}
+
+bool ParallelSearch::takeWork(const int workerId, WorkUnit &unit)
+{
+    // Take from the front of the own queue.
+    {
+        WorkQueue &queue = queues[workerId];
+        QMutexLocker locker(&queue.mutex);
+
+        if (!queue.units.isEmpty())
+        {
+            unit = queue.units.takeFirst();
+            return true;
+        }
+    }
+
+    // Steal from the back of some other queue.
+    for (int i = 1; i < workerCount; i++)
+    {
+        WorkQueue &queue = queues[(workerId + i) % workerCount];
+        QMutexLocker locker(&queue.mutex);
+
+        if (!queue.units.isEmpty())
+        {
+            unit = queue.units.takeLast();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PARALLELSEARCH_H
+#define PARALLELSEARCH_H
+
+#include "Database.h"
+#include "SearchDeadline.h"
+#include <QThreadPool>
+#include <QMutex>
+#include <QList>
+#include <QPair>
+#include <QVector>
+#include <QScopedArrayPointer>
+#include <limits>
+
+/**
+ * @brief Exhaustive multi-threaded search over the database.
+ *
+ * The database is split into work units, each of which is a range of
+ * histograms of one track. At the start of a search, units of each person are
+ * given to the same worker so that every worker gets an equal number of
+ * persons. A worker that runs out of its own units steals units from other
+ * workers. This way a person with lots of tracks doesn't keep one worker busy
+ * while the others are idle.
+ */
+class ParallelSearch
+{
+public:
+    struct Result
+    {
+        Result() :
+            distance(std::numeric_limits<float>::max()),
+            personId(std::numeric_limits<quint32>::max()),
+            histogramsCompared(0),
+            patchesEvaluated(0),
+            nsecsElapsed(0),
+            completed(true) {}
+
+        float distance;                 /**< The smallest distance below the bound. */
+        quint32 personId;               /**< Person of the smallest distance. */
+        QVector<QPair<float, quint32> > personDistances; /**< The smallest distance below the bound of each person. */
+        quint32 histogramsCompared;
+        quint64 patchesEvaluated;       /**< Patches compared in all comparisons. */
+        quint64 nsecsElapsed;           /**< Time of the workers, summed. */
+        bool completed;                 /**< False, if the deadline was over. */
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param threadCount   Number of worker threads. If zero or negative,
+     *                      one thread per processor core is used.
+     */
+    explicit ParallelSearch(const int threadCount = 0);
+    ~ParallelSearch();
+
+    int threadCount() const     { return workerCount; }
+
+    /**
+     * @brief Compare the given histogram to every histogram in the database.
+     *
+     * Blocks until all histograms are compared or the deadline is over.
+     * Workers check the deadline between work units.
+     *
+     * @param snapshot      Snapshot of the database.
+     * @param histogram     The histogram to search for (in the form returned
+     *                      by LBPImage::toGalleryHistogram()).
+     * @param bound         Distances bigger than this are not of interest.
+     *                      Comparisons are abandoned when either this or the
+     *                      best distance of the person so far is exceeded,
+     *                      so the best distance of every person is found.
+     * @param deadline      The time limit and the stop request of the search.
+     * @return Result       The best match over all workers, and the best
+     *                      distance of each person below the bound.
+     */
+    Result search(const Database::Snapshot &snapshot, const cv::Mat &histogram, const float bound = std::numeric_limits<float>::max(),
+                  const SearchDeadline &deadline = SearchDeadline());
+
+private:
+    struct WorkUnit
+    {
+        quint32 personId;
+        quint32 trackId;
+        quint32 firstHistogramId;
+        quint32 lastHistogramId; // Exclusive.
+    };
+
+    struct WorkQueue
+    {
+        QMutex mutex;
+        QList<WorkUnit> units;
+    };
+
+    class Worker;
+
+    void distributeWork(const Database::Snapshot &snapshot);
+    bool takeWork(const int workerId, WorkUnit &unit);
+
+private:
+    int workerCount;
+
+    QThreadPool pool;
+
+    QScopedArrayPointer<WorkQueue> queues;
+    QVector<Result> results;
+    QVector<QVector<float> > personBests;  // Best distance of each person, by worker.
+
+    // Parameters of the ongoing search.
+    const Database::Snapshot *snapshot;
+    cv::Mat histogramToCompare;
+    float bound;
+    const SearchDeadline *deadline;
+
+};
+
+#endif // PARALLELSEARCH_H
@@ -59,15 +59,28 @@ quint32 Person::addTrack(const QSharedPointer<Track> &track)
     return trackId;
 }
 
-quint32 Person::addHistogram(quint32 trackId, const Mat &histogram)
+bool Person::addHistogram(quint32 trackId, const Mat &histogram)
 {
     Q_ASSERT(trackId < static_cast<quint32>(tracks.size()));
 
     Track& track = *tracks.at(trackId).data();
+    if (!track.addHistogram(histogram))
+    {
+        return false;
+    }
+
     totalHistogramCount++;
     sizeInBytes += histogram.step[0] * histogram.rows;
 
-    return track.addHistogram(histogram);
+    return true;
+}
+
+void Person::attach(HistogramArena &arena, const quint32 personId)
+{
+    for (int i = 0; i < tracks.size(); i++)
+    {
+        tracks.at(i)->attach(arena, personId, i);
+    }
 }
 
 void Person::setFaceImage(const Mat &img)
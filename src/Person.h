@@ -52,7 +52,14 @@ public:
     const Track& getTrack(quint32 trackId) const;
 
     quint32 addTrack(const QSharedPointer<Track> &track);
-    quint32 addHistogram(quint32 trackId, const cv::Mat &histogram);
+    bool addHistogram(quint32 trackId, const cv::Mat &histogram);
+
+    /**
+     * @brief Attach all tracks of the person to the arena.
+     *
+     * @see Track::attach()
+     */
+    void attach(HistogramArena &arena, const quint32 personId);
 
     void setFaceImage(const cv::Mat &img);
     const cv::Mat getFaceImage() const      { return faceImage; }
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PivotSearch.h"
+#include "LBPImage.h"
+#include <QtGlobal>
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+
+// Number of histograms among which the pivots are chosen.
+const int PIVOT_CANDIDATE_COUNT = 1024;
+
+// The distances are rounded, so the bounds are loosened by this much, so that
+// no histogram that would be nearer is skipped.
+const float ROUNDING_SLACK = 1e-4f;
+
+PivotSearch::PivotSearch(const int pivotCount) :
+    pivotCount(qMax(pivotCount, 1)),
+    version(0),
+    isBuilt(false),
+    generation(0)
+{
+}
+
+void PivotSearch::update(const Database::Snapshot &snapshot)
+{
+    if (isBuilt && snapshot.version() == version)
+    {
+        return;
+    }
+
+    // Slots of another arena generation are different histograms.
+    if (!isBuilt || snapshot.arenaGeneration() != generation)
+    {
+        pivots.clear();
+        pivotDistances.clear();
+        computed.clear();
+    }
+
+    version = snapshot.version();
+    isBuilt = true;
+    generation = snapshot.arenaGeneration();
+
+    entries.clear();
+    entries.reserve(snapshot.histogramCount());
+
+    for (quint32 personId = 0; personId < snapshot.personCount(); personId++)
+    {
+        for (quint32 trackId = 0; trackId < snapshot.trackCount(personId); trackId++)
+        {
+            for (quint32 histogramId = 0; histogramId < snapshot.histogramCount(personId, trackId); histogramId++)
+            {
+                Entry entry;
+                entry.personId = personId;
+                entry.trackId = trackId;
+                entry.histogramId = histogramId;
+                entry.slot = snapshot.histogramSlot(personId, trackId, histogramId);
+                entries.append(entry);
+            }
+        }
+    }
+
+    if (pivots.isEmpty())
+    {
+        selectPivots(snapshot);
+
+        if (pivots.isEmpty())
+        {
+            return;
+        }
+    }
+
+    // Only the histograms added since the last update are compared to the
+    // pivots.
+    const int count = pivots.size();
+
+    for (int i = 0; i < entries.size(); i++)
+    {
+        const Entry &entry = entries.at(i);
+
+        if (entry.slot >= static_cast<quint32>(computed.size()))
+        {
+            // Grown geometrically, slots are added one at a time.
+            const int size = qMax(static_cast<int>(entry.slot) + 1, computed.size() * 2);
+            computed.resize(size);
+            pivotDistances.resize(size * count);
+        }
+
+        if (!computed.testBit(entry.slot))
+        {
+            const Mat histogram = snapshot.getHistogram(entry.personId, entry.trackId, entry.histogramId);
+            float *distances = pivotDistances.data() + static_cast<size_t>(entry.slot) * count;
+
+            for (int j = 0; j < count; j++)
+            {
+                distances[j] = std::sqrt(LBPImage::galleryDistance(histogram, pivots.at(j)));
+            }
+
+            computed.setBit(entry.slot);
+        }
+    }
+}
+
+void PivotSearch::selectPivots(const Database::Snapshot &snapshot)
+{
+    if (entries.size() < pivotCount)
+    {
+        return;
+    }
+
+    // Candidates spread evenly over the database.
+    const int step = qMax(entries.size() / PIVOT_CANDIDATE_COUNT, 1);
+
+    QList<Mat> candidates;
+    for (int i = 0; i < entries.size() && candidates.size() < PIVOT_CANDIDATE_COUNT; i += step)
+    {
+        const Entry &entry = entries.at(i);
+        candidates.append(snapshot.getHistogram(entry.personId, entry.trackId, entry.histogramId));
+    }
+
+    // Each next pivot is the candidate farthest from the chosen ones.
+    std::vector<float> nearest(candidates.size(), std::numeric_limits<float>::max());
+    int next = 0;
+
+    while (pivots.size() < pivotCount)
+    {
+        const Mat pivot = candidates.at(next).clone();
+        pivots.append(pivot);
+
+        float farthest = -1.0f;
+        for (int i = 0; i < candidates.size(); i++)
+        {
+            nearest[i] = qMin(nearest[i], LBPImage::galleryDistance(candidates.at(i), pivot));
+
+            if (nearest[i] > farthest)
+            {
+                farthest = nearest[i];
+                next = i;
+            }
+        }
+
+        // The rest of the candidates are copies of the pivots.
+        if (farthest <= 0.0f)
+        {
+            break;
+        }
+    }
+}
+
+void PivotSearch::clear()
+{
+    pivots.clear();
+    pivotDistances.clear();
+    computed.clear();
+    entries.clear();
+    isBuilt = false;
+}
+
+PivotSearch::Result PivotSearch::search(const Database::Snapshot &snapshot, const Mat &histogram, const float bound,
+                                        const SearchDeadline &deadline)
+{
+    Result result;
+
+    if (histogram.empty())
+    {
+        return result;
+    }
+
+    const int count = pivots.size();
+
+    queryDistances.resize(count);
+    for (int j = 0; j < count; j++)
+    {
+        queryDistances[j] = std::sqrt(LBPImage::galleryDistance(histogram, pivots.at(j)));
+    }
+
+    result.histogramsCompared += count;
+    result.patchesEvaluated += static_cast<quint64>(count) * LBPImage::patchCount();
+
+    float best = bound;
+    float limit = std::sqrt(best) + ROUNDING_SLACK;
+
+    for (int i = 0; i < entries.size(); i++)
+    {
+        if (i % SearchDeadline::CHECK_INTERVAL == 0 && deadline.isOver())
+        {
+            result.completed = false;
+            break;
+        }
+
+        const Entry &entry = entries.at(i);
+
+        // The largest lower bound of the pivots.
+        const float *distances = pivotDistances.constData() + static_cast<size_t>(entry.slot) * count;
+        bool isPruned = false;
+
+        for (int j = 0; j < count; j++)
+        {
+            if (std::abs(queryDistances[j] - distances[j]) > limit)
+            {
+                isPruned = true;
+                break;
+            }
+        }
+
+        if (isPruned)
+        {
+            result.histogramsPruned++;
+            continue;
+        }
+
+        int patchesEvaluated;
+        const float distance = LBPImage::galleryDistance(snapshot.getHistogram(entry.personId, entry.trackId, entry.histogramId), histogram,
+                                                         best, &patchesEvaluated);
+        result.histogramsCompared++;
+        result.patchesEvaluated += patchesEvaluated;
+
+        if (distance < best)
+        {
+            best = distance;
+            limit = std::sqrt(best) + ROUNDING_SLACK;
+            result.distance = distance;
+            result.personId = entry.personId;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PIVOTSEARCH_H
+#define PIVOTSEARCH_H
+
+#include "Database.h"
+#include "SearchDeadline.h"
+#include <QBitArray>
+#include <QList>
+#include <QVector>
+#include <QtGlobal>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Exact search of the database, which skips histograms with the
+ * distances to pivot histograms (LAESA).
+ *
+ * The square root of the weighted Chi square distance is a metric: the
+ * square root of the Chi square distance of each patch (the triangular
+ * discrimination) is a metric, and the square root of a weighted sum of the
+ * squares of metrics is a metric too. So for any pivot p
+ *
+ *    sqrt(d(q, x)) >= |sqrt(d(q, p)) - sqrt(d(x, p))|
+ *
+ * The distances of the histograms of the database to a few pivots are kept
+ * in a table. A histogram is compared to the pivots first, and a histogram
+ * of the database is skipped if the bound of some pivot shows that it can't
+ * be nearer than the best match so far (or the threshold). The result is the
+ * same as the result of comparing to all histograms.
+ *
+ * The pivots are chosen far from each other among the first histograms of the
+ * database, and kept until the database is cleared or loaded. The distances
+ * are kept by arena slot, so only the histograms added since the last update
+ * are compared to the pivots.
+ */
+class PivotSearch
+{
+public:
+    struct Result
+    {
+        Result() :
+            distance(std::numeric_limits<float>::max()),
+            personId(std::numeric_limits<quint32>::max()),
+            histogramsCompared(0),
+            histogramsPruned(0),
+            patchesEvaluated(0),
+            completed(true) {}
+
+        float distance;                 /**< The smallest distance below the bound. */
+        quint32 personId;               /**< Person of the smallest distance. */
+        quint32 histogramsCompared;     /**< Comparisons to pivots and histograms. */
+        quint32 histogramsPruned;       /**< Histograms skipped by the bounds. */
+        quint64 patchesEvaluated;       /**< Patches compared in the comparisons. */
+        bool completed;                 /**< False, if the deadline was over. */
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param pivotCount    Number of pivots.
+     */
+    explicit PivotSearch(const int pivotCount);
+
+    /**
+     * @brief Update the pivot table to the given snapshot, unless it has been
+     * updated to it already.
+     */
+    void update(const Database::Snapshot &snapshot);
+    void clear();
+
+    /**
+     * @brief Search the snapshot given to the last update().
+     *
+     * @param snapshot      The snapshot given to update().
+     * @param histogram     A histogram in the form returned by
+     *                      LBPImage::toGalleryHistogram().
+     * @param bound         Distances bigger than this are not of interest.
+     * @param deadline      The time limit and the stop request of the search.
+     *                      If it is over, the search returns the best match
+     *                      found so far.
+     * @return Result       The nearest histogram below the bound.
+     */
+    Result search(const Database::Snapshot &snapshot, const cv::Mat &histogram, const float bound,
+                  const SearchDeadline &deadline = SearchDeadline());
+
+private:
+    struct Entry
+    {
+        quint32 personId;
+        quint32 trackId;
+        quint32 histogramId;
+        quint32 slot;
+    };
+
+    void selectPivots(const Database::Snapshot &snapshot);
+
+    int pivotCount;
+
+    quint64 version;
+    bool isBuilt;
+    quint32 generation;
+
+    QList<cv::Mat> pivots;          // Copies of the pivot histograms.
+    QVector<float> pivotDistances;  // Square roots of the distances to the pivots, per arena slot.
+    QBitArray computed;             // Slots whose distances have been computed.
+    QVector<Entry> entries;         // Histograms of the snapshot.
+
+    // Buffer of the search, kept to avoid reallocating it.
+    std::vector<float> queryDistances;
+
+};
+
+#endif // PIVOTSEARCH_H
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ProductQuantizer.h"
+#include "Database.h"
+#include "LBPImage.h"
+#include "Constants.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDebug>
+#include <limits>
+#include <vector>
+
+using namespace cv;
+
+const quint32 CODEBOOK_FILE_MAGIC = 0x42435150; // "PQCB"
+const quint32 CODEBOOK_FILE_VERSION = 2;
+
+// The codes are bytes.
+Q_STATIC_ASSERT(PQ_CODEWORD_COUNT > 0 && PQ_CODEWORD_COUNT <= 256);
+
+static int binCount()
+{
+    return LBPImage::histogramSize() / LBPImage::patchCount();
+}
+
+ProductQuantizer::ProductQuantizer() :
+    lbpDescriptor(DEFAULT_LBP_DESCRIPTOR)
+{
+}
+
+int ProductQuantizer::codeSize()
+{
+    return LBPImage::patchCount();
+}
+
+int ProductQuantizer::distanceTableSize()
+{
+    return LBPImage::patchCount() * PQ_CODEWORD_COUNT;
+}
+
+bool ProductQuantizer::train(const QList<Mat> &histograms, const int descriptor)
+{
+    const int patches = LBPImage::patchCount();
+    const int bins = binCount();
+
+    // Hellinger embeddings of the histograms, a row per histogram.
+    Mat embeddings(histograms.size(), LBPImage::histogramSize(), CV_32FC1);
+    int count = 0;
+
+    for (int i = 0; i < histograms.size(); i++)
+    {
+        if (LBPImage::embedHistogram(histograms.at(i), embeddings.ptr<float>(count)))
+        {
+            count++;
+        }
+    }
+
+    if (count < PQ_CODEWORD_COUNT)
+    {
+        qDebug() << "Too few histograms for training codebooks:" << count;
+
+        return false;
+    }
+
+    std::vector<Mat> newCodebooks(patches);
+    std::vector<Mat> newEmbeddedCodebooks(patches);
+
+    for (int patch = 0; patch < patches; patch++)
+    {
+        // Subvectors of the patch. k-means needs them continuous.
+        const Mat samples = embeddings.rowRange(0, count).colRange(patch * bins, (patch + 1) * bins).clone();
+
+        Mat labels;
+        Mat centers;
+        kmeans(samples, PQ_CODEWORD_COUNT, labels,
+               TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, PQ_TRAINING_ITERATIONS, 1e-4),
+               1, KMEANS_PP_CENTERS, centers);
+
+        // Means of embeddings can't be negative, but clamp the rounding.
+        cv::max(centers, 0.0f, centers);
+
+        newEmbeddedCodebooks[patch] = centers;
+        newCodebooks[patch] = centers.mul(centers);
+    }
+
+    codebooks.swap(newCodebooks);
+    embeddedCodebooks.swap(newEmbeddedCodebooks);
+    lbpDescriptor = descriptor;
+
+    return true;
+}
+
+bool ProductQuantizer::encode(const Mat &histogram, uchar *code) const
+{
+    if (isEmpty())
+    {
+        return false;
+    }
+
+    std::vector<float> embedding(LBPImage::histogramSize());
+    if (!LBPImage::embedHistogram(histogram, embedding.data()))
+    {
+        return false;
+    }
+
+    const int bins = binCount();
+
+    for (int patch = 0; patch < LBPImage::patchCount(); patch++)
+    {
+        const float *subvector = embedding.data() + patch * bins;
+        const Mat &codebook = embeddedCodebooks.at(patch);
+
+        float best = std::numeric_limits<float>::max();
+        int bestCodeword = 0;
+
+        for (int i = 0; i < codebook.rows; i++)
+        {
+            const float *codeword = codebook.ptr<float>(i);
+
+            float distance = 0.0f;
+            for (int j = 0; j < bins; j++)
+            {
+                const float diff = subvector[j] - codeword[j];
+                distance += diff * diff;
+            }
+
+            if (distance < best)
+            {
+                best = distance;
+                bestCodeword = i;
+            }
+        }
+
+        code[patch] = static_cast<uchar>(bestCodeword);
+    }
+
+    return true;
+}
+
+bool ProductQuantizer::distanceTable(const Mat &histogram, float *table) const
+{
+    if (isEmpty())
+    {
+        return false;
+    }
+
+    // The weighted histogram is the square of the embedding.
+    std::vector<float> weighted(LBPImage::histogramSize());
+    if (!LBPImage::embedHistogram(histogram, weighted.data()))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < weighted.size(); i++)
+    {
+        weighted[i] *= weighted[i];
+    }
+
+    const int bins = binCount();
+
+    for (int patch = 0; patch < LBPImage::patchCount(); patch++)
+    {
+        const float *subvector = weighted.data() + patch * bins;
+        const Mat &codebook = codebooks.at(patch);
+
+        for (int i = 0; i < codebook.rows; i++)
+        {
+            const float *codeword = codebook.ptr<float>(i);
+
+            // Chi square distance of the patch (see LBPImage::weightedDistance()).
+            float distance = 0.0f;
+            for (int j = 0; j < bins; j++)
+            {
+                const float sum = subvector[j] + codeword[j];
+                if (sum > 0.0f)
+                {
+                    const float diff = subvector[j] - codeword[j];
+                    distance += (diff * diff) / sum;
+                }
+            }
+
+            table[patch * PQ_CODEWORD_COUNT + i] = distance;
+        }
+    }
+
+    return true;
+}
+
+float ProductQuantizer::distance(const float *table, const uchar *code)
+{
+    float distance = 0.0f;
+
+    for (int patch = 0; patch < LBPImage::patchCount(); patch++)
+    {
+        distance += table[patch * PQ_CODEWORD_COUNT + code[patch]];
+    }
+
+    return distance;
+}
+
+bool ProductQuantizer::write(const QString &filename) const
+{
+    if (isEmpty())
+    {
+        return false;
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_2);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    stream << CODEBOOK_FILE_MAGIC << CODEBOOK_FILE_VERSION << static_cast<qint32>(lbpDescriptor) << static_cast<qint32>(LBPImage::patchCount()) <<
+              static_cast<qint32>(binCount()) << static_cast<qint32>(PQ_CODEWORD_COUNT);
+
+    for (size_t patch = 0; patch < codebooks.size(); patch++)
+    {
+        const Mat &codebook = codebooks.at(patch);
+        for (int i = 0; i < codebook.rows; i++)
+        {
+            for (int j = 0; j < codebook.cols; j++)
+            {
+                stream << codebook.at<float>(i, j);
+            }
+        }
+    }
+
+    QSaveFile file(filename);
+
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+    {
+        qDebug() << "Failed to write a codebook file:" << filename;
+
+        return false;
+    }
+
+    return true;
+}
+
+bool ProductQuantizer::read(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_2);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    quint32 magic;
+    quint32 version;
+    qint32 descriptor;
+    qint32 patches;
+    qint32 bins;
+    qint32 codewords;
+
+    stream >> magic >> version >> descriptor >> patches >> bins >> codewords;
+
+    if (stream.status() != QDataStream::Ok ||
+        magic != CODEBOOK_FILE_MAGIC ||
+        version != CODEBOOK_FILE_VERSION ||
+        patches != LBPImage::patchCount() ||
+        bins != binCount() ||
+        codewords != PQ_CODEWORD_COUNT)
+    {
+        qDebug() << "Codebook file doesn't match the histograms:" << filename;
+
+        return false;
+    }
+
+    std::vector<Mat> newCodebooks(patches);
+    std::vector<Mat> newEmbeddedCodebooks(patches);
+
+    for (int patch = 0; patch < patches; patch++)
+    {
+        Mat codebook(codewords, bins, CV_32FC1);
+        for (int i = 0; i < codewords; i++)
+        {
+            for (int j = 0; j < bins; j++)
+            {
+                stream >> codebook.at<float>(i, j);
+            }
+        }
+
+        if (stream.status() != QDataStream::Ok)
+        {
+            qDebug() << "Failed to read a codebook file:" << filename;
+
+            return false;
+        }
+
+        Mat embedded;
+        cv::sqrt(cv::max(codebook, 0.0f), embedded);
+
+        newCodebooks[patch] = codebook;
+        newEmbeddedCodebooks[patch] = embedded;
+    }
+
+    codebooks.swap(newCodebooks);
+    embeddedCodebooks.swap(newEmbeddedCodebooks);
+    lbpDescriptor = descriptor;
+
+    return true;
+}
+
+bool ProductQuantizer::trainCodebook(const QString &databaseFilename, const QString &codebookFilename)
+{
+    Database db;
+
+    const bool loaded = QFileInfo(databaseFilename).suffix() == "fgb" ?
+                db.loadGallery(databaseFilename, true) :
+                db.load(databaseFilename, true);
+
+    if (!loaded)
+    {
+        return false;
+    }
+
+    const Database::SnapshotPointer snapshot = db.snapshot();
+
+    // Every step:th histogram is sampled.
+    const quint32 step = qMax(snapshot->histogramCount() / PQ_TRAINING_SAMPLE_COUNT, 1u);
+
+    QList<Mat> histograms;
+    quint32 index = 0;
+
+    for (quint32 personId = 0; personId < snapshot->personCount(); personId++)
+    {
+        for (quint32 trackId = 0; trackId < snapshot->trackCount(personId); trackId++)
+        {
+            for (quint32 histogramId = 0; histogramId < snapshot->histogramCount(personId, trackId); histogramId++, index++)
+            {
+                if (index % step == 0 && static_cast<quint32>(histograms.size()) < PQ_TRAINING_SAMPLE_COUNT)
+                {
+                    histograms.append(LBPImage::fromGalleryHistogram(snapshot->getHistogram(personId, trackId, histogramId)));
+                }
+            }
+        }
+    }
+
+    qDebug() << "Training codebooks with" << histograms.size() << "histograms.";
+
+    ProductQuantizer quantizer;
+
+    return quantizer.train(histograms, db.descriptor()) && quantizer.write(codebookFilename);
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PRODUCTQUANTIZER_H
+#define PRODUCTQUANTIZER_H
+
+#include "opencv2/opencv.hpp"
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QtGlobal>
+
+/**
+ * @brief Product quantizer of the histograms.
+ *
+ * Each patch of a weighted histogram is a subvector, which is encoded as the
+ * index of the nearest codeword of the codebook of the patch. A histogram is
+ * encoded in one byte per patch (39 bytes instead of 4606 bytes of a
+ * quantized histogram).
+ *
+ * The weighted Chi square distance is a sum over the patches, so the distance
+ * of a histogram to an encoded histogram is approximated by the sum of the
+ * distances of the patches of the histogram to the codewords of the code
+ * (asymmetric distance computation). The distances to all codewords are
+ * computed once per searched histogram (see distanceTable()), after which a
+ * code is compared with one table lookup per patch.
+ *
+ * The codebooks are trained with k-means on the Hellinger embeddings of the
+ * patches (see LBPImage::embedHistogram()), whose Euclidean distance is close
+ * to the Chi square distance, and the codewords are stored as histograms.
+ */
+class ProductQuantizer
+{
+public:
+    ProductQuantizer();
+
+    bool isEmpty() const    { return codebooks.empty(); }
+
+    /**
+     * @brief Return the size of a code in bytes (one byte per patch).
+     */
+    static int codeSize();
+
+    /**
+     * @brief Return the number of values of a distance table.
+     */
+    static int distanceTableSize();
+
+    /**
+     * @brief Train the codebooks.
+     *
+     * @param histograms    Uniform spatial histograms (as returned by
+     *                      LBPImage::histogram()). At least PQ_CODEWORD_COUNT.
+     * @param descriptor    LBP descriptor of the histograms. It is stored in
+     *                      the codebook file.
+     * @return bool         False, if there were too few valid histograms.
+     */
+    bool train(const QList<cv::Mat> &histograms, const int descriptor);
+
+    /**
+     * @brief Return the LBP descriptor of the histograms of the codebooks.
+     */
+    int descriptor() const  { return lbpDescriptor; }
+
+    /**
+     * @brief Encode a histogram.
+     *
+     * @param histogram     A uniform spatial histogram.
+     * @param code          codeSize() bytes.
+     * @return bool         False, if the histogram is not valid. Then the
+     *                      code is not written.
+     */
+    bool encode(const cv::Mat &histogram, uchar *code) const;
+
+    /**
+     * @brief Calculate the distances of the patches of a histogram to the
+     * codewords.
+     *
+     * @param histogram     A uniform spatial histogram.
+     * @param table         distanceTableSize() floats, PQ_CODEWORD_COUNT per
+     *                      patch.
+     * @return bool         False, if the histogram is not valid.
+     */
+    bool distanceTable(const cv::Mat &histogram, float *table) const;
+
+    /**
+     * @brief Return the approximate distance of a code with the distance
+     * table of a histogram.
+     */
+    static float distance(const float *table, const uchar *code);
+
+    bool write(const QString &filename) const;
+    bool read(const QString &filename);
+
+    /**
+     * @brief Train the codebooks from the histograms of a database file (.fdb
+     * or .fgb), and write them to a codebook file.
+     *
+     * At most PQ_TRAINING_SAMPLE_COUNT histograms, evenly spread over the
+     * database, are used.
+     */
+    static bool trainCodebook(const QString &databaseFilename, const QString &codebookFilename);
+
+    /**
+     * @brief Return the codebook file of a database file.
+     *
+     * The codebook is read when the database is loaded (see
+     * Database::Snapshot::quantizer()).
+     */
+    static QString filename(const QString &databaseFilename)   { return databaseFilename + ".pqc"; }
+
+private:
+    // Codewords of each patch: PQ_CODEWORD_COUNT rows of the bins of the
+    // patch, as weighted histograms and as their Hellinger embeddings.
+    std::vector<cv::Mat> codebooks;
+    std::vector<cv::Mat> embeddedCodebooks;
+    int lbpDescriptor;
+
+};
+
+#endif // PRODUCTQUANTIZER_H
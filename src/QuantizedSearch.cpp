@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "QuantizedSearch.h"
+#include "LBPImage.h"
+#include <QtGlobal>
+#include <algorithm>
+
+using namespace cv;
+
+QuantizedSearch::QuantizedSearch(const int rerankCount) :
+    rerankCount(qMax(rerankCount, 1)),
+    version(0),
+    isBuilt(false),
+    generation(0)
+{
+}
+
+bool QuantizedSearch::update(const Database::Snapshot &snapshot)
+{
+    if (isBuilt && snapshot.version() == version)
+    {
+        return !quantizer.isNull();
+    }
+
+    // Codes of another arena generation or codebook are of other histograms.
+    if (!isBuilt || snapshot.arenaGeneration() != generation || snapshot.quantizer() != quantizer)
+    {
+        codes.clear();
+        encoded.clear();
+    }
+
+    version = snapshot.version();
+    isBuilt = true;
+    generation = snapshot.arenaGeneration();
+    quantizer = snapshot.quantizer();
+
+    entries.clear();
+
+    if (quantizer.isNull())
+    {
+        return false;
+    }
+
+    const int codeSize = ProductQuantizer::codeSize();
+    entries.reserve(snapshot.histogramCount());
+
+    for (quint32 personId = 0; personId < snapshot.personCount(); personId++)
+    {
+        for (quint32 trackId = 0; trackId < snapshot.trackCount(personId); trackId++)
+        {
+            for (quint32 histogramId = 0; histogramId < snapshot.histogramCount(personId, trackId); histogramId++)
+            {
+                const quint32 slot = snapshot.histogramSlot(personId, trackId, histogramId);
+
+                if (slot >= static_cast<quint32>(encoded.size()))
+                {
+                    // Grown geometrically, slots are added one at a time.
+                    const int size = qMax(static_cast<int>(slot) + 1, encoded.size() * 2);
+                    encoded.resize(size);
+                    codes.resize(size * codeSize);
+                }
+
+                if (!encoded.testBit(slot))
+                {
+                    uchar *code = codes.data() + static_cast<size_t>(slot) * codeSize;
+                    if (!quantizer->encode(LBPImage::fromGalleryHistogram(snapshot.getHistogram(personId, trackId, histogramId)), code))
+                    {
+                        std::fill(code, code + codeSize, 0);
+                    }
+
+                    encoded.setBit(slot);
+                }
+
+                Entry entry;
+                entry.personId = personId;
+                entry.trackId = trackId;
+                entry.histogramId = histogramId;
+                entry.slot = slot;
+                entries.append(entry);
+            }
+        }
+    }
+
+    return true;
+}
+
+void QuantizedSearch::clear()
+{
+    codes.clear();
+    encoded.clear();
+    entries.clear();
+    quantizer.clear();
+    isBuilt = false;
+}
+
+QuantizedSearch::Result QuantizedSearch::search(const Database::Snapshot &snapshot, const Mat &histogram, const float bound,
+                                                const SearchDeadline &deadline)
+{
+    Result result;
+
+    if (quantizer.isNull() || entries.isEmpty())
+    {
+        return result;
+    }
+
+    table.resize(ProductQuantizer::distanceTableSize());
+    const Mat galleryHistogram = LBPImage::toGalleryHistogram(histogram);
+    if (!quantizer->distanceTable(histogram, table.data()) || galleryHistogram.empty())
+    {
+        return result;
+    }
+
+    // Approximate distances of all codes.
+    const int codeSize = ProductQuantizer::codeSize();
+    const uchar *codeData = codes.constData();
+
+    ranking.resize(entries.size());
+    for (int i = 0; i < entries.size(); i++)
+    {
+        if (i % SearchDeadline::CHECK_INTERVAL == 0 && deadline.isOver())
+        {
+            result.completed = false;
+            return result;
+        }
+
+        ranking[i] = qMakePair(ProductQuantizer::distance(table.data(), codeData + static_cast<size_t>(entries.at(i).slot) * codeSize), i);
+    }
+
+    const int count = qMin(rerankCount, entries.size());
+    std::nth_element(ranking.begin(), ranking.begin() + count - 1, ranking.end());
+
+    // Re-rank the candidates with the exact distance. The approximate
+    // distance is no bound of the exact one, so all of them are compared.
+    float best = bound;
+    for (int i = 0; i < count; i++)
+    {
+        if (i % SearchDeadline::CHECK_INTERVAL == 0 && deadline.isOver())
+        {
+            result.completed = false;
+            break;
+        }
+
+        const Entry &entry = entries.at(ranking.at(i).second);
+
+        int patchesEvaluated;
+        const float distance = LBPImage::galleryDistance(snapshot.getHistogram(entry.personId, entry.trackId, entry.histogramId), galleryHistogram,
+                                                         best, &patchesEvaluated);
+        result.histogramsCompared++;
+        result.patchesEvaluated += patchesEvaluated;
+
+        if (distance < best)
+        {
+            best = distance;
+            result.distance = distance;
+            result.personId = entry.personId;
+        }
+    }
+
+    return result;
+}
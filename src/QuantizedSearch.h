@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QUANTIZEDSEARCH_H
+#define QUANTIZEDSEARCH_H
+
+#include "Database.h"
+#include "SearchDeadline.h"
+#include "ProductQuantizer.h"
+#include <QBitArray>
+#include <QSharedPointer>
+#include <QVector>
+#include <QPair>
+#include <QtGlobal>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief Search of the database with product quantized codes of the
+ * histograms (see ProductQuantizer).
+ *
+ * The histograms are encoded with the codebook of the snapshot, and the codes
+ * are kept by arena slot, so only the histograms added since the last update
+ * are encoded. A histogram is compared to all codes with the distance table
+ * of the histogram, and the candidates with the smallest approximate
+ * distances are re-ranked with the exact distance. The histograms are read
+ * only for the re-ranking, so with a gallery file (see
+ * Database::loadGallery()) most of the gallery stays on disk and only the
+ * codes (39 bytes per histogram) are in memory.
+ */
+class QuantizedSearch
+{
+public:
+    struct Result
+    {
+        Result() :
+            distance(std::numeric_limits<float>::max()),
+            personId(std::numeric_limits<quint32>::max()),
+            histogramsCompared(0),
+            patchesEvaluated(0),
+            completed(true) {}
+
+        float distance;                 /**< The smallest distance below the bound. */
+        quint32 personId;               /**< Person of the smallest distance. */
+        quint32 histogramsCompared;     /**< Exact comparisons of re-ranking. */
+        quint64 patchesEvaluated;       /**< Patches compared in them. */
+        bool completed;                 /**< False, if the deadline was over. */
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param rerankCount   Maximum number of candidates re-ranked with the
+     *                      exact distance per histogram.
+     */
+    explicit QuantizedSearch(const int rerankCount);
+
+    void setRerankCount(const int count)    { rerankCount = qMax(count, 1); }
+    int getRerankCount() const              { return rerankCount; }
+
+    /**
+     * @brief Encode the histograms of the given snapshot, unless they have
+     * been encoded already.
+     *
+     * @return bool     False, if the snapshot has no codebook.
+     */
+    bool update(const Database::Snapshot &snapshot);
+    void clear();
+
+    /**
+     * @brief Search the snapshot given to the last update().
+     *
+     * @param snapshot      The snapshot given to update().
+     * @param histogram     A uniform spatial histogram (as returned by
+     *                      LBPImage::histogram()).
+     * @param bound         Distances bigger than this are not of interest.
+     * @param deadline      The time limit and the stop request of the search.
+     *                      If it is over, the search returns the best match
+     *                      found so far.
+     * @return Result       The best match of the re-ranked candidates.
+     */
+    Result search(const Database::Snapshot &snapshot, const cv::Mat &histogram, const float bound,
+                  const SearchDeadline &deadline = SearchDeadline());
+
+private:
+    struct Entry
+    {
+        quint32 personId;
+        quint32 trackId;
+        quint32 histogramId;
+        quint32 slot;
+    };
+
+    int rerankCount;
+
+    quint64 version;
+    bool isBuilt;
+    quint32 generation;
+    QSharedPointer<const ProductQuantizer> quantizer;
+
+    QVector<uchar> codes;       // ProductQuantizer::codeSize() bytes per arena slot.
+    QBitArray encoded;          // Slots whose code has been computed.
+    QVector<Entry> entries;     // Histograms of the snapshot.
+
+    // Buffers of the search, kept to avoid reallocating them.
+    std::vector<float> table;
+    std::vector<QPair<float, int> > ranking;
+
+};
+
+#endif // QUANTIZEDSEARCH_H
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEARCHDEADLINE_H
+#define SEARCHDEADLINE_H
+
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QtGlobal>
+
+/**
+ * @brief The time limit and the stop request of an ongoing search.
+ *
+ * Scans of the whole database check the deadline between work units and
+ * return what they have found so far, so that time-constrained search doesn't
+ * run past its maximum time and a stop request doesn't wait for the scan.
+ */
+class SearchDeadline
+{
+public:
+    enum
+    {
+        CHECK_INTERVAL = 64     /**< Comparisons between the checks of a scan. */
+    };
+
+    /**
+     * @brief Constructor of a deadline that is never over.
+     */
+    SearchDeadline() :
+        timer(0),
+        timeLimitMs(-1),
+        stopRequested(0) {}
+
+    /**
+     * @brief Constructor.
+     *
+     * @param timer         A timer of the ongoing search.
+     * @param timeLimitMs   The deadline is over when the timer exceeds this
+     *                      limit. If negative, there is no limit.
+     * @param stopRequested If not null, the deadline is over when this is set
+     *                      (from any thread).
+     */
+    SearchDeadline(const QElapsedTimer &timer, const qint64 timeLimitMs, const QAtomicInt *stopRequested) :
+        timer(&timer),
+        timeLimitMs(timeLimitMs),
+        stopRequested(stopRequested) {}
+
+    bool isOver() const
+    {
+        return (timer && timeLimitMs >= 0 && timer->elapsed() > timeLimitMs) ||
+               (stopRequested && stopRequested->loadAcquire());
+    }
+
+private:
+    const QElapsedTimer *timer;
+    qint64 timeLimitMs;
+    const QAtomicInt *stopRequested;
+
+};
+
+#endif // SEARCHDEADLINE_H
@@ -39,6 +39,7 @@
 #include <QtGlobal>
 #include <QMutexLocker>
 #include <limits>
+#include <cmath>
 
 using namespace cv;
 using namespace FaceReco;
@@ -46,9 +47,35 @@ using namespace FaceReco;
 SearchEngine::SearchEngine(QObject *parent) :
     QObject(parent),
     shouldContinueSearching(false),
+    histogramsCompared(0),
+    patchesEvaluated(0),
+    histogramsPruned(0),
+    comparisonNsecs(0),
+    sliceSize(SEARCH_SLICE_SIZE),
+    searchMode(DEFAULT_SEARCH_MODE),
+    indexSearchWidth(HNSW_SEARCH_WIDTH),
+    probeCount(IVF_PROBE_COUNT),
+    candidateCount(SEARCH_CANDIDATE_COUNT),
+    candidateRanking(DEFAULT_CANDIDATE_RANKING),
     threshold(HISTOGRAM_DISTANCE_THRESHOLD),
+    nextEntry(0),
+    embeddedSearch(EMBEDDED_SEARCH_RERANK_COUNT),
+    quantizedSearch(PQ_RERANK_COUNT),
+    pivotSearch(PIVOT_COUNT),
+    cascadeSearch(CASCADE_FRACTION, CASCADE_MIN_COUNT),
+    batchedSearch(BATCHED_SEARCH_TILE_BYTES),
+    tally(SEARCH_CANDIDATE_BEST_COUNT),
     db(0)
 {
+    anytimeRule.enabled = ANYTIME_SEARCH_ENABLED;
+    anytimeRule.minSupportFrames = ANYTIME_MIN_SUPPORT_FRAMES;
+    anytimeRule.minVoteShare = ANYTIME_MIN_VOTE_SHARE;
+    anytimeRule.minMargin = ANYTIME_MIN_MARGIN;
+    anytimeRule.nonMatchFrames = static_cast<quint32>(std::ceil(std::log(ANYTIME_FALSE_REJECT_RATE) / std::log(1.0f - ANYTIME_FRAME_MATCH_RATE)));
+
+    qRegisterMetaType<SearchStatistics>("SearchStatistics");
+    qRegisterMetaType<QVector<SearchCandidate> >("QVector<SearchCandidate>");
+
     connect(this, SIGNAL(triggerStart(bool,quint32,quint32)), this, SLOT(handleStart(bool,quint32,quint32)), Qt::QueuedConnection);
     connect(this, SIGNAL(triggerStop(bool)), this, SLOT(handleStop(bool)), Qt::QueuedConnection);
     connect(this, SIGNAL(triggerPartialSearch(bool,quint32,quint32)), this, SLOT(handlePartialSearch(bool,quint32,quint32)), Qt::QueuedConnection);
@@ -90,6 +117,11 @@ void SearchEngine::start_TC(const quint32 minSearchTimeMs, const quint32 maxSear
 
 void SearchEngine::stop(const bool analyzeResultsSoFar)
 {
+    // The search thread may be blocked in a scan of the database, which
+    // handles the stop request only when it returns. The flag ends the scan
+    // at its next deadline check (see SearchDeadline).
+    stopRequested.storeRelease(1);
+
     emit triggerStop(analyzeResultsSoFar);
 }
 
@@ -98,10 +130,19 @@ void SearchEngine::handleStart(const bool isTimeConstrained, const quint32 param
     Q_ASSERT(parameter0 > 0);
     Q_ASSERT(db);
 
-    if (db->isEmpty())
+    // The search is done with the histograms in the database at this point.
+    // Histograms added during the search are not searched.
+    nextEntry = 0;
+    snapshot = db->snapshot();
+    stopRequested.storeRelease(0);
+
+    if (snapshot->histogramCount() == 0)
     {
         shouldContinueSearching = false;
+        snapshot.reset();
 
+        emit searchStatistics(SearchStatistics());
+        emit searchCandidates(QVector<SearchCandidate>());
         emit personNotFound(0, 0, 0);
     }
     else
@@ -109,9 +150,12 @@ void SearchEngine::handleStart(const bool isTimeConstrained, const quint32 param
         shouldContinueSearching = true;
         resultFound = false;
         histogramsCompared = 0;
+        patchesEvaluated = 0;
+        histogramsPruned = 0;
+        comparisonNsecs = 0;
         histogramToCompare = Mat();
-        dbIterator.reset(new Database::Iterator(*db));
         results.clear();
+        tally.clear();
         timer.restart();
 
         emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
@@ -134,6 +178,11 @@ void SearchEngine::handleStop(const bool analyzeResultsSoFar)
     }
 
     shouldContinueSearching = false;
+
+    // Release the snapshot, so that it can be deleted. The entries of the
+    // schedule are not used before the schedule is updated again.
+    nextEntry = 0;
+    snapshot.reset();
 }
 
 void SearchEngine::handlePartialSearch(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
@@ -143,72 +192,605 @@ void SearchEngine::handlePartialSearch(const bool isTimeConstrained, const quint
         return;
     }
 
-    Q_ASSERT(db);
+    Q_ASSERT(!snapshot.isNull());
+
+    switch (searchMode)
+    {
+    case SEARCH_MODE_PARALLEL:
+        searchParallel(isTimeConstrained, parameter0, parameter1);
+        break;
+    case SEARCH_MODE_EMBEDDED:
+        searchEmbedded(isTimeConstrained, parameter0, parameter1);
+        break;
+    case SEARCH_MODE_INDEXED:
+        searchIndexed(isTimeConstrained, parameter0, parameter1);
+        break;
+    case SEARCH_MODE_INVERTED_FILE:
+        searchInvertedFile(isTimeConstrained, parameter0, parameter1);
+        break;
+    case SEARCH_MODE_QUANTIZED:
+        searchQuantized(isTimeConstrained, parameter0, parameter1);
+        break;
+    case SEARCH_MODE_PIVOT:
+        searchPivot(isTimeConstrained, parameter0, parameter1);
+        break;
+    case SEARCH_MODE_CASCADE:
+        searchCascade(isTimeConstrained, parameter0, parameter1);
+        break;
+    case SEARCH_MODE_BATCHED:
+        searchBatched(isTimeConstrained, parameter0, parameter1);
+        break;
+    default:
+        searchSequential(isTimeConstrained, parameter0, parameter1);
+        break;
+    }
+}
+
+void SearchEngine::searchSequential(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    QElapsedTimer sliceTimer;
+    sliceTimer.start();
 
-    if (isTimeConstrained)
+    // The time of the slice is counted as comparison time when the slice
+    // ends, as timing every comparison would slow them down.
+    for (quint32 i = 0; i < sliceSize; i++)
     {
-        if ((timer.elapsed() > parameter1) ||
-            (timer.elapsed() > parameter0 && resultFound))
+        if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
         {
+            comparisonNsecs += sliceTimer.nsecsElapsed();
             handleStop(true);
             return;
         }
-    }
 
-    if (histogramToCompare.empty())
-    {
-        histogramToCompare = popHistogram();
         if (histogramToCompare.empty())
         {
-            // Histogram queue is empty. Go back to event loop and try again.
-            emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+            histogramToCompare = LBPImage::toGalleryHistogram(popHistogram());
+            if (histogramToCompare.empty())
+            {
+                // Histogram queue is empty. Go back to event loop and try
+                // again.
+                break;
+            }
+
+            // Recomputed only if the snapshot has changed since the last
+            // search.
+            schedule.update(*snapshot);
+            nextEntry = schedule.begin();
+        }
+
+        const SearchSchedule::Entry &entry = *nextEntry;
+        const Mat databaseHistogram = schedule.histogram(entry);
+
+        // Only distances below the threshold matter, so the comparison can be
+        // abandoned as soon as the threshold is exceeded.
+        int patches;
+        const float distance = LBPImage::galleryDistance(databaseHistogram, histogramToCompare, threshold, &patches);
+        histogramsCompared++;
+        patchesEvaluated += patches;
+
+        ++nextEntry;
+
+        bool stopSearching = false;
+
+        if (distance < threshold)
+        {
+            stopSearching = appendResult(isTimeConstrained, parameter0, distance, entry.personId);
+            histogramToCompare = Mat();
+        }
+        else if (nextEntry == schedule.end())
+        {
+            // Whole database iterated through. No person found for current
+            // histogram.
+            stopSearching = appendResult(isTimeConstrained, parameter0,
+                                         std::numeric_limits<float>::max(),
+                                         std::numeric_limits<quint32>::max());
+            histogramToCompare = Mat();
+        }
+
+        if (stopSearching)
+        {
+            comparisonNsecs += sliceTimer.nsecsElapsed();
+            handleStop(true);
             return;
         }
 
-        dbIterator->reset();
+        if (sliceTimer.elapsed() >= SEARCH_SLICE_TIME_MS)
+        {
+            break;
+        }
+    }
+
+    comparisonNsecs += sliceTimer.nsecsElapsed();
+
+    // Go back to event loop before the next slice, so that stop requests are
+    // handled.
+    emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+}
+
+void SearchEngine::searchParallel(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
+    {
+        handleStop(true);
+        return;
     }
 
-    const Database::Indices indices = dbIterator->indices();
-    const Mat &databaseHistogram = db->getHistogram(indices.personId,
-                                                    indices.trackId,
-                                                    indices.histogramId);
+    const Mat histogram = LBPImage::toGalleryHistogram(popHistogram());
+    if (histogram.empty())
+    {
+        // Histogram queue is empty. Go back to event loop and try again.
+        emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
 
-    const float distance = LBPImage::distance(databaseHistogram, histogramToCompare);
-    histogramsCompared++;
+    if (parallelSearch.isNull())
+    {
+        parallelSearch.reset(new ParallelSearch(SEARCH_THREAD_COUNT));
+    }
 
-    ++(*dbIterator.data());
+    const ParallelSearch::Result result = parallelSearch->search(*snapshot, histogram, threshold, searchDeadline(isTimeConstrained, parameter1));
+    histogramsCompared += result.histogramsCompared;
+    patchesEvaluated += result.patchesEvaluated;
+    comparisonNsecs += result.nsecsElapsed;
 
-    bool resultAppended = false;
+    bool stopSearching = false;
 
-    if (distance < threshold)
+    if (result.distance < threshold)
     {
-        results.append(qMakePair(distance, indices.personId));
-        resultAppended = true;
-        resultFound = true;
+        stopSearching = appendResult(isTimeConstrained, parameter0, result.distance, result.personId, result.personDistances);
     }
-    else if (dbIterator->isAtBeginning())
+    else if (result.completed)
     {
-        // Whole database iterated through. No person found for current
-        // histogram.
-        results.append(qMakePair(std::numeric_limits<float>::max(),
-                                 std::numeric_limits<quint32>::max()));
-        resultAppended = true;
+        // Whole database searched. No person found for this histogram.
+        stopSearching = appendResult(isTimeConstrained, parameter0,
+                                     std::numeric_limits<float>::max(),
+                                     std::numeric_limits<quint32>::max());
+    }
+
+    if (stopSearching)
+    {
+        handleStop(true);
+        return;
     }
 
-    if (resultAppended)
+    emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+}
+
+void SearchEngine::searchEmbedded(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
     {
-        if (!isTimeConstrained && results.size() == parameter0)
+        handleStop(true);
+        return;
+    }
+
+    // Queued histograms are searched in blocks. The rest stay queued for the
+    // next call, so the time of a call stays bounded.
+    QList<Mat> block;
+    while (block.size() < EMBEDDED_SEARCH_BLOCK_SIZE)
+    {
+        const Mat histogram = popHistogram();
+        if (histogram.empty())
+        {
+            break;
+        }
+
+        block.append(histogram);
+    }
+
+    if (block.isEmpty())
+    {
+        // Histogram queue is empty. Go back to event loop and try again.
+        emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    QElapsedTimer searchTimer;
+    searchTimer.start();
+
+    // Recomputed only if the snapshot has changed since the last search.
+    embeddedSearch.update(*snapshot);
+    const QVector<EmbeddedSearch::Result> blockResults = embeddedSearch.search(block, threshold, searchDeadline(isTimeConstrained, parameter1));
+
+    comparisonNsecs += searchTimer.nsecsElapsed();
+
+    for (int i = 0; i < blockResults.size(); i++)
+    {
+        const EmbeddedSearch::Result &result = blockResults.at(i);
+        histogramsCompared += result.histogramsCompared;
+        patchesEvaluated += result.patchesEvaluated;
+
+        // A histogram whose search was cut by the deadline is not found only
+        // if the whole database was searched.
+        bool stopSearching = false;
+
+        if (result.distance < threshold)
+        {
+            stopSearching = appendResult(isTimeConstrained, parameter0, result.distance, result.personId);
+        }
+        else if (result.completed)
+        {
+            stopSearching = appendResult(isTimeConstrained, parameter0, std::numeric_limits<float>::max(), std::numeric_limits<quint32>::max());
+        }
+
+        if (stopSearching)
         {
             handleStop(true);
             return;
         }
+    }
 
-        histogramToCompare = Mat();
+    emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+}
+
+void SearchEngine::searchIndexed(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    if (!HNSW_INDEX_ENABLED)
+    {
+        // The database has no index.
+        searchSequential(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
+    {
+        handleStop(true);
+        return;
+    }
+
+    const Mat histogram = LBPImage::toGalleryHistogram(popHistogram());
+    if (histogram.empty())
+    {
+        // Histogram queue is empty. Go back to event loop and try again.
+        emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    QElapsedTimer searchTimer;
+    searchTimer.start();
+
+    // The index is of the current database, not of the snapshot of the
+    // search, so histograms added during the search may be found too.
+    quint32 personId = std::numeric_limits<quint32>::max();
+    const HnswIndex::Result result = db->searchIndex(histogram, indexSearchWidth, threshold, &personId);
+
+    comparisonNsecs += searchTimer.nsecsElapsed();
+    histogramsCompared += result.histogramsCompared;
+    patchesEvaluated += result.patchesEvaluated;
+
+    // The result of the index is final, even though the nearest histogram
+    // may have been missed.
+    const bool stopSearching = result.distance < threshold ?
+                appendResult(isTimeConstrained, parameter0, result.distance, personId) :
+                appendResult(isTimeConstrained, parameter0, std::numeric_limits<float>::max(), std::numeric_limits<quint32>::max());
+
+    if (stopSearching)
+    {
+        handleStop(true);
+        return;
     }
 
     emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
 }
 
+void SearchEngine::searchInvertedFile(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
+    {
+        handleStop(true);
+        return;
+    }
+
+    const Mat histogram = popHistogram();
+    if (histogram.empty())
+    {
+        // Histogram queue is empty. Go back to event loop and try again.
+        emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    // Updated only with the histograms added since the last search.
+    invertedFileSearch.update(*snapshot);
+
+    QElapsedTimer searchTimer;
+    searchTimer.start();
+
+    const InvertedFileSearch::Result result = invertedFileSearch.search(*snapshot, histogram, probeCount, threshold, searchDeadline(isTimeConstrained, parameter1));
+
+    comparisonNsecs += searchTimer.nsecsElapsed();
+    histogramsCompared += result.histogramsCompared;
+    patchesEvaluated += result.patchesEvaluated;
+
+    // The result of the probed tracks is final, even though the nearest
+    // histogram may be in a track that was not probed.
+    // A search cut by the deadline is final only if it found a match.
+    bool stopSearching = false;
+
+    if (result.distance < threshold || result.completed)
+    {
+        stopSearching = appendResult(isTimeConstrained, parameter0, result.distance, result.personId);
+    }
+
+    if (stopSearching)
+    {
+        handleStop(true);
+        return;
+    }
+
+    emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+}
+
+void SearchEngine::searchQuantized(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    // Encodes only the histograms added since the last search.
+    if (!quantizedSearch.update(*snapshot))
+    {
+        // The database file has no codebook.
+        searchSequential(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
+    {
+        handleStop(true);
+        return;
+    }
+
+    const Mat histogram = popHistogram();
+    if (histogram.empty())
+    {
+        // Histogram queue is empty. Go back to event loop and try again.
+        emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    QElapsedTimer searchTimer;
+    searchTimer.start();
+
+    const QuantizedSearch::Result result = quantizedSearch.search(*snapshot, histogram, threshold, searchDeadline(isTimeConstrained, parameter1));
+
+    comparisonNsecs += searchTimer.nsecsElapsed();
+    histogramsCompared += result.histogramsCompared;
+    patchesEvaluated += result.patchesEvaluated;
+
+    // The result of the re-ranked candidates is final, even though the
+    // nearest histogram may not have been among them.
+    // A search cut by the deadline is final only if it found a match.
+    bool stopSearching = false;
+
+    if (result.distance < threshold || result.completed)
+    {
+        stopSearching = appendResult(isTimeConstrained, parameter0, result.distance, result.personId);
+    }
+
+    if (stopSearching)
+    {
+        handleStop(true);
+        return;
+    }
+
+    emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+}
+
+void SearchEngine::searchPivot(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
+    {
+        handleStop(true);
+        return;
+    }
+
+    const Mat histogram = LBPImage::toGalleryHistogram(popHistogram());
+    if (histogram.empty())
+    {
+        // Histogram queue is empty. Go back to event loop and try again.
+        emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    // Only the histograms added since the last search are compared to the
+    // pivots.
+    pivotSearch.update(*snapshot);
+
+    QElapsedTimer searchTimer;
+    searchTimer.start();
+
+    const PivotSearch::Result result = pivotSearch.search(*snapshot, histogram, threshold, searchDeadline(isTimeConstrained, parameter1));
+
+    comparisonNsecs += searchTimer.nsecsElapsed();
+    histogramsCompared += result.histogramsCompared;
+    histogramsPruned += result.histogramsPruned;
+    patchesEvaluated += result.patchesEvaluated;
+
+    // A search cut by the deadline is final only if it found a match.
+    bool stopSearching = false;
+
+    if (result.distance < threshold || result.completed)
+    {
+        stopSearching = appendResult(isTimeConstrained, parameter0, result.distance, result.personId);
+    }
+
+    if (stopSearching)
+    {
+        handleStop(true);
+        return;
+    }
+
+    emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+}
+
+void SearchEngine::searchCascade(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
+    {
+        handleStop(true);
+        return;
+    }
+
+    const Mat histogram = popHistogram();
+    if (histogram.empty())
+    {
+        // Histogram queue is empty. Go back to event loop and try again.
+        emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    // Only the histograms added since the last search are coarsened.
+    cascadeSearch.update(*snapshot);
+
+    QElapsedTimer searchTimer;
+    searchTimer.start();
+
+    const CascadeSearch::Result result = cascadeSearch.search(*snapshot, histogram, threshold, searchDeadline(isTimeConstrained, parameter1));
+
+    comparisonNsecs += searchTimer.nsecsElapsed();
+    histogramsCompared += result.histogramsCompared;
+    patchesEvaluated += result.patchesEvaluated;
+
+    // The result of the compared fraction is final, even though the nearest
+    // histogram may have been cut off.
+    // A search cut by the deadline is final only if it found a match.
+    bool stopSearching = false;
+
+    if (result.distance < threshold || result.completed)
+    {
+        stopSearching = appendResult(isTimeConstrained, parameter0, result.distance, result.personId);
+    }
+
+    if (stopSearching)
+    {
+        handleStop(true);
+        return;
+    }
+
+    emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+}
+
+void SearchEngine::searchBatched(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1)
+{
+    if (isSearchTimeOver(isTimeConstrained, parameter0, parameter1))
+    {
+        handleStop(true);
+        return;
+    }
+
+    // Queued histograms are searched in blocks. The rest stay queued for the
+    // next call, so the time of a call stays bounded.
+    QList<Mat> block;
+    while (block.size() < BATCHED_SEARCH_BLOCK_SIZE)
+    {
+        const Mat histogram = popHistogram();
+        if (histogram.empty())
+        {
+            break;
+        }
+
+        block.append(histogram);
+    }
+
+    if (block.isEmpty())
+    {
+        // Histogram queue is empty. Go back to event loop and try again.
+        emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+        return;
+    }
+
+    QElapsedTimer searchTimer;
+    searchTimer.start();
+
+    // Split into tiles only if the snapshot has changed since the last search.
+    batchedSearch.update(*snapshot);
+    const QVector<BatchedSearch::Result> blockResults = batchedSearch.search(*snapshot, block, threshold, searchDeadline(isTimeConstrained, parameter1));
+
+    comparisonNsecs += searchTimer.nsecsElapsed();
+
+    // Each histogram gets its own result, as if it was searched alone.
+    for (int i = 0; i < blockResults.size(); i++)
+    {
+        const BatchedSearch::Result &result = blockResults.at(i);
+        histogramsCompared += result.histogramsCompared;
+        patchesEvaluated += result.patchesEvaluated;
+
+        // A histogram whose search was cut by the deadline is not found only
+        // if the whole database was searched.
+        if (result.distance >= threshold && !result.completed)
+        {
+            continue;
+        }
+
+        if (appendResult(isTimeConstrained, parameter0, result.distance, result.personId, result.personDistances))
+        {
+            handleStop(true);
+            return;
+        }
+    }
+
+    emit triggerPartialSearch(isTimeConstrained, parameter0, parameter1);
+}
+
+SearchDeadline SearchEngine::searchDeadline(const bool isTimeConstrained, const quint32 maxSearchTimeMs) const
+{
+    // In time-constrained search the scans end at the maximum search time.
+    return SearchDeadline(timer, isTimeConstrained ? static_cast<qint64>(maxSearchTimeMs) : -1, &stopRequested);
+}
+
+bool SearchEngine::isSearchTimeOver(const bool isTimeConstrained, const quint32 minSearchTimeMs, const quint32 maxSearchTimeMs) const
+{
+    if (!isTimeConstrained)
+    {
+        return false;
+    }
+
+    return (timer.elapsed() > maxSearchTimeMs) ||
+           (timer.elapsed() > minSearchTimeMs && resultFound) ||
+           isResultCertain();
+}
+
+bool SearchEngine::isResultCertain() const
+{
+    if (!anytimeRule.enabled || tally.frameCount() == 0)
+    {
+        return false;
+    }
+
+    if (tally.matchedFrameCount() == 0)
+    {
+        return tally.frameCount() >= anytimeRule.nonMatchFrames;
+    }
+
+    // The best two persons by the smallest distance, which is also how
+    // analyzeResults() decides.
+    const QVector<SearchCandidate> best = tally.candidates(2, CANDIDATE_RANKING_MIN);
+    const SearchCandidate &first = best.at(0);
+    const float next = best.size() > 1 ? best.at(1).minDistance : threshold;
+
+    const bool isSupported = first.votes >= anytimeRule.minSupportFrames &&
+                             first.votes >= anytimeRule.minVoteShare * tally.matchedFrameCount();
+
+    // Only the exhaustive searches give the smallest distance of every person
+    // in every frame, which the margin is measured from.
+    const bool isExhaustive = searchMode == SEARCH_MODE_PARALLEL || searchMode == SEARCH_MODE_BATCHED;
+
+    return isSupported && (!isExhaustive || next - first.minDistance >= anytimeRule.minMargin);
+}
+
+bool SearchEngine::appendResult(const bool isTimeConstrained, const quint32 histogramCount, const float distance, const quint32 personId,
+                                const QVector<QPair<float, quint32> > &personDistances)
+{
+    results.append(qMakePair(distance, personId));
+
+    // Only the exhaustive searches give the distances of the other persons.
+    tally.add(distance, personId, personDistances);
+
+    if (personId != std::numeric_limits<quint32>::max())
+    {
+        resultFound = true;
+    }
+
+    // Histogram-constrained search is done when enough histograms are searched.
+    return !isTimeConstrained && results.size() == histogramCount;
+}
+
 void SearchEngine::analyzeResults()
 {
     const quint32 searchTime = timer.elapsed();
@@ -228,6 +810,22 @@ void SearchEngine::analyzeResults()
         //qDebug() << "Result:" << i << " dist:" << minDistance << " personId:" << personId;
     }
 
+    SearchStatistics statistics;
+    if (histogramsCompared > 0)
+    {
+        statistics.patchesEvaluated = static_cast<float>(patchesEvaluated) / (static_cast<float>(histogramsCompared) * LBPImage::patchCount());
+        statistics.comparisonTime = static_cast<float>(comparisonNsecs) / (1000.0f * histogramsCompared);
+        statistics.pruningRate = static_cast<float>(histogramsPruned) / (static_cast<float>(histogramsPruned) + histogramsCompared);
+    }
+
+    if (!snapshot.isNull())
+    {
+        statistics.compression = snapshot->compression();
+    }
+
+    emit searchStatistics(statistics);
+    emit searchCandidates(tally.candidates(candidateCount, candidateRanking));
+
     if (personId == std::numeric_limits<quint32>::max())
     {
         emit personNotFound(searchTime, histogramsSearched, histogramsCompared);
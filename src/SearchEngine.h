@@ -33,17 +33,72 @@
 #define SEARCHENGINE_H
 
 #include "Database.h"
+#include "ParallelSearch.h"
+#include "EmbeddedSearch.h"
+#include "InvertedFileSearch.h"
+#include "QuantizedSearch.h"
+#include "PivotSearch.h"
+#include "CascadeSearch.h"
+#include "BatchedSearch.h"
+#include "SearchDeadline.h"
+#include "CandidateTally.h"
+#include "SearchSchedule.h"
 #include <QObject>
 #include <QScopedPointer>
 #include <QList>
 #include <QMutex>
+#include <QAtomicInt>
 #include <QPair>
 #include <QElapsedTimer>
+#include <QtGlobal>
+#include <QMetaType>
+
+/**
+ * @brief Statistics of one search, in addition to those given with the result.
+ */
+struct SearchStatistics
+{
+    SearchStatistics() : patchesEvaluated(0.0f), compression(1.0f), comparisonTime(0.0f), pruningRate(0.0f) {}
+
+    float patchesEvaluated; /**< Average fraction of patches evaluated per comparison. */
+    float compression;      /**< Dense size of the database histograms divided by their stored size. */
+    float comparisonTime;   /**< Average time of one comparison in microseconds (per thread). */
+    float pruningRate;      /**< Fraction of the histograms skipped without comparing (SEARCH_MODE_PIVOT). */
+};
+
+Q_DECLARE_METATYPE(SearchStatistics)
 
 class SearchEngine : public QObject
 {
     Q_OBJECT
 public:
+    /**
+     * @brief Rule for ending time-constrained search before the minimum
+     * search time, when the result is already certain.
+     *
+     * The search ends as found when the person of the smallest distance so
+     * far is the best match of at least minSupportFrames frames and of at
+     * least minVoteShare of the matched frames, and the smallest distance of
+     * any other person (or the threshold, if no other person matched) is at
+     * least minMargin bigger. The search ends as not found when
+     * nonMatchFrames frames have been searched without a match.
+     *
+     * The margin is required only in SEARCH_MODE_PARALLEL and
+     * SEARCH_MODE_BATCHED. The other modes stop at the first match of a frame
+     * and don't know the distances of the other persons, so in them the
+     * support of the frames is enough.
+     */
+    struct AnytimeRule
+    {
+        AnytimeRule() : enabled(false), minSupportFrames(0), minVoteShare(0.0f), minMargin(0.0f), nonMatchFrames(0) {}
+
+        bool enabled;
+        quint32 minSupportFrames;
+        float minVoteShare;
+        float minMargin;
+        quint32 nonMatchFrames;
+    };
+
     explicit SearchEngine(QObject *parent = 0);
 
     void setDatabase(Database *db)   { this->db = db; }
@@ -53,6 +108,84 @@ public:
     float distanceThreshold() const { return threshold; }
     void setDistanceThreshold(const float t)    { threshold = t; }
 
+    /**
+     * @brief Set maximum number of comparisons done in one search slice.
+     *
+     * The search is done in slices, and between the slices the control is
+     * returned to the event loop of the search engine thread. The bigger the
+     * slice, the less overhead there is, but the slower the search engine
+     * reacts to new histograms and stop requests. Value 1 makes the search
+     * engine return to the event loop after every comparison.
+     *
+     * NOTE: The slice ends also when it has lasted SEARCH_SLICE_TIME_MS.
+     *
+     * @param comparisons   Number of comparisons in one slice (at least 1).
+     */
+    void setSliceSize(const quint32 comparisons)   { sliceSize = qMax(comparisons, 1u); }
+
+    /**
+     * @brief Set search mode.
+     *
+     * NOTE: The mode should not be changed while searching.
+     *
+     * @param mode  SEARCH_MODE_SEQUENTIAL, SEARCH_MODE_PARALLEL,
+     *              SEARCH_MODE_EMBEDDED, SEARCH_MODE_INDEXED,
+     *              SEARCH_MODE_INVERTED_FILE, SEARCH_MODE_QUANTIZED,
+     *              SEARCH_MODE_PIVOT, SEARCH_MODE_CASCADE or
+     *              SEARCH_MODE_BATCHED.
+     */
+    void setSearchMode(const int mode)  { searchMode = mode; }
+    int getSearchMode() const           { return searchMode; }
+
+    /**
+     * @brief Set the number of best nodes kept in SEARCH_MODE_INDEXED (see
+     * HnswIndex::search()).
+     */
+    void setIndexSearchWidth(const int ef)  { indexSearchWidth = qMax(ef, 1); }
+    int getIndexSearchWidth() const         { return indexSearchWidth; }
+
+    /**
+     * @brief Set the number of tracks compared exactly in
+     * SEARCH_MODE_INVERTED_FILE (see InvertedFileSearch::search()).
+     */
+    void setProbeCount(const int count) { probeCount = qMax(count, 1); }
+    int getProbeCount() const           { return probeCount; }
+
+    /**
+     * @brief Set the number of candidates re-ranked with the exact distance
+     * in SEARCH_MODE_QUANTIZED.
+     */
+    void setQuantizedRerankCount(const int count)   { quantizedSearch.setRerankCount(count); }
+    int getQuantizedRerankCount() const             { return quantizedSearch.getRerankCount(); }
+
+    /**
+     * @brief Set the cutoff of SEARCH_MODE_CASCADE: the fraction of the
+     * histograms (but at least minCount) compared with the full distance.
+     */
+    void setCascadeCutoff(const float fraction, const int minCount) { cascadeSearch.setCutoff(fraction, minCount); }
+    float getCascadeFraction() const                                { return cascadeSearch.getFraction(); }
+    int getCascadeMinCount() const                                  { return cascadeSearch.getMinCount(); }
+
+    /**
+     * @brief Set the number of candidates reported by searchCandidates() and
+     * their ranking (CANDIDATE_RANKING_MIN, CANDIDATE_RANKING_MEAN_BEST or
+     * CANDIDATE_RANKING_VOTES).
+     *
+     * NOTE: These should not be changed while searching.
+     */
+    void setCandidateCount(const int count)     { candidateCount = qMax(count, 0); }
+    int getCandidateCount() const               { return candidateCount; }
+    void setCandidateRanking(const int ranking) { candidateRanking = ranking; }
+    int getCandidateRanking() const             { return candidateRanking; }
+
+    /**
+     * @brief Set the rule for ending time-constrained search early.
+     *
+     * NOTE: The rule should not be changed while searching.
+     */
+    void setAnytimeRule(const AnytimeRule &rule)    { anytimeRule = rule; }
+    AnytimeRule getAnytimeRule() const              { return anytimeRule; }
+
     /**
      * @brief Start histogram-constrained search.
      *
@@ -84,6 +217,22 @@ private:
     const cv::Mat popHistogram();
     void analyzeResults();
 
+    void searchSequential(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+    void searchParallel(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+    void searchEmbedded(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+    void searchIndexed(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+    void searchInvertedFile(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+    void searchQuantized(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+    void searchPivot(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+    void searchCascade(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+    void searchBatched(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
+
+    bool isSearchTimeOver(const bool isTimeConstrained, const quint32 minSearchTimeMs, const quint32 maxSearchTimeMs) const;
+    SearchDeadline searchDeadline(const bool isTimeConstrained, const quint32 maxSearchTimeMs) const;
+    bool isResultCertain() const;
+    bool appendResult(const bool isTimeConstrained, const quint32 histogramCount, const float distance, const quint32 personId,
+                      const QVector<QPair<float, quint32> > &personDistances = QVector<QPair<float, quint32> >());
+
 signals:
     void triggerStart(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
     void triggerStop(const bool analyzeResultsSoFar);
@@ -91,6 +240,18 @@ signals:
     void personFound(const quint32 personId, const quint32 searchTime, const quint32 histogramsSearched, const quint32 histogramsCompared);
     void personNotFound(const quint32 searchTime, const quint32 histogramsSearched, const quint32 histogramsCompared);
 
+    /**
+     * @brief Emitted right before personFound() or personNotFound().
+     */
+    void searchStatistics(const SearchStatistics &statistics);
+
+    /**
+     * @brief Emitted right before personFound() or personNotFound(), with the
+     * best candidates of the search aggregated over the searched frames (see
+     * setCandidateCount()).
+     */
+    void searchCandidates(const QVector<SearchCandidate> &candidates);
+
 private slots:
     void handleStart(const bool isTimeConstrained, const quint32 parameter0, const quint32 parameter1);
     void handleStop(const bool analyzeResultsSoFar);
@@ -102,19 +263,60 @@ private:
 
     QMutex  dataMutex;
 
+    // Set by stop() from any thread, cleared when a search starts.
+    QAtomicInt stopRequested;
+
     QElapsedTimer timer;
 
     quint32 histogramsCompared;
+    quint64 patchesEvaluated;
+    quint32 histogramsPruned;
+    quint64 comparisonNsecs;    // Time spent in comparing, summed over threads.
+    quint32 sliceSize;
+    int searchMode;
+    int indexSearchWidth;
+    int probeCount;
+    int candidateCount;
+    int candidateRanking;
+    AnytimeRule anytimeRule;
 
     QList<cv::Mat>  histograms;
     cv::Mat histogramToCompare;
 
     float threshold;
 
-    QScopedPointer<Database::Iterator> dbIterator;
+    // Snapshot of the database pinned for the ongoing search.
+    Database::SnapshotPointer snapshot;
+
+    // Order of the sequential search, and the next histogram to compare. The
+    // schedule is kept between searches.
+    SearchSchedule schedule;
+    const SearchSchedule::Entry *nextEntry;
+    QScopedPointer<ParallelSearch> parallelSearch;
+
+    // Embeddings of the database, kept between searches.
+    EmbeddedSearch embeddedSearch;
+
+    // Centroids of the tracks of the database, kept between searches.
+    InvertedFileSearch invertedFileSearch;
+
+    // Codes of the histograms of the database, kept between searches.
+    QuantizedSearch quantizedSearch;
+
+    // Pivot table of the database, kept between searches.
+    PivotSearch pivotSearch;
+
+    // Coarse histograms of the database, kept between searches.
+    CascadeSearch cascadeSearch;
+
+    // Tiles of the database, kept between searches.
+    BatchedSearch batchedSearch;
 
     QList<QPair<float, quint32> > results; /**< Contains distance (float) and personId (quint32) */
 
+    // Results of the search by person.
+    CandidateTally tally;
+
     Database *db;
 
 };
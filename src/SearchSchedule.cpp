@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SearchSchedule.h"
+
+SearchSchedule::SearchSchedule() :
+    version(0),
+    isBuilt(false),
+    histogramType(CV_32FC1)
+{
+}
+
+void SearchSchedule::update(const Database::Snapshot &snapshot)
+{
+    if (isBuilt && snapshot.version() == version)
+    {
+        return;
+    }
+
+    version = snapshot.version();
+    isBuilt = true;
+    histogramType = snapshot.histogramType();
+
+    const quint32 personCount = snapshot.personCount();
+    const quint32 histogramCount = snapshot.histogramCount();
+
+    entries.resize(histogramCount);
+    personOrder.resize(histogramCount);
+    personStart.resize(personCount + 1);
+
+    // Order the histograms of each person by taking one histogram from each
+    // track in turns. Tracks with no histograms left are dropped from the
+    // active list, so that the work is linear in the number of histograms.
+    quint32 n = 0;
+    for (quint32 personId = 0; personId < personCount; personId++)
+    {
+        personStart[personId] = n;
+
+        active.clear();
+        for (quint32 trackId = 0; trackId < snapshot.trackCount(personId); trackId++)
+        {
+            if (snapshot.histogramCount(personId, trackId) > 0)
+            {
+                active.append(trackId);
+            }
+        }
+
+        for (quint32 histogramId = 0; !active.isEmpty(); histogramId++)
+        {
+            int remaining = 0;
+            for (int i = 0; i < active.size(); i++)
+            {
+                const quint32 trackId = active.at(i);
+                Entry &entry = personOrder[n++];
+                entry.histogram = snapshot.histogramData(personId, trackId, histogramId);
+                entry.personId = personId;
+                entry.histogramSize = snapshot.histogramSize(personId, trackId, histogramId);
+
+                if (histogramId + 1 < snapshot.histogramCount(personId, trackId))
+                {
+                    active[remaining++] = trackId;
+                }
+            }
+
+            active.resize(remaining);
+        }
+    }
+
+    personStart[personCount] = n;
+
+    // Interleave the persons the same way.
+    active.clear();
+    for (quint32 personId = 0; personId < personCount; personId++)
+    {
+        if (personStart.at(personId + 1) > personStart.at(personId))
+        {
+            active.append(personId);
+        }
+    }
+
+    Entry *entry = entries.data();
+    for (quint32 round = 0; !active.isEmpty(); round++)
+    {
+        int remaining = 0;
+        for (int i = 0; i < active.size(); i++)
+        {
+            const quint32 personId = active.at(i);
+            const quint32 position = personStart.at(personId) + round;
+
+            *entry++ = personOrder.at(position);
+
+            if (position + 1 < personStart.at(personId + 1))
+            {
+                active[remaining++] = personId;
+            }
+        }
+
+        active.resize(remaining);
+    }
+}
+
+void SearchSchedule::clear()
+{
+    entries.clear();
+    isBuilt = false;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEARCHSCHEDULE_H
+#define SEARCHSCHEDULE_H
+
+#include "Database.h"
+#include <QVector>
+
+/**
+ * @brief The order in which the histograms of a snapshot are searched.
+ *
+ * Persons are visited in turns, so that every person is sampled early in the
+ * search, and the histograms of a person are taken from its tracks in turns.
+ * For example, with persons A (tracks A1, A2) and B (track B1), the order is
+ * A1[0], B1[0], A2[0], B1[1], A1[1], ... Persons and tracks that run out of
+ * histograms are skipped.
+ *
+ * The order is computed once per snapshot version to a flat array, so that
+ * advancing in the search is a pointer increment. The entries point to the
+ * histograms of the snapshot, and are valid as long as the snapshot is
+ * referenced.
+ */
+class SearchSchedule
+{
+public:
+    struct Entry
+    {
+        const uchar *histogram;
+        quint32 personId;
+        int histogramSize;      // Number of values in the histogram.
+    };
+
+    SearchSchedule();
+
+    /**
+     * @brief Compute the order for the given snapshot, unless it has been
+     * computed for it already.
+     */
+    void update(const Database::Snapshot &snapshot);
+    void clear();
+
+    bool isEmpty() const        { return entries.isEmpty(); }
+    quint32 size() const        { return entries.size(); }
+
+    const Entry* begin() const  { return entries.constData(); }
+    const Entry* end() const    { return entries.constData() + entries.size(); }
+
+    /**
+     * @brief Return the histogram of an entry as a Mat header (no copying).
+     */
+    const cv::Mat histogram(const Entry &entry) const
+    {
+        return cv::Mat(1, entry.histogramSize, histogramType, const_cast<uchar*>(entry.histogram));
+    }
+
+private:
+    QVector<Entry> entries;
+    quint64 version;
+    bool isBuilt;
+    int histogramType;
+
+    // Buffers used in computing the order, kept to avoid reallocating them.
+    QVector<Entry> personOrder;
+    QVector<quint32> personStart;
+    QVector<quint32> active;
+
+};
+
+#endif // SEARCHSCHEDULE_H
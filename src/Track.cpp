@@ -30,46 +30,154 @@
  */
 
 #include "Track.h"
+#include "LBPImage.h"
 #include <QtGlobal>
 #include <QByteArray>
+#include <QDebug>
 
 using namespace cv;
 
 Track::Track() :
-    sizeInBytes(0)
+    sizeInBytes(0),
+    arena(0),
+    personId(0),
+    trackId(0)
 {
 }
 
-quint32 Track::addHistogram(const Mat &histogram)
+bool Track::addHistogram(const Mat &histogram)
 {
-    const quint32 histogramId = histograms.size();
+    const Mat galleryHistogram = LBPImage::toGalleryHistogram(histogram);
+    if (galleryHistogram.empty())
+    {
+        qDebug() << "Not a valid histogram for a track.";
+
+        return false;
+    }
+
+    if (arena)
+    {
+        quint32 slot;
+        if (!arena->append(galleryHistogram, personId, trackId, &slot))
+        {
+            return false;
+        }
+
+        arenaSlots.append(slot);
+    }
+    else
+    {
+        histograms.append(galleryHistogram);
+    }
 
-    histograms.append(histogram);
     sizeInBytes += histogram.step[0] * histogram.rows;
 
-    return histogramId;
+    return true;
 }
 
 const Mat Track::getHistogram(quint32 histogramId) const
 {
-    Q_ASSERT(histogramId < static_cast<quint32>(histograms.size()));
+    Q_ASSERT(histogramId < histogramCount());
 
     Mat histogram;
-    if (histogramId < static_cast<quint32>(histograms.size()))
+    if (histogramId < histogramCount())
     {
-        histogram = histograms.at(histogramId);
+        histogram = arena ? arena->histogram(arenaSlots.at(histogramId)) : histograms.at(histogramId);
     }
 
     return histogram;
 }
 
+const QList<Mat> Track::getHistograms() const
+{
+    if (!arena)
+    {
+        return histograms;
+    }
+
+    QList<Mat> list;
+    list.reserve(arenaSlots.size());
+    for (int i = 0; i < arenaSlots.size(); i++)
+    {
+        list.append(arena->histogram(arenaSlots.at(i)));
+    }
+
+    return list;
+}
+
+quint32 Track::histogramCount() const
+{
+    return arena ? arenaSlots.size() : histograms.size();
+}
+
+void Track::clear()
+{
+    // Slots in the arena are not released, the arena only grows until it is
+    // cleared.
+    histograms.clear();
+    arenaSlots.clear();
+    arena = 0;
+}
+
+void Track::attach(HistogramArena &arena, const quint32 personId, const quint32 trackId)
+{
+    this->personId = personId;
+    this->trackId = trackId;
+
+    if (this->arena)
+    {
+        Q_ASSERT(this->arena == &arena);
+
+        for (int i = 0; i < arenaSlots.size(); i++)
+        {
+            arena.setOwner(arenaSlots.at(i), personId, trackId);
+        }
+
+        return;
+    }
+
+    this->arena = &arena;
+
+    arenaSlots.reserve(histograms.size());
+    for (int i = 0; i < histograms.size(); i++)
+    {
+        // The histograms were checked when they were added.
+        quint32 slot = 0;
+        const bool ok = arena.append(histograms.at(i), personId, trackId, &slot);
+        Q_ASSERT(ok);
+        Q_UNUSED(ok);
+
+        arenaSlots.append(slot);
+    }
+
+    histograms.clear();
+}
+
+void Track::attach(HistogramArena &arena, const quint32 personId, const quint32 trackId,
+                   const quint32 firstSlot, const quint32 count, const quint64 sizeInBytes)
+{
+    Q_ASSERT(!this->arena && histograms.isEmpty());
+
+    this->arena = &arena;
+    this->personId = personId;
+    this->trackId = trackId;
+    this->sizeInBytes = sizeInBytes;
+
+    arenaSlots.resize(count);
+    for (quint32 i = 0; i < count; i++)
+    {
+        arenaSlots[i] = firstSlot + i;
+    }
+}
+
 QDataStream &operator<< (QDataStream &out, const Track &track)
 {
     out << track.sizeInBytes << track.histogramCount();
 
     for (quint32 i = 0; i < track.histogramCount(); i++)
     {
-        const Mat &histogram = track.getHistogram(i);
+        // Files always contain unweighted histograms.
+        const Mat &histogram = LBPImage::fromGalleryHistogram(track.getHistogram(i));
 
         const char* dataPtr = reinterpret_cast<char*>(histogram.data);
         const int dataSize = static_cast<int>(histogram.step[0] * histogram.rows);
@@ -102,7 +210,15 @@ QDataStream &operator>> (QDataStream &in, Track &track)
         Mat histogram;
         Mat(rows, cols, type, data.data(), step).copyTo(histogram);
 
-        track.histograms.append(histogram);
+        const Mat galleryHistogram = LBPImage::toGalleryHistogram(histogram);
+        if (galleryHistogram.empty())
+        {
+            in.setStatus(QDataStream::ReadCorruptData);
+
+            return in;
+        }
+
+        track.histograms.append(galleryHistogram);
     }
 
     return in;
@@ -111,15 +227,15 @@ QDataStream &operator>> (QDataStream &in, Track &track)
 bool Track::operator!= (const Track &otherTrack) const
 {
     if (this->sizeInBytes != otherTrack.sizeInBytes ||
-        this->histograms.size() != otherTrack.histograms.size())
+        this->histogramCount() != otherTrack.histogramCount())
     {
         return true;
     }
 
-    for (int i = 0; i < this->histograms.size(); i++)
+    for (quint32 i = 0; i < this->histogramCount(); i++)
     {
-        const Mat &histogram1 = this->histograms.at(i);
-        const Mat &histogram2 = otherTrack.histograms.at(i);
+        const Mat histogram1 = this->getHistogram(i);
+        const Mat histogram2 = otherTrack.getHistogram(i);
 
         QByteArray h1 = QByteArray::fromRawData(reinterpret_cast<char*>(histogram1.data), static_cast<int>(histogram1.step[0] * histogram1.rows));
         QByteArray h2 = QByteArray::fromRawData(reinterpret_cast<char*>(histogram2.data), static_cast<int>(histogram2.step[0] * histogram2.rows));
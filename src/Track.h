@@ -33,21 +33,62 @@
 #define TRACK_H
 
 #include "opencv2/opencv.hpp"
+#include "HistogramArena.h"
 #include <QList>
+#include <QVector>
 #include <QDataStream>
 
+/**
+ * @brief A track of LBP histograms.
+ *
+ * Histograms are kept in the form returned by LBPImage::toGalleryHistogram(),
+ * so they must be compared with LBPImage::galleryDistance().
+ *
+ * A new track owns its histograms. When the track is attached to an arena,
+ * the histograms are moved there and the track only refers to their slots.
+ */
 class Track
 {
 public:
     Track();
 
-    quint32 addHistogram(const cv::Mat &histogram);
+    /**
+     * @brief Add a histogram to the track.
+     *
+     * @param histogram     Uniform spatial histogram (as returned by
+     *                      LBPImage::histogram()).
+     * @return bool         False, if the histogram is not valid.
+     */
+    bool addHistogram(const cv::Mat &histogram);
     const cv::Mat getHistogram(quint32 histogramId) const;
+    const QList<cv::Mat> getHistograms() const;
 
     quint64 size() const { return sizeInBytes; }
 
-    quint32 histogramCount() const  { return histograms.size(); }
-    void clear()                { histograms.clear(); }
+    quint32 histogramCount() const;
+    void clear();
+
+    /**
+     * @brief Return slots of the histograms in the arena, or an empty vector
+     * if the track is not attached.
+     */
+    const QVector<quint32> getArenaSlots() const    { return arenaSlots; }
+
+    /**
+     * @brief Move histograms to the arena, or if already attached, update the
+     * owner of the histograms in the arena.
+     */
+    void attach(HistogramArena &arena, const quint32 personId, const quint32 trackId);
+
+    /**
+     * @brief Attach an empty track to histograms already in the arena.
+     *
+     * @param firstSlot     Slot of the first histogram of the track.
+     * @param count         Number of histograms in consecutive slots.
+     * @param sizeInBytes   Size of the histograms, as returned by size().
+     */
+    void attach(HistogramArena &arena, const quint32 personId, const quint32 trackId,
+                const quint32 firstSlot, const quint32 count, const quint64 sizeInBytes);
 
     friend QDataStream &operator<< (QDataStream &out, const Track &track);
     friend QDataStream &operator>> (QDataStream &in, Track &track);
@@ -55,9 +96,14 @@ public:
     bool operator!= (const Track &otherTrack) const;
 
 private:
-    QList<cv::Mat> histograms;
+    QList<cv::Mat> histograms; // Used when not attached.
     quint64 sizeInBytes;
 
+    HistogramArena *arena;
+    QVector<quint32> arenaSlots;
+    quint32 personId;
+    quint32 trackId;
+
 };
 
 #endif // TRACK_H
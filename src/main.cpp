@@ -31,10 +31,13 @@
 
 #include "MainWindow.h"
 #include "Constants.h"
+#include "ProductQuantizer.h"
+#include "CascadeSearch.h"
 #include <QApplication>
 #include <QtGlobal>
 #include <QDebug>
 #include <QFile>
+#include <QStringList>
 
 using namespace std;
 
@@ -57,6 +60,24 @@ int main(int argc, char *argv[])
     qInstallMessageHandler(myMessageOutput);
     QApplication a(argc, argv);
 
+    // Offline training of the codebook of a database file:
+    //    FaceReco --train-codebook <database file>
+    const QStringList arguments = a.arguments();
+    if (arguments.size() == 3 && arguments.at(1) == "--train-codebook")
+    {
+        return ProductQuantizer::trainCodebook(arguments.at(2), ProductQuantizer::filename(arguments.at(2))) ? 0 : 1;
+    }
+
+    // Accuracy loss of the cascade search against the exhaustive search:
+    //    FaceReco --evaluate-cascade <gallery file> <test file> [fraction] [min]
+    if (arguments.size() >= 4 && arguments.at(1) == "--evaluate-cascade")
+    {
+        const float fraction = arguments.size() > 4 ? arguments.at(4).toFloat() : CASCADE_FRACTION;
+        const int minCount = arguments.size() > 5 ? arguments.at(5).toInt() : CASCADE_MIN_COUNT;
+
+        return CascadeSearch::evaluateFiles(arguments.at(2), arguments.at(3), fraction, minCount) ? 0 : 1;
+    }
+
     qDebug() << "========== FaceReco" << VERSION_STRING.toStdString().c_str() << "==========";
 
     try
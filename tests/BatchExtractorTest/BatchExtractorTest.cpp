@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "BatchExtractor.h"
+#include "LBPImage.h"
+#include "Constants.h"
+#include <QtTest>
+#include <QThread>
+#include <QVector>
+
+using namespace cv;
+
+class BatchExtractorTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void extract_data();
+    void extract();
+    void invalidImages();
+    void preallocatedHistograms();
+    void concurrentBatches();
+
+private:
+    QVector<Mat> faces;
+
+};
+
+namespace
+{
+
+// Histograms of the images calculated one at a time.
+Mat referenceHistograms(const QVector<Mat> &images, const int descriptor)
+{
+    Mat histograms = Mat::zeros(images.size(), LBPImage::histogramSize(), CV_32FC1);
+    for (int i = 0; i < images.size(); i++)
+    {
+        LBPImage lbpImage(images.at(i), descriptor);
+        if (!lbpImage.histogram().empty())
+        {
+            lbpImage.histogram().copyTo(histograms.row(i));
+        }
+    }
+
+    return histograms;
+}
+
+bool isEqual(const Mat &m1, const Mat &m2)
+{
+    return m1.size() == m2.size() && m1.type() == m2.type() && norm(m1, m2, NORM_INF) == 0.0;
+}
+
+class ExtractThread : public QThread
+{
+public:
+    ExtractThread(BatchExtractor &extractor, const QVector<Mat> &images, const int descriptor) :
+        extractor(extractor),
+        images(images),
+        descriptor(descriptor)
+    {
+    }
+
+    void run()
+    {
+        extractor.extract(images, descriptor, histograms);
+    }
+
+    Mat histograms;
+
+private:
+    BatchExtractor &extractor;
+    const QVector<Mat> &images;
+    const int descriptor;
+
+};
+
+}
+
+void BatchExtractorTest::initTestCase()
+{
+    RNG rng(20150116);
+
+    // More images than the workers take in one chunk each.
+    for (int i = 0; i < 101; i++)
+    {
+        Mat face(ALIGNED_FACE_IMAGE_SIZE, CV_8UC1);
+        rng.fill(face, RNG::UNIFORM, 0, 256);
+        faces.append(face);
+    }
+}
+
+void BatchExtractorTest::extract_data()
+{
+    QTest::addColumn<int>("descriptor");
+    QTest::addColumn<int>("threadCount");
+
+    QTest::newRow("R1P8, 1 thread") << LBP_DESCRIPTOR_R1P8 << 1;
+    QTest::newRow("R1P8, 4 threads") << LBP_DESCRIPTOR_R1P8 << 4;
+    QTest::newRow("R2P8, 1 thread") << LBP_DESCRIPTOR_R2P8 << 1;
+    QTest::newRow("R2P8, 4 threads") << LBP_DESCRIPTOR_R2P8 << 4;
+}
+
+void BatchExtractorTest::extract()
+{
+    QFETCH(int, descriptor);
+    QFETCH(int, threadCount);
+
+    BatchExtractor extractor(threadCount);
+
+    Mat histograms;
+    extractor.extract(faces, descriptor, histograms);
+
+    QCOMPARE(histograms.rows, faces.size());
+    QCOMPARE(histograms.cols, LBPImage::histogramSize());
+    QVERIFY(histograms.isContinuous());
+    QVERIFY(isEqual(histograms, referenceHistograms(faces, descriptor)));
+}
+
+void BatchExtractorTest::invalidImages()
+{
+    QVector<Mat> images = faces.mid(0, 20);
+    images[3] = Mat();
+    images[7] = Mat(ALIGNED_FACE_IMAGE_SIZE, CV_8UC3, Scalar::all(128));
+    images[11] = Mat(3, 3, CV_8UC1, Scalar::all(128));
+
+    BatchExtractor extractor(4);
+
+    Mat histograms;
+    extractor.extract(images, LBP_DESCRIPTOR_R2P8, histograms);
+
+    QCOMPARE(countNonZero(histograms.row(3)), 0);
+    QCOMPARE(countNonZero(histograms.row(7)), 0);
+    QCOMPARE(countNonZero(histograms.row(11)), 0);
+    QVERIFY(isEqual(histograms, referenceHistograms(images, LBP_DESCRIPTOR_R2P8)));
+}
+
+void BatchExtractorTest::preallocatedHistograms()
+{
+    BatchExtractor extractor(4);
+
+    // Garbage in the rows must not leak to the result.
+    Mat histograms(faces.size(), LBPImage::histogramSize(), CV_32FC1, Scalar::all(-1.0));
+    const uchar *data = histograms.data;
+
+    extractor.extract(faces, LBP_DESCRIPTOR_R2P8, histograms);
+
+    QVERIFY(histograms.data == data);
+    QVERIFY(isEqual(histograms, referenceHistograms(faces, LBP_DESCRIPTOR_R2P8)));
+}
+
+void BatchExtractorTest::concurrentBatches()
+{
+    BatchExtractor extractor(4);
+
+    // Two batches of different descriptors share the extractor.
+    ExtractThread thread1(extractor, faces, LBP_DESCRIPTOR_R1P8);
+    ExtractThread thread2(extractor, faces, LBP_DESCRIPTOR_R2P8);
+    thread1.start();
+    thread2.start();
+    QVERIFY(thread1.wait(60000));
+    QVERIFY(thread2.wait(60000));
+
+    QVERIFY(isEqual(thread1.histograms, referenceHistograms(faces, LBP_DESCRIPTOR_R1P8)));
+    QVERIFY(isEqual(thread2.histograms, referenceHistograms(faces, LBP_DESCRIPTOR_R2P8)));
+}
+
+QTEST_APPLESS_MAIN(BatchExtractorTest)
+
+#include "BatchExtractorTest.moc"
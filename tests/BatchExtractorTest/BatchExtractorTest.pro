@@ -0,0 +1,12 @@
+include(../tests.pri)
+
+TARGET = BatchExtractorTest
+
+HEADERS += \
+    $${SRC_DIR}/LBPImage.h \
+    $${SRC_DIR}/LBPDescriptor.h \
+    $${SRC_DIR}/BatchExtractor.h
+
+SOURCES += BatchExtractorTest.cpp \
+    $${SRC_DIR}/LBPImage.cpp \
+    $${SRC_DIR}/BatchExtractor.cpp
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2015, Marko Linna
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SearchEngine.h"
+#include "Database.h"
+#include "Person.h"
+#include "Track.h"
+#include "LBPImage.h"
+#include "Constants.h"
+#include <QtTest>
+#include <QSharedPointer>
+
+using namespace cv;
+
+class SearchEngineTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void stopsWhenFound_data();
+    void stopsWhenFound();
+    void stopsWhenNotFound_data();
+    void stopsWhenNotFound();
+    void searchesMinTimeWithoutRule();
+
+private:
+    void addModes();
+    void startSearch(SearchEngine &engine, const Mat &histogram, const int histogramCount, const quint32 searchTimeMs);
+
+    Database db;
+    Mat personHistogram;    // Histogram of the person in the database.
+    Mat strangerHistogram;  // Histogram that matches nobody.
+    float threshold;
+    SearchEngine::AnytimeRule rule;
+
+};
+
+namespace
+{
+
+// A search that is not ended by the rule lasts this long.
+const quint32 SEARCH_TIME_MS = 60000;
+
+// Number of histograms queued for a search. More than the rule needs.
+const int QUEUED_HISTOGRAMS = 50;
+
+}
+
+void SearchEngineTest::initTestCase()
+{
+    RNG rng(20150116);
+
+    Mat face(ALIGNED_FACE_IMAGE_SIZE, CV_8UC1);
+    rng.fill(face, RNG::UNIFORM, 0, 256);
+    personHistogram = LBPImage(face, db.descriptor()).histogram().clone();
+
+    // A smooth gradient has none of the patterns of the noise.
+    Mat gradient(ALIGNED_FACE_IMAGE_SIZE, CV_8UC1);
+    for (int y = 0; y < gradient.rows; y++)
+    {
+        for (int x = 0; x < gradient.cols; x++)
+        {
+            gradient.at<uchar>(y, x) = saturate_cast<uchar>(x + y);
+        }
+    }
+
+    strangerHistogram = LBPImage(gradient, db.descriptor()).histogram().clone();
+
+    QVERIFY(!personHistogram.empty());
+    QVERIFY(!strangerHistogram.empty());
+
+    // The stranger must not match, whatever the scale of the distances.
+    const float strangerDistance = LBPImage::distance(personHistogram, strangerHistogram);
+    QVERIFY(strangerDistance > 0.0f);
+    threshold = qMin(HISTOGRAM_DISTANCE_THRESHOLD, 0.5f * strangerDistance);
+
+    // The only person of the database is always within the margin of the
+    // threshold.
+    rule.enabled = true;
+    rule.minSupportFrames = 3;
+    rule.minVoteShare = 0.8f;
+    rule.minMargin = 0.5f * threshold;
+    rule.nonMatchFrames = 10;
+
+    QSharedPointer<Track> track(new Track);
+    track->addHistogram(personHistogram);
+
+    QSharedPointer<Person> person(new Person("person"));
+    person->addTrack(track);
+
+    QVERIFY(db.addPerson(person, db.descriptor()) != Database::INVALID_ID);
+}
+
+void SearchEngineTest::addModes()
+{
+    QTest::addColumn<int>("mode");
+
+    QTest::newRow("sequential") << SEARCH_MODE_SEQUENTIAL;
+    QTest::newRow("parallel") << SEARCH_MODE_PARALLEL;
+}
+
+void SearchEngineTest::startSearch(SearchEngine &engine, const Mat &histogram, const int histogramCount, const quint32 searchTimeMs)
+{
+    engine.setDatabase(&db);
+    engine.setDistanceThreshold(threshold);
+
+    for (int i = 0; i < histogramCount; i++)
+    {
+        engine.pushHistogram(histogram);
+    }
+
+    engine.start_TC(searchTimeMs, searchTimeMs);
+}
+
+void SearchEngineTest::stopsWhenFound_data()
+{
+    addModes();
+}
+
+void SearchEngineTest::stopsWhenFound()
+{
+    QFETCH(int, mode);
+
+    SearchEngine engine;
+    engine.setSearchMode(mode);
+    engine.setAnytimeRule(rule);
+
+    QSignalSpy found(&engine, SIGNAL(personFound(quint32,quint32,quint32,quint32)));
+    startSearch(engine, personHistogram, QUEUED_HISTOGRAMS, SEARCH_TIME_MS);
+
+    // The search ends after the supporting frames, long before its time.
+    QVERIFY(found.wait(SEARCH_TIME_MS / 2));
+    QCOMPARE(found.at(0).at(2).toUInt(), rule.minSupportFrames);
+    QVERIFY(found.at(0).at(1).toUInt() < SEARCH_TIME_MS);
+}
+
+void SearchEngineTest::stopsWhenNotFound_data()
+{
+    addModes();
+}
+
+void SearchEngineTest::stopsWhenNotFound()
+{
+    QFETCH(int, mode);
+
+    SearchEngine engine;
+    engine.setSearchMode(mode);
+    engine.setAnytimeRule(rule);
+
+    QSignalSpy notFound(&engine, SIGNAL(personNotFound(quint32,quint32,quint32)));
+    startSearch(engine, strangerHistogram, QUEUED_HISTOGRAMS, SEARCH_TIME_MS);
+
+    // The search ends after the frames without a match.
+    QVERIFY(notFound.wait(SEARCH_TIME_MS / 2));
+    QCOMPARE(notFound.at(0).at(1).toUInt(), rule.nonMatchFrames);
+    QVERIFY(notFound.at(0).at(0).toUInt() < SEARCH_TIME_MS);
+}
+
+void SearchEngineTest::searchesMinTimeWithoutRule()
+{
+    const quint32 searchTimeMs = 300;
+
+    SearchEngine engine;
+    engine.setSearchMode(SEARCH_MODE_SEQUENTIAL);
+    engine.setAnytimeRule(SearchEngine::AnytimeRule());
+
+    QSignalSpy found(&engine, SIGNAL(personFound(quint32,quint32,quint32,quint32)));
+    startSearch(engine, personHistogram, QUEUED_HISTOGRAMS, searchTimeMs);
+
+    // Without the rule all frames are searched, and the search lasts its
+    // minimum time.
+    QVERIFY(found.wait(SEARCH_TIME_MS / 2));
+    QCOMPARE(found.at(0).at(2).toUInt(), static_cast<uint>(QUEUED_HISTOGRAMS));
+    QVERIFY(found.at(0).at(1).toUInt() >= searchTimeMs);
+}
+
+QTEST_GUILESS_MAIN(SearchEngineTest)
+
+#include "SearchEngineTest.moc"
@@ -0,0 +1,52 @@
+include(../tests.pri)
+
+# The search engine and the database use QImage.
+QT += gui
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = SearchEngineTest
+
+HEADERS += \
+    $${SRC_DIR}/SearchEngine.h \
+    $${SRC_DIR}/Database.h \
+    $${SRC_DIR}/Person.h \
+    $${SRC_DIR}/Track.h \
+    $${SRC_DIR}/Util.h \
+    $${SRC_DIR}/LBPImage.h \
+    $${SRC_DIR}/LBPDescriptor.h \
+    $${SRC_DIR}/HistogramArena.h \
+    $${SRC_DIR}/GalleryFile.h \
+    $${SRC_DIR}/Journal.h \
+    $${SRC_DIR}/HnswIndex.h \
+    $${SRC_DIR}/ProductQuantizer.h \
+    $${SRC_DIR}/SearchSchedule.h \
+    $${SRC_DIR}/SearchDeadline.h \
+    $${SRC_DIR}/CandidateTally.h \
+    $${SRC_DIR}/ParallelSearch.h \
+    $${SRC_DIR}/EmbeddedSearch.h \
+    $${SRC_DIR}/InvertedFileSearch.h \
+    $${SRC_DIR}/QuantizedSearch.h \
+    $${SRC_DIR}/PivotSearch.h \
+    $${SRC_DIR}/CascadeSearch.h \
+    $${SRC_DIR}/BatchedSearch.h
+
+SOURCES += SearchEngineTest.cpp \
+    $${SRC_DIR}/SearchEngine.cpp \
+    $${SRC_DIR}/Database.cpp \
+    $${SRC_DIR}/Person.cpp \
+    $${SRC_DIR}/Track.cpp \
+    $${SRC_DIR}/Util.cpp \
+    $${SRC_DIR}/LBPImage.cpp \
+    $${SRC_DIR}/HistogramArena.cpp \
+    $${SRC_DIR}/Journal.cpp \
+    $${SRC_DIR}/HnswIndex.cpp \
+    $${SRC_DIR}/ProductQuantizer.cpp \
+    $${SRC_DIR}/SearchSchedule.cpp \
+    $${SRC_DIR}/CandidateTally.cpp \
+    $${SRC_DIR}/ParallelSearch.cpp \
+    $${SRC_DIR}/EmbeddedSearch.cpp \
+    $${SRC_DIR}/InvertedFileSearch.cpp \
+    $${SRC_DIR}/QuantizedSearch.cpp \
+    $${SRC_DIR}/PivotSearch.cpp \
+    $${SRC_DIR}/CascadeSearch.cpp \
+    $${SRC_DIR}/BatchedSearch.cpp
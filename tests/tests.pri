@@ -0,0 +1,27 @@
+# Common settings of the test projects. OpenCV's root path is the same as in
+# FaceReco.pro.
+
+QT       += core testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+OPENCV_ROOT = C:/OpenCV_2.4.9
+
+SRC_DIR = $$PWD/../src
+
+INCLUDEPATH += $${SRC_DIR}
+INCLUDEPATH += $${OPENCV_ROOT}/opencv/build/include
+
+win32 {
+    CONFIG( debug, debug|release ) {
+        LIBS += -L"$${OPENCV_ROOT}/opencv/build/x64/vc11/lib" -lopencv_core249d -lopencv_imgproc249d
+    } else {
+        LIBS += -L"$${OPENCV_ROOT}/opencv/build/x64/vc11/lib" -lopencv_core249 -lopencv_imgproc249
+    }
+} else {
+    LIBS += -lopencv_core -lopencv_imgproc
+}
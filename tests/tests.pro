@@ -0,0 +1,11 @@
+#-------------------------------------------------
+#
+# Unit tests of FaceReco. Run with "make check".
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    BatchExtractorTest \
+    SearchEngineTest